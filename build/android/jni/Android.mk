@@ -166,6 +166,7 @@ LOCAL_SRC_FILES :=                                \
 		jni/src/itemdef.cpp                       \
 		jni/src/keycode.cpp                       \
 		jni/src/light.cpp                         \
+		jni/src/liquidqueue.cpp                   \
 		jni/src/localplayer.cpp                   \
 		jni/src/log.cpp                           \
 		jni/src/main.cpp                          \
@@ -179,6 +180,7 @@ LOCAL_SRC_FILES :=                                \
 		jni/src/mapgen_v6.cpp                     \
 		jni/src/mapgen_v7.cpp                     \
 		jni/src/mapnode.cpp                       \
+		jni/src/mapsaver.cpp                      \
 		jni/src/mapsector.cpp                     \
 		jni/src/mesh.cpp                          \
 		jni/src/mg_biome.cpp                      \
@@ -52,6 +52,9 @@ struct ActiveObjectMessage
 	u16 id;
 	bool reliable;
 	std::string datastring;
+	// The same message in a smaller encoding for clients of protocol
+	// version 27 and later, empty if there is none
+	std::string compact_datastring;
 };
 
 /*
@@ -138,57 +138,139 @@ void MeshUpdateQueue::addBlock(v3s16 p, MeshMakeData *data, bool ack_block_to_se
 }
 
 // Returned pointer must be deleted
-// Returns NULL if queue is empty
+// Returns NULL if queue is empty or all queued blocks are in progress
 QueuedMeshUpdate *MeshUpdateQueue::pop()
 {
 	MutexAutoLock lock(m_mutex);
 
-	bool must_be_urgent = !m_urgents.empty();
+	std::vector<QueuedMeshUpdate*>::iterator nearest = m_queue.end();
+	std::vector<QueuedMeshUpdate*>::iterator nearest_urgent = m_queue.end();
+	s32 nearest_d = 0;
+	s32 nearest_urgent_d = 0;
 	for(std::vector<QueuedMeshUpdate*>::iterator
 			i = m_queue.begin();
 			i != m_queue.end(); ++i)
 	{
 		QueuedMeshUpdate *q = *i;
-		if(must_be_urgent && m_urgents.count(q->p) == 0)
+		if(m_inflight_blocks.count(q->p) != 0)
 			continue;
-		m_queue.erase(i);
-		m_urgents.erase(q->p);
-		return q;
+		v3s16 dp = q->p - m_camera_block;
+		s32 d = (s32)dp.X * dp.X + (s32)dp.Y * dp.Y + (s32)dp.Z * dp.Z;
+		if(nearest == m_queue.end() || d < nearest_d) {
+			nearest = i;
+			nearest_d = d;
+		}
+		if(m_urgents.count(q->p) != 0 &&
+				(nearest_urgent == m_queue.end() || d < nearest_urgent_d)) {
+			nearest_urgent = i;
+			nearest_urgent_d = d;
+		}
 	}
-	return NULL;
-}
 
-/*
-	MeshUpdateThread
-*/
+	if(nearest_urgent != m_queue.end())
+		nearest = nearest_urgent;
+	if(nearest == m_queue.end())
+		return NULL;
 
-void MeshUpdateThread::enqueueUpdate(v3s16 p, MeshMakeData *data,
-		bool ack_block_to_server, bool urgent)
+	QueuedMeshUpdate *q = *nearest;
+	m_queue.erase(nearest);
+	m_urgents.erase(q->p);
+	m_inflight_blocks.insert(q->p);
+	return q;
+}
+
+void MeshUpdateQueue::done(v3s16 p)
 {
-	m_queue_in.addBlock(p, data, ack_block_to_server, urgent);
-	deferUpdate();
+	MutexAutoLock lock(m_mutex);
+	m_inflight_blocks.erase(p);
 }
 
-void MeshUpdateThread::doUpdate()
+/*
+	MeshUpdateWorkerThread
+*/
+
+void MeshUpdateWorkerThread::doUpdate()
 {
 	QueuedMeshUpdate *q;
-	while ((q = m_queue_in.pop())) {
+	while ((q = m_manager->m_queue_in.pop())) {
 
 		ScopeProfiler sp(g_profiler, "Client: Mesh making");
 
-		MapBlockMesh *mesh_new = new MapBlockMesh(q->data, m_camera_offset);
+		MapBlockMesh *mesh_new = new MapBlockMesh(q->data,
+				m_manager->m_camera_offset);
 
 		MeshUpdateResult r;
 		r.p = q->p;
 		r.mesh = mesh_new;
 		r.ack_block_to_server = q->ack_block_to_server;
 
-		m_queue_out.push_back(r);
+		// Queue the result before another thread can take the block
+		m_manager->m_queue_out.push_back(r);
+		m_manager->m_queue_in.done(q->p);
 
 		delete q;
 	}
 }
 
+/*
+	MeshUpdateManager
+*/
+
+MeshUpdateManager::MeshUpdateManager()
+{
+	s16 nthreads = g_settings->getS16("num_mesh_threads");
+	if (nthreads <= 0)
+		nthreads = Thread::getNumberOfProcessors() - 2;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	for (s16 i = 0; i < nthreads; i++)
+		m_workers.push_back(new MeshUpdateWorkerThread(this));
+}
+
+MeshUpdateManager::~MeshUpdateManager()
+{
+	for (u32 i = 0; i < m_workers.size(); i++)
+		delete m_workers[i];
+}
+
+void MeshUpdateManager::start()
+{
+	infostream << "MeshUpdateManager: using " << m_workers.size()
+			<< " threads" << std::endl;
+	for (u32 i = 0; i < m_workers.size(); i++)
+		m_workers[i]->start();
+}
+
+void MeshUpdateManager::stop()
+{
+	for (u32 i = 0; i < m_workers.size(); i++)
+		m_workers[i]->stop();
+}
+
+void MeshUpdateManager::wait()
+{
+	for (u32 i = 0; i < m_workers.size(); i++)
+		m_workers[i]->wait();
+}
+
+bool MeshUpdateManager::isRunning()
+{
+	for (u32 i = 0; i < m_workers.size(); i++) {
+		if (m_workers[i]->isRunning())
+			return true;
+	}
+	return false;
+}
+
+void MeshUpdateManager::enqueueUpdate(v3s16 p, MeshMakeData *data,
+		bool ack_block_to_server, bool urgent)
+{
+	m_queue_in.addBlock(p, data, ack_block_to_server, urgent);
+	for (u32 i = 0; i < m_workers.size(); i++)
+		m_workers[i]->deferUpdate();
+}
+
 /*
 	Client
 */
@@ -217,7 +299,8 @@ Client::Client(
 	m_nodedef(nodedef),
 	m_sound(sound),
 	m_event(event),
-	m_mesh_update_thread(),
+	m_mesh_buffer_pool(new MeshBufferPool(device->getVideoDriver())),
+	m_mesh_update_manager(),
 	m_env(
 		new ClientMap(this, this, control,
 			device->getSceneManager()->getRootSceneNode(),
@@ -270,7 +353,7 @@ Client::Client(
 void Client::Stop()
 {
 	//request all client managed threads to stop
-	m_mesh_update_thread.stop();
+	m_mesh_update_manager.stop();
 	// Save local server map
 	if (m_localdb) {
 		infostream << "Local map saving ended." << std::endl;
@@ -281,7 +364,7 @@ void Client::Stop()
 bool Client::isShutdown()
 {
 
-	if (!m_mesh_update_thread.isRunning()) return true;
+	if (!m_mesh_update_manager.isRunning()) return true;
 
 	return false;
 }
@@ -290,10 +373,10 @@ Client::~Client()
 {
 	m_con.Disconnect();
 
-	m_mesh_update_thread.stop();
-	m_mesh_update_thread.wait();
-	while (!m_mesh_update_thread.m_queue_out.empty()) {
-		MeshUpdateResult r = m_mesh_update_thread.m_queue_out.pop_frontNoEx();
+	m_mesh_update_manager.stop();
+	m_mesh_update_manager.wait();
+	while (!m_mesh_update_manager.m_queue_out.empty()) {
+		MeshUpdateResult r = m_mesh_update_manager.m_queue_out.pop_frontNoEx();
 		delete r.mesh;
 	}
 
@@ -317,6 +400,9 @@ Client::~Client()
 	}
 
 	delete m_mapper;
+
+	// Block meshes still in the scene hold their own references
+	m_mesh_buffer_pool->drop();
 }
 
 void Client::connect(Address address,
@@ -526,15 +612,19 @@ void Client::step(float dtime)
 		Replace updated meshes
 	*/
 	{
+		// Blocks near the player are meshed first
+		m_mesh_update_manager.setCameraBlock(getNodeBlockPos(
+				floatToInt(player->getEyePosition(), BS)));
+
 		int num_processed_meshes = 0;
-		while (!m_mesh_update_thread.m_queue_out.empty())
+		while (!m_mesh_update_manager.m_queue_out.empty())
 		{
 			num_processed_meshes++;
 
 			MinimapMapblock *minimap_mapblock = NULL;
 			bool do_mapper_update = true;
 
-			MeshUpdateResult r = m_mesh_update_thread.m_queue_out.pop_frontNoEx();
+			MeshUpdateResult r = m_mesh_update_manager.m_queue_out.pop_frontNoEx();
 			MapBlock *block = m_env.getMap().getBlockNoCreateNoEx(r.p);
 			if (block) {
 				// Delete the old mesh
@@ -574,6 +664,8 @@ void Client::step(float dtime)
 
 		if (num_processed_meshes > 0)
 			g_profiler->graphAdd("num_processed_meshes", num_processed_meshes);
+
+		m_mesh_buffer_pool->trim();
 	}
 
 	/*
@@ -1602,10 +1694,11 @@ void Client::addUpdateMeshTask(v3s16 p, bool ack_to_server, bool urgent)
 		data->setCrack(m_crack_level, m_crack_pos);
 		data->setHighlighted(m_highlighted_pos, m_show_highlighted);
 		data->setSmoothLighting(m_cache_smooth_lighting);
+		data->setBufferPool(m_mesh_buffer_pool);
 	}
 
 	// Add task to queue
-	m_mesh_update_thread.enqueueUpdate(p, data, ack_to_server, urgent);
+	m_mesh_update_manager.enqueueUpdate(p, data, ack_to_server, urgent);
 }
 
 void Client::addUpdateMeshTaskWithEdge(v3s16 blockpos, bool ack_to_server, bool urgent)
@@ -1795,9 +1888,9 @@ void Client::afterContentReceived(IrrlichtDevice *device)
 		delete[] text;
 	}
 
-	// Start mesh update thread after setting up content definitions
-	infostream<<"- Starting mesh update thread"<<std::endl;
-	m_mesh_update_thread.start();
+	// Start mesh update threads after setting up content definitions
+	infostream<<"- Starting mesh update threads"<<std::endl;
+	m_mesh_update_manager.start();
 
 	m_state = LC_Ready;
 	sendReady();
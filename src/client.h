@@ -35,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "hud.h"
 #include "particles.h"
 #include "network/networkpacket.h"
+#include "mapblock_mesh.h"
 
 struct MeshMakeData;
 class MapBlockMesh;
@@ -68,7 +69,11 @@ enum LocalClientState {
 };
 
 /*
-	A thread-safe queue of mesh update tasks
+	A thread-safe queue of mesh update tasks.
+
+	Urgent tasks are popped first, then the ones nearest to the camera.
+	A block is not handed out again until done() has been called for it,
+	so the results of one block are produced in the order it was queued.
 */
 class MeshUpdateQueue
 {
@@ -84,9 +89,18 @@ class MeshUpdateQueue
 			bool ack_block_to_server, bool urgent);
 
 	// Returned pointer must be deleted
-	// Returns NULL if queue is empty
+	// Returns NULL if queue is empty or all queued blocks are in progress
 	QueuedMeshUpdate * pop();
 
+	// Ends the work on a block returned by pop()
+	void done(v3s16 p);
+
+	void setCameraBlock(v3s16 p)
+	{
+		MutexAutoLock lock(m_mutex);
+		m_camera_block = p;
+	}
+
 	u32 size()
 	{
 		MutexAutoLock lock(m_mutex);
@@ -96,6 +110,9 @@ class MeshUpdateQueue
 private:
 	std::vector<QueuedMeshUpdate*> m_queue;
 	std::set<v3s16> m_urgents;
+	// Blocks popped but not done yet
+	std::set<v3s16> m_inflight_blocks;
+	v3s16 m_camera_block;
 	Mutex m_mutex;
 };
 
@@ -113,23 +130,51 @@ struct MeshUpdateResult
 	}
 };
 
-class MeshUpdateThread : public UpdateThread
+class MeshUpdateManager;
+
+class MeshUpdateWorkerThread : public UpdateThread
 {
-private:
-	MeshUpdateQueue m_queue_in;
+public:
+	MeshUpdateWorkerThread(MeshUpdateManager *manager) :
+		UpdateThread("Mesh"),
+		m_manager(manager)
+	{}
 
 protected:
 	virtual void doUpdate();
 
+private:
+	MeshUpdateManager *m_manager;
+};
+
+/*
+	Makes the meshes of the queued blocks on num_mesh_threads threads
+*/
+class MeshUpdateManager
+{
 public:
+	MeshUpdateManager();
+	~MeshUpdateManager();
 
-	MeshUpdateThread() : UpdateThread("Mesh") {}
+	void start();
+	void stop();
+	void wait();
+	bool isRunning();
 
 	void enqueueUpdate(v3s16 p, MeshMakeData *data,
 			bool ack_block_to_server, bool urgent);
+	void setCameraBlock(v3s16 p)
+	{ m_queue_in.setCameraBlock(p); }
+
 	MutexedQueue<MeshUpdateResult> m_queue_out;
 
 	v3s16 m_camera_offset;
+
+private:
+	friend class MeshUpdateWorkerThread;
+
+	MeshUpdateQueue m_queue_in;
+	std::vector<MeshUpdateWorkerThread *> m_workers;
 };
 
 enum ClientEventType
@@ -476,7 +521,7 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	void addUpdateMeshTaskForNode(v3s16 nodepos, bool ack_to_server=false, bool urgent=false);
 
 	void updateCameraOffset(v3s16 camera_offset)
-	{ m_mesh_update_thread.m_camera_offset = camera_offset; }
+	{ m_mesh_update_manager.m_camera_offset = camera_offset; }
 
 	// Get event from queue. CE_NONE is returned if queue is empty.
 	ClientEvent getClientEvent();
@@ -587,7 +632,8 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	MtEventManager *m_event;
 
 
-	MeshUpdateThread m_mesh_update_thread;
+	MeshBufferPool *m_mesh_buffer_pool;
+	MeshUpdateManager m_mesh_update_manager;
 	ClientEnvironment m_env;
 	ParticleManager m_particle_manager;
 	con::Connection m_con;
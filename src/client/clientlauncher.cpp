@@ -239,6 +239,7 @@ bool ClientLauncher::run(GameParams &game_params, const Settings &cmd_args)
 			the_game(
 				kill,
 				random_input,
+				benchmark_frames,
 				input,
 				device,
 				worldspec.path,
@@ -319,6 +320,9 @@ void ClientLauncher::init_args(GameParams &game_params, const Settings &cmd_args
 
 	random_input = g_settings->getBool("random_input")
 			|| cmd_args.getFlag("random-input");
+
+	if (cmd_args.exists("benchmark"))
+		benchmark_frames = stoi(cmd_args.get("benchmark"));
 }
 
 bool ClientLauncher::init_engine()
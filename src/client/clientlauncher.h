@@ -69,6 +69,7 @@ class ClientLauncher
 		skip_main_menu(false),
 		use_freetype(false),
 		random_input(false),
+		benchmark_frames(0),
 		address(""),
 		playername(""),
 		password(""),
@@ -105,6 +106,7 @@ class ClientLauncher
 	bool skip_main_menu;
 	bool use_freetype;
 	bool random_input;
+	u32 benchmark_frames;
 	std::string address;
 	std::string playername;
 	std::string password;
@@ -418,6 +418,9 @@ class TextureSource : public IWritableTextureSource
 
 	// Queued texture fetches (to be processed by the main thread)
 	RequestQueue<std::string, u32, u8, u8> m_get_texture_queue;
+	// Other threads share one result queue, so only one of them may
+	// wait for a texture at a time
+	Mutex m_get_texture_wait_mutex;
 
 	// Textures that have been overwritten with other ones
 	// but can't be deleted because the ITexture* might still be used
@@ -510,6 +513,8 @@ u32 TextureSource::getTextureId(const std::string &name)
 	{
 		infostream<<"getTextureId(): Queued: name=\""<<name<<"\""<<std::endl;
 
+		MutexAutoLock lock(m_get_texture_wait_mutex);
+
 		// We're gonna ask the result to be put into here
 		static ResultQueue<std::string, u32, u8, u8> result_queue;
 
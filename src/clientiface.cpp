@@ -32,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serverobject.h"              // TODO this is used for cleanup of only
 #include "log.h"
 #include "util/srp.h"
+#include "util/directiontables.h"
 
 const char *ClientInterface::statenames[] = {
 	"Invalid",
@@ -61,11 +62,45 @@ void RemoteClient::ResendBlockIfOnWire(v3s16 p)
 	}
 }
 
+// Makes GetNextBlocks look at a block that was skipped before again
+void RemoteClient::RescanBlock(v3s16 p)
+{
+	if (m_blocks_sent.find(p) != m_blocks_sent.end() ||
+			m_blocks_sending.find(p) != m_blocks_sending.end())
+		return;
+
+	// GetNextBlocks goes through the blocks by this distance
+	v3s16 d = p - m_last_center;
+	s16 dist = MYMAX(MYMAX(abs(d.X), abs(d.Y)), abs(d.Z));
+	if (dist < m_nearest_unsent_d)
+		m_nearest_unsent_d = dist;
+}
+
+/*
+	Returns true if the faces of all neighbours of the block towards it are
+	opaque, so nothing in it can be seen by a player outside of it.
+	Neighbours that aren't loaded or whose faces are expired count as
+	transparent.
+*/
+static bool is_block_occluded(Map *map, v3s16 p)
+{
+	for (u8 i = 0; i < 6; i++) {
+		MapBlock *block = map->getBlockNoCreateNoExNoCache(p + g_6dirs[i]);
+		if (block == NULL)
+			return false;
+		// The face of the neighbour in the opposite direction
+		if ((block->getOpaqueFacesNoUpdate() & (1 << ((i + 3) % 6))) == 0)
+			return false;
+	}
+	return true;
+}
+
 void RemoteClient::GetNextBlocks (
 		ServerEnvironment *env,
 		EmergeManager * emerge,
 		float dtime,
-		std::vector<PrioritySortedBlockTransfer> &dest)
+		std::vector<PrioritySortedBlockTransfer> &dest,
+		std::vector<MapBlock *> &used_blocks)
 {
 	DSTACK(FUNCTION_NAME);
 
@@ -183,6 +218,8 @@ void RemoteClient::GetNextBlocks (
 	s32 nearest_sent_d = -1;
 	//bool queue_is_full = false;
 
+	bool occlusion_culling = g_settings->getBool("server_side_occlusion_culling");
+
 	s16 d;
 	for(d = d_start; d <= d_max; d++) {
 		/*
@@ -264,14 +301,15 @@ void RemoteClient::GetNextBlocks (
 			/*
 				Check if map has this block
 			*/
-			MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
+			MapBlock *block = env->getMap().getBlockNoCreateNoExNoCache(p);
 
 			bool surely_not_found_on_disk = false;
 			bool block_is_invalid = false;
 			if(block != NULL)
 			{
-				// Reset usage timer, this block will be of use in the future.
-				block->resetUsageTimer();
+				// This block will be of use in the future, the caller
+				// resets its usage timer.
+				used_blocks.push_back(block);
 
 				// Block is dummy if data doesn't exist.
 				// It means it has been not found from disk and not generated
@@ -298,7 +336,7 @@ void RemoteClient::GetNextBlocks (
 				*/
 				if(d >= 4)
 				{
-					if(block->getDayNightDiff() == false)
+					if(block->getDayNightDiffNoUpdate() == false)
 						continue;
 				}
 			}
@@ -331,6 +369,15 @@ void RemoteClient::GetNextBlocks (
 				continue;
 			}
 
+			/*
+				Don't send blocks enclosed by opaque nodes. If one of
+				the neighbours changes, the blocks around it are
+				looked at again.
+			*/
+			if(occlusion_culling && d >= 2 &&
+					is_block_occluded(&env->getMap(), p))
+				continue;
+
 			if(nearest_sent_d == -1)
 				nearest_sent_d = d;
 
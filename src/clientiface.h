@@ -254,6 +254,8 @@ class RemoteClient
 		chosen_mech(AUTH_MECHANISM_NONE),
 		auth_data(NULL),
 		m_time_from_building(9999),
+		m_known_objects_radius(-1),
+		m_known_objects_player_radius(0),
 		m_pending_serialization_version(SER_FMT_VER_INVALID),
 		m_state(CS_Created),
 		m_nearest_unsent_d(0),
@@ -277,9 +279,17 @@ class RemoteClient
 		Finds block that should be sent next to the client.
 		Environment should be locked when this is called.
 		dtime is used for resetting send radius at slow interval
+
+		The map is only read, so this can run for several clients at
+		once. The loaded blocks that were looked at are added to
+		used_blocks; their usage timers should be reset by the caller.
+		Blocks whose day-night difference is expired are selected as if
+		it differs; the sender has to check getDayNightDiff() of blocks
+		further away than 4 itself.
 	*/
 	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
-			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
+			float dtime, std::vector<PrioritySortedBlockTransfer> &dest,
+			std::vector<MapBlock *> &used_blocks);
 
 	void GotBlock(v3s16 p);
 
@@ -296,6 +306,13 @@ class RemoteClient
 	 */
 	void ResendBlockIfOnWire(v3s16 p);
 
+	/**
+	 * make the block be looked at again by GetNextBlocks if it hasn't been
+	 * sent, used when a block hidden by its neighbours may have become visible
+	 * @param p position of the block
+	 */
+	void RescanBlock(v3s16 p);
+
 	s32 SendingCount()
 	{
 		return m_blocks_sending.size();
@@ -326,6 +343,16 @@ class RemoteClient
 	*/
 	std::set<u16> m_known_objects;
 
+	/*
+		Block of the player and the radii in blocks with which
+		m_known_objects was last fully updated. While they stay the same,
+		only the objects that changed since the last step are looked at.
+		m_known_objects_radius is -1 if a full update is needed.
+	*/
+	v3s16 m_known_objects_block;
+	s16 m_known_objects_radius;
+	s16 m_known_objects_player_radius;
+
 	ClientState getState()
 		{ return m_state; }
 
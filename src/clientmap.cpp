@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "mapblock.h"
 #include "profiler.h"
+#include "porting.h"
 #include "settings.h"
 #include "camera.h"               // CameraModes
 #include "util/mathconstants.h"
@@ -34,6 +35,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
 
+// Edge length in blocks of the regions whose blocks are batched together
+#define MAP_BATCH_REGION_SIZE 4
+// Batches made per pass at most; the blocks of the others are drawn one
+// by one meanwhile
+#define MAP_BATCH_MAX_UPDATES 4
+// Time after which batches that are not drawn are deleted
+#define MAP_BATCH_KEEP_MS 10000
+
 ClientMap::ClientMap(
 		Client *client,
 		IGameDef *gamedef,
@@ -48,7 +57,9 @@ ClientMap::ClientMap(
 	m_control(control),
 	m_camera_position(0,0,0),
 	m_camera_direction(0,0,1),
-	m_camera_fov(M_PI)
+	m_camera_fov(M_PI),
+	m_draw_call_count(0),
+	m_material_change_count(0)
 {
 	m_box = core::aabbox3d<f32>(-BS*1000000,-BS*1000000,-BS*1000000,
 			BS*1000000,BS*1000000,BS*1000000);
@@ -65,11 +76,16 @@ ClientMap::ClientMap(
 	m_cache_trilinear_filter  = g_settings->getBool("trilinear_filter");
 	m_cache_bilinear_filter   = g_settings->getBool("bilinear_filter");
 	m_cache_anistropic_filter = g_settings->getBool("anisotropic_filter");
+	m_cache_batch_drawing     = g_settings->getBool("enable_batched_drawing");
 
 }
 
 ClientMap::~ClientMap()
 {
+	for (std::map<v3s16, MapBlockBatch*>::iterator
+			i = m_batches.begin(); i != m_batches.end(); ++i)
+		deleteBatch(i->second);
+
 	/*MutexAutoLock lock(mesh_mutex);
 
 	if(mesh != NULL)
@@ -398,6 +414,179 @@ struct MeshBufListList
 	}
 };
 
+void ClientMap::addMeshBuffer(MeshBufListList &drawbufs,
+		scene::IMeshBuffer *buf, video::IVideoDriver *driver,
+		bool is_transparent_pass)
+{
+	buf->getMaterial().setFlag(video::EMF_TRILINEAR_FILTER, m_cache_trilinear_filter);
+	buf->getMaterial().setFlag(video::EMF_BILINEAR_FILTER, m_cache_bilinear_filter);
+	buf->getMaterial().setFlag(video::EMF_ANISOTROPIC_FILTER, m_cache_anistropic_filter);
+
+	const video::SMaterial& material = buf->getMaterial();
+	video::IMaterialRenderer* rnd =
+			driver->getMaterialRenderer(material.MaterialType);
+	bool transparent = (rnd && rnd->isTransparent());
+	if(transparent == is_transparent_pass)
+		drawbufs.add(buf);
+}
+
+void ClientMap::addMeshBuffers(MeshBufListList &drawbufs, MapBlock *block,
+		video::IVideoDriver *driver, bool is_transparent_pass,
+		bool static_buffers, bool other_buffers)
+{
+	MapBlockMesh *mapBlockMesh = block->mesh;
+	assert(mapBlockMesh);
+
+	scene::IMesh *mesh = mapBlockMesh->getMesh();
+	assert(mesh);
+
+	u32 c = mesh->getMeshBufferCount();
+	for(u32 i=0; i<c; i++)
+	{
+		bool is_static = mapBlockMesh->isStaticBuffer(i);
+		if ((is_static && !static_buffers) || (!is_static && !other_buffers))
+			continue;
+
+		scene::IMeshBuffer *buf = mesh->getMeshBuffer(i);
+		if(buf->getVertexCount() == 0)
+			errorstream<<"Block ["<<analyze_block(block)
+					<<"] contains an empty meshbuf"<<std::endl;
+		addMeshBuffer(drawbufs, buf, driver, is_transparent_pass);
+	}
+}
+
+MapBlockBatch *ClientMap::getBatch(v3s16 region,
+		const std::vector<MapBlock*> &blocks, u32 &max_updates)
+{
+	MapBlockBatch *batch = NULL;
+	std::map<v3s16, MapBlockBatch*>::iterator it = m_batches.find(region);
+	if (it != m_batches.end()) {
+		batch = it->second;
+		bool up_to_date = batch->mesh_versions.size() == blocks.size();
+		for (u32 i = 0; up_to_date && i < blocks.size(); i++)
+			up_to_date = batch->mesh_versions[i] ==
+					blocks[i]->mesh->getVersion();
+		if (up_to_date)
+			return batch;
+	}
+
+	if (max_updates == 0)
+		return NULL;
+	max_updates--;
+
+	ScopeProfiler sp(g_profiler, "CM: batch update", SPT_AVG);
+
+	if (batch)
+		deleteBatch(batch);
+	batch = new MapBlockBatch;
+	// Nothing has been blended yet
+	batch->daynight_ratio = U32_MAX;
+	m_batches[region] = batch;
+
+	// Join the static buffers of the blocks by material
+	MeshBufListList lists;
+	std::map<scene::IMeshBuffer*, const std::map<u32, std::pair<u8, u8> > *>
+			daynight_diffs;
+	for (u32 i = 0; i < blocks.size(); i++) {
+		MapBlockMesh *mapBlockMesh = blocks[i]->mesh;
+		batch->mesh_versions.push_back(mapBlockMesh->getVersion());
+
+		scene::IMesh *mesh = mapBlockMesh->getMesh();
+		for (u32 j = 0; j < mesh->getMeshBufferCount(); j++) {
+			if (!mapBlockMesh->isStaticBuffer(j))
+				continue;
+			lists.add(mesh->getMeshBuffer(j));
+			const std::map<u32, std::pair<u8, u8> > *diffs =
+					mapBlockMesh->getDayNightDiffs(j);
+			if (diffs)
+				daynight_diffs[mesh->getMeshBuffer(j)] = diffs;
+		}
+	}
+
+	for (u32 i = 0; i < lists.lists.size(); i++) {
+		const MeshBufList &list = lists.lists[i];
+		scene::SMeshBufferTangents *dst = NULL;
+		for (u32 j = 0; j < list.bufs.size(); j++) {
+			scene::SMeshBufferTangents *src =
+					(scene::SMeshBufferTangents *)list.bufs[j];
+			// Indices are 16 bits, start a new buffer when they run out
+			if (dst == NULL || dst->Vertices.size() +
+					src->Vertices.size() > U16_MAX + 1) {
+				dst = new scene::SMeshBufferTangents();
+				dst->setHardwareMappingHint(scene::EHM_STATIC);
+				dst->Material = list.m;
+				batch->buffers.push_back(dst);
+			}
+			u16 base = dst->Vertices.size();
+			for (u32 k = 0; k < src->Vertices.size(); k++)
+				dst->Vertices.push_back(src->Vertices[k]);
+			for (u32 k = 0; k < src->Indices.size(); k++)
+				dst->Indices.push_back(base + src->Indices[k]);
+
+			std::map<scene::IMeshBuffer*,
+					const std::map<u32, std::pair<u8, u8> > *>::iterator
+					d = daynight_diffs.find(src);
+			if (d == daynight_diffs.end())
+				continue;
+			for (std::map<u32, std::pair<u8, u8> >::const_iterator
+					k = d->second->begin(); k != d->second->end(); ++k) {
+				MapBlockBatchDayNightVertex v;
+				v.buffer = batch->buffers.size() - 1;
+				v.vertex = base + k->first;
+				v.day = k->second.first;
+				v.night = k->second.second;
+				batch->daynight_vertices.push_back(v);
+			}
+		}
+	}
+	for (u32 i = 0; i < batch->buffers.size(); i++)
+		batch->buffers[i]->recalculateBoundingBox();
+
+	return batch;
+}
+
+void ClientMap::updateBatchDayNight(MapBlockBatch *batch, u32 daynight_ratio)
+{
+	if (batch->daynight_ratio == daynight_ratio)
+		return;
+	batch->daynight_ratio = daynight_ratio;
+
+	scene::SMeshBufferTangents *buf = NULL;
+	for (u32 i = 0; i < batch->daynight_vertices.size(); i++) {
+		const MapBlockBatchDayNightVertex &v = batch->daynight_vertices[i];
+		if (buf != batch->buffers[v.buffer]) {
+			buf = batch->buffers[v.buffer];
+			buf->setDirty(scene::EBT_VERTEX);
+		}
+		finalColorBlend(buf->Vertices[v.vertex].Color,
+				v.day, v.night, daynight_ratio);
+	}
+}
+
+void ClientMap::deleteBatch(MapBlockBatch *batch)
+{
+	video::IVideoDriver *driver = SceneManager->getVideoDriver();
+	for (u32 i = 0; i < batch->buffers.size(); i++) {
+		driver->removeHardwareBuffer(batch->buffers[i]);
+		batch->buffers[i]->drop();
+	}
+	delete batch;
+}
+
+void ClientMap::trimBatches()
+{
+	u32 now = porting::getTimeMs();
+	for (std::map<v3s16, MapBlockBatch*>::iterator
+			i = m_batches.begin(); i != m_batches.end();) {
+		if (now - i->second->last_used_ms >= MAP_BATCH_KEEP_MS) {
+			deleteBatch(i->second);
+			m_batches.erase(i++);
+		} else {
+			++i;
+		}
+	}
+}
+
 void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 {
 	DSTACK(FUNCTION_NAME);
@@ -416,6 +605,8 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 	if(pass == scene::ESNRP_SOLID)
 	{
 		m_last_drawn_sectors.clear();
+		m_draw_call_count = 0;
+		m_material_change_count = 0;
 	}
 
 	/*
@@ -463,6 +654,7 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 
 	u32 vertex_count = 0;
 	u32 meshbuffer_count = 0;
+	u32 material_count = 0;
 
 	// For limiting number of mesh animations per frame
 	u32 mesh_animate_count = 0;
@@ -484,6 +676,9 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 
 	MeshBufListList drawbufs;
 
+	// Blocks in sight by batch region
+	std::map<v3s16, std::vector<MapBlock*> > region_blocks;
+
 	for(std::map<v3s16, MapBlock*>::iterator
 			i = m_drawlist.begin();
 			i != m_drawlist.end(); ++i)
@@ -531,40 +726,37 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 		}
 
 		/*
-			Get the meshbuffers of the block
+			Get the meshbuffers of the block; the static ones are drawn
+			with the batch of the region
 		*/
-		{
-			//MutexAutoLock lock(block->mesh_mutex);
-
-			MapBlockMesh *mapBlockMesh = block->mesh;
-			assert(mapBlockMesh);
-
-			scene::IMesh *mesh = mapBlockMesh->getMesh();
-			assert(mesh);
+		if (m_cache_batch_drawing)
+			region_blocks[getContainerPos(block->getPos(),
+					MAP_BATCH_REGION_SIZE)].push_back(block);
+		addMeshBuffers(drawbufs, block, driver, is_transparent_pass,
+				!m_cache_batch_drawing, true);
+	}
 
-			u32 c = mesh->getMeshBufferCount();
-			for(u32 i=0; i<c; i++)
-			{
-				scene::IMeshBuffer *buf = mesh->getMeshBuffer(i);
-
-				buf->getMaterial().setFlag(video::EMF_TRILINEAR_FILTER, m_cache_trilinear_filter);
-				buf->getMaterial().setFlag(video::EMF_BILINEAR_FILTER, m_cache_bilinear_filter);
-				buf->getMaterial().setFlag(video::EMF_ANISOTROPIC_FILTER, m_cache_anistropic_filter);
-
-				const video::SMaterial& material = buf->getMaterial();
-				video::IMaterialRenderer* rnd =
-						driver->getMaterialRenderer(material.MaterialType);
-				bool transparent = (rnd && rnd->isTransparent());
-				if(transparent == is_transparent_pass)
-				{
-					if(buf->getVertexCount() == 0)
-						errorstream<<"Block ["<<analyze_block(block)
-								<<"] contains an empty meshbuf"<<std::endl;
-					drawbufs.add(buf);
-				}
-			}
+	u32 max_updates = MAP_BATCH_MAX_UPDATES;
+	for (std::map<v3s16, std::vector<MapBlock*> >::iterator
+			i = region_blocks.begin(); i != region_blocks.end(); ++i) {
+		const std::vector<MapBlock*> &blocks = i->second;
+		MapBlockBatch *batch = getBatch(i->first, blocks, max_updates);
+		if (batch == NULL) {
+			// Draw the blocks one by one until there is time to make
+			// the batch again
+			for (u32 j = 0; j < blocks.size(); j++)
+				addMeshBuffers(drawbufs, blocks[j], driver,
+						is_transparent_pass, true, false);
+			continue;
 		}
+		batch->last_used_ms = porting::getTimeMs();
+		updateBatchDayNight(batch, daynight_ratio);
+		for (u32 j = 0; j < batch->buffers.size(); j++)
+			addMeshBuffer(drawbufs, batch->buffers[j], driver,
+					is_transparent_pass);
 	}
+	if (m_cache_batch_drawing && pass == scene::ESNRP_SOLID)
+		trimBatches();
 
 	std::vector<MeshBufList> &lists = drawbufs.lists;
 
@@ -586,6 +778,7 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 		MeshBufList &list = *i;
 
 		driver->setMaterial(list.m);
+		material_count++;
 
 		for(std::vector<scene::IMeshBuffer*>::iterator j = list.bufs.begin();
 				j != list.bufs.end(); ++j) {
@@ -604,7 +797,12 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 		g_profiler->avg("CM: animated meshes (far)", mesh_animate_count_far);
 	}
 
+	m_draw_call_count += meshbuffer_count;
+	m_material_change_count += material_count;
+
 	g_profiler->avg(prefix+"vertices drawn", vertex_count);
+	g_profiler->avg(prefix+"draw calls", meshbuffer_count);
+	g_profiler->avg(prefix+"material changes", material_count);
 	if(blocks_had_pass_meshbuf != 0)
 		g_profiler->avg(prefix+"meshbuffers per block",
 				(float)meshbuffer_count / (float)blocks_had_pass_meshbuf);
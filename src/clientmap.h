@@ -56,6 +56,32 @@ struct MapDrawControl
 
 class Client;
 class ITextureSource;
+struct MeshBufListList;
+
+// A vertex of a batch whose colour depends on the day/night ratio
+struct MapBlockBatchDayNightVertex
+{
+	u32 buffer;
+	u32 vertex;
+	u8 day;
+	u8 night;
+};
+
+/*
+	The static geometry of the drawn blocks of a region of the map, joined
+	into as few mesh buffers per material as possible.
+*/
+struct MapBlockBatch
+{
+	// Versions of the meshes the buffers were made of
+	std::vector<u32> mesh_versions;
+	std::vector<scene::SMeshBufferTangents*> buffers;
+	// Sorted by buffer
+	std::vector<MapBlockBatchDayNightVertex> daynight_vertices;
+	// The day/night ratio the vertex colours were blended for
+	u32 daynight_ratio;
+	u32 last_used_ms;
+};
 
 /*
 	ClientMap
@@ -132,6 +158,16 @@ class ClientMap : public Map, public scene::ISceneNode
 	// For debug printing
 	virtual void PrintInfo(std::ostream &out);
 	
+	// Number of draw calls and material changes of the last frame
+	u32 getDrawCallCount() const
+	{
+		return m_draw_call_count;
+	}
+	u32 getMaterialChangeCount() const
+	{
+		return m_material_change_count;
+	}
+
 	// Check if sector was drawn on last render()
 	bool sectorWasDrawn(v2s16 p)
 	{
@@ -139,6 +175,24 @@ class ClientMap : public Map, public scene::ISceneNode
 	}
 	
 private:
+	void addMeshBuffer(MeshBufListList &drawbufs, scene::IMeshBuffer *buf,
+			video::IVideoDriver *driver, bool is_transparent_pass);
+	// Adds the mesh buffers of a block that belong to the pass, either
+	// the static ones or the others
+	void addMeshBuffers(MeshBufListList &drawbufs, MapBlock *block,
+			video::IVideoDriver *driver, bool is_transparent_pass,
+			bool static_buffers, bool other_buffers);
+	// Returns the up to date batch of a region, or NULL if it would
+	// have to be made again but max_updates is 0
+	MapBlockBatch *getBatch(v3s16 region,
+			const std::vector<MapBlock*> &blocks, u32 &max_updates);
+	// Blends the day/night vertex colours of the batch again if the
+	// ratio has changed
+	void updateBatchDayNight(MapBlockBatch *batch, u32 daynight_ratio);
+	void deleteBatch(MapBlockBatch *batch);
+	// Deletes the batches that have not been drawn for a while
+	void trimBatches();
+
 	Client *m_client;
 	
 	core::aabbox3d<f32> m_box;
@@ -158,6 +212,12 @@ class ClientMap : public Map, public scene::ISceneNode
 	bool m_cache_trilinear_filter;
 	bool m_cache_bilinear_filter;
 	bool m_cache_anistropic_filter;
+	bool m_cache_batch_drawing;
+
+	std::map<v3s16, MapBlockBatch*> m_batches;
+
+	u32 m_draw_call_count;
+	u32 m_material_change_count;
 };
 
 #endif
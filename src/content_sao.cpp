@@ -62,13 +62,15 @@ class TestSAO : public ServerActiveObject
 		m_age += dtime;
 		if(m_age > 10)
 		{
-			m_removed = true;
+			markForRemoval();
 			return;
 		}
 
-		m_base_position.Y += dtime * BS * 2;
-		if(m_base_position.Y > 8*BS)
-			m_base_position.Y = 2*BS;
+		v3f pos = m_base_position;
+		pos.Y += dtime * BS * 2;
+		if(pos.Y > 8*BS)
+			pos.Y = 2*BS;
+		setBasePosition(pos);
 
 		if(send_recommended == false)
 			return;
@@ -252,7 +254,7 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 	if(isAttached())
 	{
 		v3f pos = m_env->getActiveObject(m_attachment_parent_id)->getBasePosition();
-		m_base_position = pos;
+		setBasePosition(pos);
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
 	}
@@ -273,12 +275,12 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 					this, m_prop.collideWithObjects);
 
 			// Apply results
-			m_base_position = p_pos;
+			setBasePosition(p_pos);
 			m_velocity = p_velocity;
 			m_acceleration = p_acceleration;
 		} else {
-			m_base_position += dtime * m_velocity + 0.5 * dtime
-					* dtime * m_acceleration;
+			setBasePosition(m_base_position + dtime * m_velocity + 0.5 * dtime
+					* dtime * m_acceleration);
 			m_velocity += dtime * m_acceleration;
 		}
 
@@ -423,7 +425,7 @@ int LuaEntitySAO::punch(v3f dir,
 {
 	if (!m_registered){
 		// Delete unknown LuaEntities when punched
-		m_removed = true;
+		markForRemoval();
 		return 0;
 	}
 
@@ -462,7 +464,7 @@ int LuaEntitySAO::punch(v3f dir,
 	}
 
 	if (getHP() == 0)
-		m_removed = true;
+		markForRemoval();
 
 	m_env->getScriptIface()->luaentity_Punch(m_id, puncher,
 			time_from_last_punch, toolcap, dir);
@@ -484,7 +486,7 @@ void LuaEntitySAO::setPos(v3f pos)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	sendPosition(false, true);
 }
 
@@ -492,7 +494,7 @@ void LuaEntitySAO::moveTo(v3f pos, bool continuous)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	if(!continuous)
 		sendPosition(true, true);
 }
@@ -707,6 +709,15 @@ void LuaEntitySAO::sendPosition(bool do_interpolate, bool is_movement_end)
 	);
 	// create message and add to list
 	ActiveObjectMessage aom(getId(), false, str);
+	aom.compact_datastring = gob_cmd_update_position_compact(
+		m_base_position,
+		m_velocity,
+		m_acceleration,
+		m_yaw,
+		do_interpolate,
+		is_movement_end,
+		update_interval
+	);
 	m_messages_out.push(aom);
 }
 
@@ -967,6 +978,15 @@ void PlayerSAO::step(float dtime, bool send_recommended)
 		);
 		// create message and add to list
 		ActiveObjectMessage aom(getId(), false, str);
+		aom.compact_datastring = gob_cmd_update_position_compact(
+			pos,
+			v3f(0,0,0),
+			v3f(0,0,0),
+			m_player->getYaw(),
+			true,
+			false,
+			update_interval
+		);
 		m_messages_out.push(aom);
 	}
 
@@ -1320,7 +1340,7 @@ void PlayerSAO::setWieldIndex(int i)
 void PlayerSAO::disconnected()
 {
 	m_peer_id = 0;
-	m_removed = true;
+	markForRemoval();
 	if(m_player->getPlayerSAO() == this)
 	{
 		m_player->setPlayerSAO(NULL);
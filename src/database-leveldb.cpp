@@ -29,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/string.h"
 
 #include "leveldb/db.h"
+#include <algorithm>
 
 
 #define ENSURE_STATUS_OK(s) \
@@ -77,6 +78,31 @@ std::string Database_LevelDB::loadBlock(const v3s16 &pos)
 		return "";
 }
 
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> &blocks)
+{
+	blocks.clear();
+	blocks.resize(positions.size());
+
+	// Seek one iterator through the sorted keys, so that neighbouring
+	// keys are read from the same table blocks
+	std::vector<std::pair<std::string, size_t> > keys;
+	keys.reserve(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		keys.push_back(std::make_pair(
+			i64tos(getBlockAsInteger(positions[i])), i));
+	std::sort(keys.begin(), keys.end());
+
+	leveldb::Iterator *it = m_database->NewIterator(leveldb::ReadOptions());
+	for (size_t i = 0; i < keys.size(); i++) {
+		it->Seek(keys[i].first);
+		if (it->Valid() && it->key() == keys[i].first)
+			blocks[keys[i].second] = it->value().ToString();
+	}
+	ENSURE_STATUS_OK(it->status());
+	delete it;
+}
+
 bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 {
 	leveldb::Status status = m_database->Delete(leveldb::WriteOptions(),
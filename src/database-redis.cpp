@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <hiredis.h>
 #include <cassert>
+#include <algorithm>
 
 
 Database_Redis::Database_Redis(Settings &conf)
@@ -140,6 +141,67 @@ std::string Database_Redis::loadBlock(const v3s16 &pos)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+// Number of blocks asked for by each HMGET
+#define HMGET_COUNT 256
+
+void Database_Redis::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> &blocks)
+{
+	blocks.clear();
+	blocks.resize(positions.size());
+
+	std::vector<std::string> keys;
+	keys.reserve(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		keys.push_back(i64tos(getBlockAsInteger(positions[i])));
+
+	// Pipeline all the commands, then read the replies
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	for (size_t start = 0; start < keys.size(); start += HMGET_COUNT) {
+		size_t end = std::min(start + HMGET_COUNT, keys.size());
+		argv.clear();
+		argvlen.clear();
+		argv.push_back("HMGET");
+		argvlen.push_back(5);
+		argv.push_back(hash.c_str());
+		argvlen.push_back(hash.size());
+		for (size_t i = start; i < end; i++) {
+			argv.push_back(keys[i].c_str());
+			argvlen.push_back(keys[i].size());
+		}
+		if (redisAppendCommandArgv(ctx, argv.size(), &argv[0],
+				&argvlen[0]) != REDIS_OK) {
+			throw FileNotGoodException(std::string(
+				"Redis command 'HMGET' failed: ") + ctx->errstr);
+		}
+	}
+
+	for (size_t start = 0; start < keys.size(); start += HMGET_COUNT) {
+		size_t end = std::min(start + HMGET_COUNT, keys.size());
+		redisReply *reply;
+		if (redisGetReply(ctx, (void **)&reply) != REDIS_OK || !reply) {
+			throw FileNotGoodException(std::string(
+				"Redis command 'HMGET' failed: ") + ctx->errstr);
+		}
+		if (reply->type != REDIS_REPLY_ARRAY ||
+				reply->elements != end - start) {
+			std::string errstr = reply->type == REDIS_REPLY_ERROR ?
+				reply->str : "invalid reply";
+			freeReplyObject(reply);
+			throw FileNotGoodException(std::string(
+				"Redis command 'HMGET' errored: ") + errstr);
+		}
+		for (size_t i = start; i < end; i++) {
+			redisReply *elem = reply->element[i - start];
+			// Missing blocks are nil
+			if (elem->type == REDIS_REPLY_STRING)
+				blocks[i].assign(elem->str, elem->len);
+		}
+		freeReplyObject(reply);
+	}
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
@@ -34,6 +34,7 @@ SQLite format specification:
 #include "util/string.h"
 
 #include <cassert>
+#include <algorithm>
 
 
 #define SQLRES(s, r) \
@@ -49,6 +50,9 @@ SQLite format specification:
 #define PREPARE_STATEMENT(name, query) \
 	SQLOK(sqlite3_prepare_v2(m_database, query, -1, &m_stmt_##name, NULL))
 
+// Number of positions bound to m_stmt_read_many
+#define READ_MANY_COUNT 64
+
 #define FINALIZE_STATEMENT(statement) \
 	if (sqlite3_finalize(statement) != SQLITE_OK) { \
 		throw FileNotGoodException(std::string( \
@@ -62,6 +66,7 @@ Database_SQLite3::Database_SQLite3(const std::string &savedir) :
 	m_savedir(savedir),
 	m_database(NULL),
 	m_stmt_read(NULL),
+	m_stmt_read_many(NULL),
 	m_stmt_write(NULL),
 	m_stmt_list(NULL),
 	m_stmt_delete(NULL),
@@ -133,6 +138,12 @@ void Database_SQLite3::verifyDatabase()
 	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
 	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
 
+	std::string read_many = "SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN (?";
+	for (u32 i = 1; i < READ_MANY_COUNT; i++)
+		read_many += ", ?";
+	read_many += ")";
+	PREPARE_STATEMENT(read_many, read_many.c_str());
+
 	m_initialized = true;
 
 	verbosestream << "ServerMap: SQLite3 database opened." << std::endl;
@@ -209,6 +220,50 @@ std::string Database_SQLite3::loadBlock(const v3s16 &pos)
 	return s;
 }
 
+void Database_SQLite3::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> &blocks)
+{
+	verifyDatabase();
+
+	blocks.clear();
+	blocks.resize(positions.size());
+
+	// Rows come back in any order, so find them by their key
+	std::vector<std::pair<s64, size_t> > keys;
+	keys.reserve(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		keys.push_back(std::make_pair(getBlockAsInteger(positions[i]), i));
+	std::sort(keys.begin(), keys.end());
+
+	for (size_t start = 0; start < keys.size(); start += READ_MANY_COUNT) {
+		size_t end = std::min(start + READ_MANY_COUNT, keys.size());
+		for (size_t i = start; i < end; i++) {
+			SQLOK(sqlite3_bind_int64(m_stmt_read_many, i - start + 1,
+				keys[i].first));
+		}
+		for (size_t i = end - start; i < READ_MANY_COUNT; i++)
+			SQLOK(sqlite3_bind_null(m_stmt_read_many, i + 1));
+
+		int res;
+		while ((res = sqlite3_step(m_stmt_read_many)) == SQLITE_ROW) {
+			s64 key = sqlite3_column_int64(m_stmt_read_many, 0);
+			const char *data = (const char *)
+				sqlite3_column_blob(m_stmt_read_many, 1);
+			size_t len = sqlite3_column_bytes(m_stmt_read_many, 1);
+			if (!data)
+				continue;
+
+			std::vector<std::pair<s64, size_t> >::iterator it =
+				std::lower_bound(keys.begin() + start, keys.begin() + end,
+					std::make_pair(key, (size_t)0));
+			for (; it != keys.begin() + end && it->first == key; ++it)
+				blocks[it->second].assign(data, len);
+		}
+		sqlite3_reset(m_stmt_read_many);
+		SQLRES(res, SQLITE_DONE);
+	}
+}
+
 void Database_SQLite3::createDatabase()
 {
 	assert(m_database); // Pre-condition
@@ -233,6 +288,7 @@ void Database_SQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 Database_SQLite3::~Database_SQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_read)
+	FINALIZE_STATEMENT(m_stmt_read_many)
 	FINALIZE_STATEMENT(m_stmt_write)
 	FINALIZE_STATEMENT(m_stmt_list)
 	FINALIZE_STATEMENT(m_stmt_begin)
@@ -38,6 +38,8 @@ class Database_SQLite3 : public Database
 	virtual bool saveBlock(const v3s16 &pos, const std::string &data);
 	virtual std::string loadBlock(const v3s16 &pos);
 	virtual bool deleteBlock(const v3s16 &pos);
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &blocks);
 	virtual void listAllLoadableBlocks(std::vector<v3s16> &dst);
 	virtual bool initialized() const { return m_initialized; }
 	~Database_SQLite3();
@@ -58,6 +60,8 @@ class Database_SQLite3 : public Database
 
 	sqlite3 *m_database;
 	sqlite3_stmt *m_stmt_read;
+	// Reads up to READ_MANY_COUNT blocks
+	sqlite3_stmt *m_stmt_read_many;
 	sqlite3_stmt *m_stmt_write;
 	sqlite3_stmt *m_stmt_list;
 	sqlite3_stmt *m_stmt_delete;
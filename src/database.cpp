@@ -67,3 +67,12 @@ v3s16 Database::getIntegerAsBlock(s64 i)
 	return pos;
 }
 
+
+void Database::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> &blocks)
+{
+	blocks.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		blocks[i] = loadBlock(positions[i]);
+}
+
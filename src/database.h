@@ -41,6 +41,11 @@ class Database
 	virtual std::string loadBlock(const v3s16 &pos) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	// Loads many blocks in as few queries as the backend allows.
+	// blocks[i] is left empty if positions[i] is not in the database.
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
@@ -22,7 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "emerge.h"
 
 #include <iostream>
-#include <queue>
+#include <deque>
 
 #include "util/container.h"
 #include "util/thread.h"
@@ -69,9 +69,13 @@ class EmergeThread : public Thread {
 	void *run();
 	void signal();
 
-	// Requires queue mutex held
+	// Locks the block queue itself. The emerge data of the block must have
+	// been added to the manager before, as any thread may take the block.
 	bool pushBlock(v3s16 pos);
 
+	// Number of queued blocks, plus one if a block is being processed
+	size_t getLoad();
+
 	void cancelPendingItems();
 
 	static void runCompletionCallbacks(
@@ -85,14 +89,20 @@ class EmergeThread : public Thread {
 	Mapgen *m_mapgen;
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+
+	// Other emerge threads take blocks from the front of this queue
+	// when they run out of their own, so it has a lock of its own
+	Mutex m_block_queue_mutex;
+	std::deque<v3s16> m_block_queue;
+	bool m_busy;
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	bool stealBlock(v3s16 *pos);
 
 	EmergeAction getBlockOrStartGen(
 		v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
-	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
-		std::map<v3s16, MapBlock *> *modified_blocks);
+	void finishGen(v3s16 pos, BlockMakeData *bmdata,
+		const EmergeCallbackList &callbacks);
 
 	friend class EmergeManager;
 };
@@ -173,6 +183,10 @@ EmergeManager::~EmergeManager()
 		delete m_mapgens[i];
 	}
 
+	GeneratedChunk *chunk;
+	while ((chunk = m_generated_chunks.pop_frontNoEx(0)) != NULL)
+		delete chunk;
+
 	delete biomemgr;
 	delete oremgr;
 	delete decomgr;
@@ -292,10 +306,17 @@ bool EmergeManager::enqueueBlockEmergeEx(
 	{
 		MutexAutoLock queuelock(m_queue_mutex);
 
+		bool queued = m_blocks_enqueued.find(blockpos) !=
+			m_blocks_enqueued.end();
+
 		if (!pushBlockEmergeData(blockpos, peer_id, flags,
 				callback, callback_param))
 			return false;
 
+		// Only the flags and callbacks of queued blocks are updated
+		if (queued)
+			return true;
+
 		thread = getOptimalThread();
 		thread->pushBlock(blockpos);
 	}
@@ -306,6 +327,44 @@ bool EmergeManager::enqueueBlockEmergeEx(
 }
 
 
+void EmergeManager::finishGeneratedChunks(Server *server)
+{
+	ServerMap *map = (ServerMap *)&server->m_env->getMap();
+	GeneratedChunk *chunk;
+
+	while ((chunk = m_generated_chunks.pop_frontNoEx(0)) != NULL) {
+		{
+			// Ignore map edit events, the modified blocks are
+			// set not sent below anyway
+			MapEditEventAreaIgnorer ign(
+				&server->m_ignore_map_edit_events_area,
+				VoxelArea(chunk->minp, chunk->maxp));
+
+			try {
+				server->getScriptIface()->environment_OnGenerated(
+					chunk->minp, chunk->maxp, chunk->blockseed);
+			} catch (LuaError &e) {
+				server->setAsyncFatalError("Lua: " + std::string(e.what()));
+			}
+		}
+
+		MapBlock *block = map->getBlockNoCreateNoEx(chunk->blockpos);
+		if (block) {
+			server->m_env->activateBlock(block, 0);
+			chunk->modified_blocks[chunk->blockpos] = block;
+		}
+
+		EmergeThread::runCompletionCallbacks(chunk->blockpos,
+			EMERGE_GENERATED, chunk->callbacks);
+
+		if (chunk->modified_blocks.size() > 0)
+			server->SetBlocksNotSent(chunk->modified_blocks);
+
+		delete chunk;
+	}
+}
+
+
 //
 // Mapgen-related helper functions
 //
@@ -450,10 +509,10 @@ EmergeThread *EmergeManager::getOptimalThread()
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	size_t nitems_lowest = m_threads[0]->getLoad();
 
 	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
+		size_t nitems = m_threads[i]->getLoad();
 		if (nitems < nitems_lowest) {
 			index = i;
 			nitems_lowest = nitems;
@@ -474,7 +533,8 @@ EmergeThread::EmergeThread(Server *server, int ethreadid) :
 	m_server(server),
 	m_map(NULL),
 	m_emerge(NULL),
-	m_mapgen(NULL)
+	m_mapgen(NULL),
+	m_busy(false)
 {
 	m_name = "Emerge-" + itos(ethreadid);
 }
@@ -494,21 +554,30 @@ void EmergeThread::signal()
 
 bool EmergeThread::pushBlock(v3s16 pos)
 {
-	m_block_queue.push(pos);
+	MutexAutoLock queuelock(m_block_queue_mutex);
+	m_block_queue.push_back(pos);
 	return true;
 }
 
 
+size_t EmergeThread::getLoad()
+{
+	MutexAutoLock queuelock(m_block_queue_mutex);
+	return m_block_queue.size() + (m_busy ? 1 : 0);
+}
+
+
 void EmergeThread::cancelPendingItems()
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+	MutexAutoLock blockqueuelock(m_block_queue_mutex);
 
 	while (!m_block_queue.empty()) {
 		BlockEmergeData bedata;
 		v3s16 pos;
 
 		pos = m_block_queue.front();
-		m_block_queue.pop();
+		m_block_queue.pop_front();
 
 		m_emerge->popBlockEmergeData(pos, &bedata);
 
@@ -536,15 +605,60 @@ void EmergeThread::runCompletionCallbacks(
 
 bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
+	bool found = false;
+	{
+		MutexAutoLock queuelock(m_block_queue_mutex);
+		if (!m_block_queue.empty()) {
+			*pos = m_block_queue.front();
+			m_block_queue.pop_front();
+			found = true;
+		}
+		m_busy = found;
+	}
+
+	if (!found && !stealBlock(pos))
+		return false;
+
+	// The block may have been enqueued again in the meantime, in which
+	// case its callbacks are run together with this emerge
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+	m_emerge->popBlockEmergeData(*pos, bedata);
+
+	return true;
+}
+
+
+bool EmergeThread::stealBlock(v3s16 *pos)
+{
+	std::vector<EmergeThread *> &threads = m_emerge->m_threads;
+
+	// Take from the thread with the longest queue
+	EmergeThread *victim = NULL;
+	size_t nitems_highest = 0;
+	for (size_t i = 0; i != threads.size(); i++) {
+		if (threads[i] == this)
+			continue;
+		MutexAutoLock queuelock(threads[i]->m_block_queue_mutex);
+		size_t nitems = threads[i]->m_block_queue.size();
+		if (nitems > nitems_highest) {
+			victim = threads[i];
+			nitems_highest = nitems;
+		}
+	}
 
-	if (m_block_queue.empty())
+	if (!victim)
 		return false;
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	{
+		MutexAutoLock queuelock(victim->m_block_queue_mutex);
+		if (victim->m_block_queue.empty())
+			return false;
+		*pos = victim->m_block_queue.front();
+		victim->m_block_queue.pop_front();
+	}
 
-	m_emerge->popBlockEmergeData(*pos, bedata);
+	MutexAutoLock queuelock(m_block_queue_mutex);
+	m_busy = true;
 
 	return true;
 }
@@ -574,54 +688,43 @@ EmergeAction EmergeThread::getBlockOrStartGen(
 }
 
 
-MapBlock *EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
-	std::map<v3s16, MapBlock *> *modified_blocks)
+void EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
+	const EmergeCallbackList &callbacks)
 {
-	MutexAutoLock envlock(m_server->m_env_mutex);
-	ScopeProfiler sp(g_profiler,
-		"EmergeThread: after Mapgen::makeChunk", SPT_AVG);
+	GeneratedChunk *chunk = new GeneratedChunk;
+	chunk->blockpos  = pos;
+	chunk->minp      = bmdata->blockpos_min * MAP_BLOCKSIZE;
+	chunk->maxp      = bmdata->blockpos_max * MAP_BLOCKSIZE +
+		v3s16(1,1,1) * (MAP_BLOCKSIZE - 1);
+	chunk->blockseed = m_mapgen->blockseed;
+	chunk->callbacks = callbacks;
 
-	/*
-		Perform post-processing on blocks (invalidate lighting, queue liquid
-		transforms, etc.) to finish block make
-	*/
-	m_map->finishBlockMake(bmdata, modified_blocks);
-
-	MapBlock *block = m_map->getBlockNoCreateNoEx(pos);
-	if (!block) {
-		errorstream << "EmergeThread::finishGen: Couldn't grab block we "
-			"just generated: " << PP(pos) << std::endl;
-		return NULL;
-	}
-
-	v3s16 minp = bmdata->blockpos_min * MAP_BLOCKSIZE;
-	v3s16 maxp = bmdata->blockpos_max * MAP_BLOCKSIZE +
-				 v3s16(1,1,1) * (MAP_BLOCKSIZE - 1);
-
-	// Ignore map edit events, they will not need to be sent
-	// to anybody because the block hasn't been sent to anybody
-	MapEditEventAreaIgnorer ign(
-		&m_server->m_ignore_map_edit_events_area,
-		VoxelArea(minp, maxp));
-
-	/*
-		Run Lua on_generated callbacks
-	*/
-	try {
-		m_server->getScriptIface()->environment_OnGenerated(
-			minp, maxp, m_mapgen->blockseed);
-	} catch (LuaError &e) {
-		m_server->setAsyncFatalError("Lua: " + std::string(e.what()));
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+		ScopeProfiler sp(g_profiler,
+			"EmergeThread: after Mapgen::makeChunk", SPT_AVG);
+
+		/*
+			Perform post-processing on blocks (invalidate lighting, queue
+			liquid transforms, etc.) to finish block make
+		*/
+		m_map->finishBlockMake(bmdata, &chunk->modified_blocks);
+
+		MapBlock *block = m_map->getBlockNoCreateNoEx(pos);
+		if (!block) {
+			errorstream << "EmergeThread::finishGen: Couldn't grab block we "
+				"just generated: " << PP(pos) << std::endl;
+		} else {
+			EMERGE_DBG_OUT("ended up with: " << analyze_block(block));
+		}
 	}
 
-	EMERGE_DBG_OUT("ended up with: " << analyze_block(block));
-
 	/*
-		Activate the block
+		Lua on_generated callbacks and the activation of the block are
+		left to the server thread, so that the env mutex is only held for
+		putting the blocks into the map here
 	*/
-	m_server->m_env->activateBlock(block, 0);
-
-	return block;
+	m_emerge->m_generated_chunks.push_back(chunk);
 }
 
 
@@ -639,7 +742,6 @@ void *EmergeThread::run()
 
 	try {
 	while (!stopRequested()) {
-		std::map<v3s16, MapBlock *> modified_blocks;
 		BlockEmergeData bedata;
 		BlockMakeData bmdata;
 		EmergeAction action;
@@ -669,16 +771,18 @@ void *EmergeThread::run()
 					t.stop(true); // Hide output
 			}
 
-			block = finishGen(pos, &bmdata, &modified_blocks);
+			// Callbacks are run by EmergeManager::finishGeneratedChunks()
+			finishGen(pos, &bmdata, bedata.callbacks);
+			continue;
 		}
 
 		runCompletionCallbacks(pos, action, bedata.callbacks);
 
-		if (block)
+		if (block) {
+			std::map<v3s16, MapBlock *> modified_blocks;
 			modified_blocks[pos] = block;
-
-		if (modified_blocks.size() > 0)
 			m_server->SetBlocksNotSent(modified_blocks);
+		}
 	}
 	} catch (VersionMismatchException &e) {
 		std::ostringstream err;
@@ -37,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 class EmergeThread;
 class INodeDefManager;
 class Settings;
+class Server;
 
 class BiomeManager;
 class OreManager;
@@ -88,6 +89,16 @@ struct BlockEmergeData {
 	EmergeCallbackList callbacks;
 };
 
+// A chunk made by an emerge thread that still needs its Lua callbacks run
+struct GeneratedChunk {
+	v3s16 blockpos;
+	v3s16 minp;
+	v3s16 maxp;
+	u32 blockseed;
+	EmergeCallbackList callbacks;
+	std::map<v3s16, MapBlock *> modified_blocks;
+};
+
 class EmergeManager {
 public:
 	INodeDefManager *ndef;
@@ -130,6 +141,10 @@ class EmergeManager {
 		EmergeCompletionCallback callback,
 		void *callback_param);
 
+	// Runs on_generated for the chunks made since the last call and
+	// activates their blocks. Server thread only, requires env mutex held.
+	void finishGeneratedChunks(Server *server);
+
 	v3s16 getContainingChunk(v3s16 blockpos);
 
 	Mapgen *getCurrentMapgen();
@@ -153,6 +168,8 @@ class EmergeManager {
 	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
 	std::map<u16, u16> m_peer_queue_count;
 
+	MutexedQueue<GeneratedChunk *> m_generated_chunks;
+
 	u16 m_qlimit_total;
 	u16 m_qlimit_diskonly;
 	u16 m_qlimit_generate;
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <fstream>
+#include <algorithm>
 #include "environment.h"
 #include "filesys.h"
 #include "porting.h"
@@ -43,7 +44,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "daynightratio.h"
 #include "map.h"
 #include "emerge.h"
+#include "noise.h"
 #include "util/serialize.h"
+#include "util/thread.h"
 #include "threading/mutex_auto_lock.h"
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
@@ -333,6 +336,98 @@ void ActiveBlockList::update(std::vector<v3s16> &active_positions,
 	}
 }
 
+/*
+	ActiveObjectGrid
+*/
+
+v3s16 ActiveObjectGrid::getCell(v3f pos)
+{
+	// Clamp so that far away objects and huge query areas can't overflow
+	const f32 limit = MAX_MAP_GENERATION_LIMIT * BS;
+	pos.X = rangelim(pos.X, -limit, limit);
+	pos.Y = rangelim(pos.Y, -limit, limit);
+	pos.Z = rangelim(pos.Z, -limit, limit);
+	return getNodeBlockPos(floatToInt(pos, BS));
+}
+
+void ActiveObjectGrid::insert(u16 id, v3f pos)
+{
+	v3s16 cell = getCell(pos);
+	m_cells[cell].insert(id);
+	m_object_cells[id] = cell;
+}
+
+void ActiveObjectGrid::remove(u16 id)
+{
+	std::map<u16, v3s16>::iterator n = m_object_cells.find(id);
+	if (n == m_object_cells.end())
+		return;
+
+	std::map<v3s16, std::set<u16> >::iterator c = m_cells.find(n->second);
+	if (c != m_cells.end()) {
+		c->second.erase(id);
+		if (c->second.empty())
+			m_cells.erase(c);
+	}
+	m_object_cells.erase(n);
+}
+
+bool ActiveObjectGrid::update(u16 id, v3f pos)
+{
+	std::map<u16, v3s16>::iterator n = m_object_cells.find(id);
+	if (n == m_object_cells.end())
+		return false;
+
+	v3s16 cell = getCell(pos);
+	if (cell == n->second)
+		return false;
+
+	std::map<v3s16, std::set<u16> >::iterator c = m_cells.find(n->second);
+	if (c != m_cells.end()) {
+		c->second.erase(id);
+		if (c->second.empty())
+			m_cells.erase(c);
+	}
+	m_cells[cell].insert(id);
+	n->second = cell;
+	return true;
+}
+
+void ActiveObjectGrid::getObjectsInArea(v3f minp, v3f maxp,
+		std::vector<u16> &result) const
+{
+	v3s16 cellmin = getCell(minp);
+	v3s16 cellmax = getCell(maxp);
+
+	s64 cell_count = (s64)(cellmax.X - cellmin.X + 1)
+			* (cellmax.Y - cellmin.Y + 1)
+			* (cellmax.Z - cellmin.Z + 1);
+
+	// For huge areas it is cheaper to filter the occupied cells
+	if (cell_count > (s64)m_cells.size()) {
+		for (std::map<v3s16, std::set<u16> >::const_iterator
+				i = m_cells.begin(); i != m_cells.end(); ++i) {
+			const v3s16 &cell = i->first;
+			if (cell.X < cellmin.X || cell.X > cellmax.X ||
+					cell.Y < cellmin.Y || cell.Y > cellmax.Y ||
+					cell.Z < cellmin.Z || cell.Z > cellmax.Z)
+				continue;
+			result.insert(result.end(), i->second.begin(), i->second.end());
+		}
+		return;
+	}
+
+	v3s16 cell;
+	for (cell.X = cellmin.X; cell.X <= cellmax.X; cell.X++)
+	for (cell.Y = cellmin.Y; cell.Y <= cellmax.Y; cell.Y++)
+	for (cell.Z = cellmin.Z; cell.Z <= cellmax.Z; cell.Z++) {
+		std::map<v3s16, std::set<u16> >::const_iterator i = m_cells.find(cell);
+		if (i == m_cells.end())
+			continue;
+		result.insert(result.end(), i->second.begin(), i->second.end());
+	}
+}
+
 /*
 	ServerEnvironment
 */
@@ -349,12 +444,18 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_game_time(0),
 	m_game_time_fraction_counter(0),
 	m_recommended_send_interval(0.1),
-	m_max_lag_estimate(0.1)
+	m_max_lag_estimate(0.1),
+	m_abm_workers(NULL)
 {
+	u16 num_abm_threads = g_settings->getU16("num_abm_threads");
+	if (num_abm_threads > 0)
+		m_abm_workers = new WorkerPool("ABM", num_abm_threads);
 }
 
 ServerEnvironment::~ServerEnvironment()
 {
+	delete m_abm_workers;
+
 	// Clear active block list.
 	// This makes the next one delete all active objects.
 	m_active_blocks.clear();
@@ -546,19 +647,98 @@ struct ActiveABM
 {
 	ActiveBlockModifier *abm;
 	int chance;
-	std::set<content_t> required_neighbors;
+	// Indexed by content id, empty if any neighbor will do
+	std::vector<bool> required_neighbors;
+
+	bool isRequiredNeighbor(content_t c) const
+	{
+		return c < required_neighbors.size() && required_neighbors[c];
+	}
+};
+
+struct ABMCandidate
+{
+	ABMCandidate(v3s16 p_, content_t c_, ActiveABM *aabm_):
+		p(p_), c(c_), aabm(aabm_)
+	{}
+
+	v3s16 p;
+	content_t c;
+	ActiveABM *aabm;
 };
 
 class ABMHandler
 {
 private:
 	ServerEnvironment *m_env;
-	std::map<content_t, std::vector<ActiveABM> > m_aabms;
+	// Indexed by content id, NULL for contents without ABMs
+	std::vector<std::vector<ActiveABM> *> m_aabms;
+	bool m_aabms_empty;
+
+	/*
+		Finds the ABM candidates of one block, i.e. the nodes that pass
+		the content, chance and neighbor checks. Only the block and its
+		neighbours, fetched beforehand, are accessed, so this can run
+		on a worker thread while the server thread waits.
+	*/
+	class ScanJob : public WorkerPool::Job
+	{
+	public:
+		ScanJob(ABMHandler *handler, ServerMap *map, v3s16 blockpos_, u64 seed):
+			blockpos(blockpos_),
+			m_handler(handler),
+			m_random(seed)
+		{
+			v3s16 d;
+			for (d.Z = -1; d.Z <= 1; d.Z++)
+			for (d.Y = -1; d.Y <= 1; d.Y++)
+			for (d.X = -1; d.X <= 1; d.X++)
+				m_blocks[(d.Z + 1) * 9 + (d.Y + 1) * 3 + (d.X + 1)] =
+					map->getBlockNoCreateNoEx(blockpos + d);
+		}
+
+		void run()
+		{
+			m_handler->scan(this);
+		}
+
+		MapBlock *getBlock()
+		{
+			return m_blocks[13];
+		}
+
+		// p is relative to the block, and may be one node outside of it
+		MapNode getNode(v3s16 p)
+		{
+			v3s16 b(p.X < 0 ? 0 : p.X < MAP_BLOCKSIZE ? 1 : 2,
+				p.Y < 0 ? 0 : p.Y < MAP_BLOCKSIZE ? 1 : 2,
+				p.Z < 0 ? 0 : p.Z < MAP_BLOCKSIZE ? 1 : 2);
+			MapBlock *block = m_blocks[b.Z * 9 + b.Y * 3 + b.X];
+			if (block == NULL)
+				return MapNode(CONTENT_IGNORE);
+			return block->getNodeNoEx(p - (b - v3s16(1,1,1)) * MAP_BLOCKSIZE);
+		}
+
+		u32 random()
+		{
+			return m_random.next();
+		}
+
+		v3s16 blockpos;
+		std::vector<ABMCandidate> candidates;
+
+	private:
+		ABMHandler *m_handler;
+		PcgRandom m_random;
+		MapBlock *m_blocks[27];
+	};
+
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 			float dtime_s, ServerEnvironment *env,
 			bool use_timers):
-		m_env(env)
+		m_env(env),
+		m_aabms_empty(true)
 	{
 		if(dtime_s < 0.001)
 			return;
@@ -595,11 +775,20 @@ class ABMHandler
 			// Trigger neighbors
 			std::set<std::string> required_neighbors_s
 					= abm->getRequiredNeighbors();
+			std::set<content_t> required_neighbors;
 			for(std::set<std::string>::iterator
 					i = required_neighbors_s.begin();
 					i != required_neighbors_s.end(); ++i)
 			{
-				ndef->getIds(*i, aabm.required_neighbors);
+				ndef->getIds(*i, required_neighbors);
+			}
+			if(!required_neighbors.empty()) {
+				aabm.required_neighbors.resize(
+						*required_neighbors.rbegin() + 1, false);
+				for(std::set<content_t>::const_iterator
+						k = required_neighbors.begin();
+						k != required_neighbors.end(); ++k)
+					aabm.required_neighbors[*k] = true;
 			}
 			// Trigger contents
 			std::set<std::string> contents_s = abm->getTriggerContents();
@@ -612,18 +801,36 @@ class ABMHandler
 						k != ids.end(); ++k)
 				{
 					content_t c = *k;
-					std::map<content_t, std::vector<ActiveABM> >::iterator j;
-					j = m_aabms.find(c);
-					if(j == m_aabms.end()){
-						std::vector<ActiveABM> aabmlist;
-						m_aabms[c] = aabmlist;
-						j = m_aabms.find(c);
-					}
-					j->second.push_back(aabm);
+					if(c >= m_aabms.size())
+						m_aabms.resize(c + 1, NULL);
+					if(m_aabms[c] == NULL)
+						m_aabms[c] = new std::vector<ActiveABM>;
+					m_aabms[c]->push_back(aabm);
+					m_aabms_empty = false;
 				}
 			}
 		}
 	}
+	~ABMHandler()
+	{
+		for(size_t i = 0; i < m_aabms.size(); i++)
+			delete m_aabms[i];
+	}
+	inline std::vector<ActiveABM> *getAABMs(content_t c)
+	{
+		return c < m_aabms.size() ? m_aabms[c] : NULL;
+	}
+	// Whether any node of the block can trigger an ABM
+	bool hasTriggerContent(MapBlock *block)
+	{
+		const std::vector<content_t> &contents = block->getContents();
+		for(std::vector<content_t>::const_iterator
+				i = contents.begin(); i != contents.end(); ++i) {
+			if(getAABMs(*i) != NULL)
+				return true;
+		}
+		return false;
+	}
 	// Find out how many objects the given block and its neighbours contain.
 	// Returns the number of objects in the block, and also in 'wider' the
 	// number of objects in the block and all its neighbours. The latter
@@ -654,7 +861,7 @@ class ABMHandler
 	}
 	void apply(MapBlock *block)
 	{
-		if(m_aabms.empty())
+		if(m_aabms_empty || !hasTriggerContent(block))
 			return;
 
 		ServerMap *map = &m_env->getServerMap();
@@ -672,13 +879,12 @@ class ABMHandler
 			content_t c = n.getContent();
 			v3s16 p = p0 + block->getPosRelative();
 
-			std::map<content_t, std::vector<ActiveABM> >::iterator j;
-			j = m_aabms.find(c);
-			if(j == m_aabms.end())
+			std::vector<ActiveABM> *aabms = getAABMs(c);
+			if(aabms == NULL)
 				continue;
 
 			for(std::vector<ActiveABM>::iterator
-					i = j->second.begin(); i != j->second.end(); ++i) {
+					i = aabms->begin(); i != aabms->end(); ++i) {
 				if(myrand() % i->chance != 0)
 					continue;
 
@@ -693,12 +899,8 @@ class ABMHandler
 						if(p1 == p)
 							continue;
 						MapNode n = map->getNodeNoEx(p1);
-						content_t c = n.getContent();
-						std::set<content_t>::const_iterator k;
-						k = i->required_neighbors.find(c);
-						if(k != i->required_neighbors.end()){
+						if(i->isRequiredNeighbor(n.getContent()))
 							goto neighbor_found;
-						}
 					}
 					// No required neighbor found
 					continue;
@@ -718,6 +920,112 @@ class ABMHandler
 			}
 		}
 	}
+	void scan(ScanJob *job)
+	{
+		MapBlock *block = job->getBlock();
+		if(block == NULL || !hasTriggerContent(block))
+			return;
+
+		v3s16 p0;
+		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
+		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
+		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
+		{
+			content_t c = block->getNodeNoEx(p0).getContent();
+
+			std::vector<ActiveABM> *aabms = getAABMs(c);
+			if(aabms == NULL)
+				continue;
+
+			for(std::vector<ActiveABM>::iterator
+					i = aabms->begin(); i != aabms->end(); ++i) {
+				if(job->random() % i->chance != 0)
+					continue;
+
+				// Check neighbors
+				if(!i->required_neighbors.empty())
+				{
+					v3s16 p1;
+					for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+					{
+						if(p1 == p0)
+							continue;
+						content_t c = job->getNode(p1).getContent();
+						if(i->isRequiredNeighbor(c))
+							goto neighbor_found;
+					}
+					// No required neighbor found
+					continue;
+				}
+neighbor_found:
+
+				job->candidates.push_back(ABMCandidate(
+						p0 + block->getPosRelative(), c, &(*i)));
+			}
+		}
+	}
+	/*
+		Like apply(), but the blocks are scanned on the worker pool and
+		only the triggers are run here. Candidates are found on the state
+		of the map before any of the triggers run.
+	*/
+	void applyParallel(const std::vector<v3s16> &blocks, WorkerPool *workers)
+	{
+		if(m_aabms_empty)
+			return;
+
+		ServerMap *map = &m_env->getServerMap();
+
+		std::vector<ScanJob> jobs;
+		jobs.reserve(blocks.size());
+		for(std::vector<v3s16>::const_iterator
+				i = blocks.begin(); i != blocks.end(); ++i) {
+			u64 seed = ((u64)myrand() << 32) | myrand();
+			jobs.push_back(ScanJob(this, map, *i, seed));
+		}
+
+		std::vector<WorkerPool::Job *> job_ptrs;
+		job_ptrs.reserve(jobs.size());
+		for(size_t i = 0; i < jobs.size(); i++)
+			job_ptrs.push_back(&jobs[i]);
+		workers->run(job_ptrs);
+
+		for(std::vector<ScanJob>::iterator
+				job = jobs.begin(); job != jobs.end(); ++job) {
+			if(job->candidates.empty())
+				continue;
+
+			// Triggers of earlier blocks may have unloaded this one
+			MapBlock *block = map->getBlockNoCreateNoEx(job->blockpos);
+			if(block == NULL)
+				continue;
+
+			u32 active_object_count_wider;
+			u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
+			m_env->m_added_objects = 0;
+
+			for(std::vector<ABMCandidate>::iterator
+					i = job->candidates.begin(); i != job->candidates.end(); ++i) {
+				// Skip nodes that were changed by earlier triggers
+				MapNode n = block->getNodeNoEx(i->p - block->getPosRelative());
+				if(n.getContent() != i->c)
+					continue;
+
+				// Call all the trigger variations
+				i->aabm->abm->trigger(m_env, i->p, n);
+				i->aabm->abm->trigger(m_env, i->p, n,
+						active_object_count, active_object_count_wider);
+
+				// Count surrounding objects again if the abms added any
+				if(m_env->m_added_objects > 0) {
+					active_object_count = countObjects(block, map, active_object_count_wider);
+					m_env->m_added_objects = 0;
+				}
+			}
+		}
+	}
 };
 
 void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
@@ -839,19 +1147,34 @@ bool ServerEnvironment::swapNode(v3s16 p, const MapNode &n)
 
 void ServerEnvironment::getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius)
 {
-	for(std::map<u16, ServerActiveObject*>::iterator
-			i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i)
+	std::vector<u16> candidates;
+	m_active_object_grid.getObjectsInArea(pos - v3f(radius, radius, radius),
+			pos + v3f(radius, radius, radius), candidates);
+	// Keep the result in id order, as callers got it before the grid
+	std::sort(candidates.begin(), candidates.end());
+
+	for(std::vector<u16>::iterator i = candidates.begin();
+			i != candidates.end(); ++i)
 	{
-		ServerActiveObject* obj = i->second;
-		u16 id = i->first;
+		ServerActiveObject* obj = getActiveObject(*i);
+		if(obj == NULL)
+			continue;
 		v3f objectpos = obj->getBasePosition();
 		if(objectpos.getDistanceFrom(pos) > radius)
 			continue;
-		objects.push_back(id);
+		objects.push_back(*i);
 	}
 }
 
+void ServerEnvironment::updateActiveObjectPosition(ServerActiveObject *obj)
+{
+	// Ignore objects that are not (or no longer) registered under their id
+	if (getActiveObject(obj->getId()) != obj)
+		return;
+	if (m_active_object_grid.update(obj->getId(), obj->getBasePosition()))
+		m_active_object_events.insert(obj->getId());
+}
+
 void ServerEnvironment::clearAllObjects()
 {
 	infostream<<"ServerEnvironment::clearAllObjects(): "
@@ -876,8 +1199,8 @@ void ServerEnvironment::clearAllObjects()
 		}
 		// If known by some client, don't delete immediately
 		if(obj->m_known_by_count > 0){
-			obj->m_pending_deactivation = true;
-			obj->m_removed = true;
+			obj->markForDeactivation();
+			obj->markForRemoval();
 			continue;
 		}
 
@@ -897,6 +1220,7 @@ void ServerEnvironment::clearAllObjects()
 	for(std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		m_active_object_grid.remove(*i);
 	}
 
 	// Get list of loaded blocks
@@ -1169,6 +1493,7 @@ void ServerEnvironment::step(float dtime)
 		// Initialize handling of ActiveBlockModifiers
 		ABMHandler abmhandler(m_abms, abm_interval, this, true);
 
+		std::vector<v3s16> abm_blocks;
 		for(std::set<v3s16>::iterator
 				i = m_active_blocks.m_list.begin();
 				i != m_active_blocks.m_list.end(); ++i)
@@ -1186,9 +1511,15 @@ void ServerEnvironment::step(float dtime)
 			block->setTimestampNoChangedFlag(m_game_time);
 
 			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block);
+			if(m_abm_workers)
+				abm_blocks.push_back(p);
+			else
+				abmhandler.apply(block);
 		}
 
+		if(!abm_blocks.empty())
+			abmhandler.applyParallel(abm_blocks, m_abm_workers);
+
 		u32 time_ms = timer.stop(true);
 		u32 max_time_ms = 200;
 		if(time_ms > max_time_ms){
@@ -1298,6 +1629,23 @@ u16 ServerEnvironment::addActiveObject(ServerActiveObject *object)
 	return id;
 }
 
+/*
+	Whether a client whose player is in player_block sees the object.
+	Distances are measured between blocks so that the result only
+	changes when the player or the object moves to another block.
+*/
+static bool is_object_in_range(ServerActiveObject *object,
+		v3s16 player_block, s16 radius, s16 player_radius)
+{
+	v3s16 d = ActiveObjectGrid::getCell(object->getBasePosition())
+			- player_block;
+	s32 distance_sq = (s32)d.X * d.X + (s32)d.Y * d.Y + (s32)d.Z * d.Z;
+	if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		return player_radius <= 0 ||
+				distance_sq <= (s32)player_radius * player_radius;
+	return distance_sq <= (s32)radius * radius;
+}
+
 /*
 	Finds out what new objects have been added to
 	inside a radius around a position
@@ -1307,26 +1655,49 @@ void ServerEnvironment::getAddedActiveObjects(Player *player, s16 radius,
 		std::set<u16> &current_objects,
 		std::queue<u16> &added_objects)
 {
-	f32 radius_f = radius * BS;
-	f32 player_radius_f = player_radius * BS;
+	v3f player_pos = player->getPosition();
+	v3s16 player_block = ActiveObjectGrid::getCell(player_pos);
 
-	if (player_radius_f < 0)
-		player_radius_f = 0;
+	/*
+		Collect the objects near the player from the grid. Players are
+		not limited by distance if player_radius is 0, so take all of
+		them from the player list in that case. The query reaches one
+		block further as the range is measured between blocks.
+	*/
+	s16 query_blocks = player_radius <= 0 ? radius :
+			MYMAX(radius, player_radius);
+	f32 query_radius = (query_blocks + 1) * MAP_BLOCKSIZE * BS;
+	std::vector<u16> candidates;
+	m_active_object_grid.getObjectsInArea(
+			player_pos - v3f(query_radius, query_radius, query_radius),
+			player_pos + v3f(query_radius, query_radius, query_radius),
+			candidates);
+	if (player_radius <= 0) {
+		for (std::vector<Player*>::iterator i = m_players.begin();
+				i != m_players.end(); ++i) {
+			PlayerSAO *sao = (*i)->getPlayerSAO();
+			if (sao && sao->getId() != 0)
+				candidates.push_back(sao->getId());
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()),
+			candidates.end());
 
 	/*
-		Go through the object list,
+		Go through the candidates,
 		- discard m_removed objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for(std::map<u16, ServerActiveObject*>::iterator
-			i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i) {
-		u16 id = i->first;
+	for(std::vector<u16>::iterator
+			i = candidates.begin();
+			i != candidates.end(); ++i) {
+		u16 id = *i;
 
 		// Get object
-		ServerActiveObject *object = i->second;
+		ServerActiveObject *object = getActiveObject(id);
 		if(object == NULL)
 			continue;
 
@@ -1334,12 +1705,8 @@ void ServerEnvironment::getAddedActiveObjects(Player *player, s16 radius,
 		if(object->m_removed || object->m_pending_deactivation)
 			continue;
 
-		f32 distance_f = object->getBasePosition().getDistanceFrom(player->getPosition());
-		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
-			// Discard if too far
-			if (distance_f > player_radius_f && player_radius_f != 0)
-				continue;
-		} else if (distance_f > radius_f)
+		// Discard if too far
+		if (!is_object_in_range(object, player_block, radius, player_radius))
 			continue;
 
 		// Discard if already on current_objects
@@ -1361,11 +1728,7 @@ void ServerEnvironment::getRemovedActiveObjects(Player *player, s16 radius,
 		std::set<u16> &current_objects,
 		std::queue<u16> &removed_objects)
 {
-	f32 radius_f = radius * BS;
-	f32 player_radius_f = player_radius * BS;
-
-	if (player_radius_f < 0)
-		player_radius_f = 0;
+	v3s16 player_block = ActiveObjectGrid::getCell(player->getPosition());
 
 	/*
 		Go through current_objects; object is removed if:
@@ -1394,11 +1757,7 @@ void ServerEnvironment::getRemovedActiveObjects(Player *player, s16 radius,
 			continue;
 		}
 
-		f32 distance_f = object->getBasePosition().getDistanceFrom(player->getPosition());
-		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
-			if (distance_f <= player_radius_f || player_radius_f == 0)
-				continue;
-		} else if (distance_f <= radius_f)
+		if (is_object_in_range(object, player_block, radius, player_radius))
 			continue;
 
 		// Object is no longer visible
@@ -1406,6 +1765,38 @@ void ServerEnvironment::getRemovedActiveObjects(Player *player, s16 radius,
 	}
 }
 
+/*
+	Looks only at the objects in m_active_object_events. An object that
+	did not change since the last full update keeps its visibility as long
+	as the player stays in the same block.
+*/
+void ServerEnvironment::getChangedActiveObjects(Player *player, s16 radius,
+		s16 player_radius,
+		std::set<u16> &current_objects,
+		std::queue<u16> &added_objects,
+		std::queue<u16> &removed_objects)
+{
+	v3s16 player_block = ActiveObjectGrid::getCell(player->getPosition());
+
+	for(std::set<u16>::iterator
+			i = m_active_object_events.begin();
+			i != m_active_object_events.end(); ++i)
+	{
+		u16 id = *i;
+		bool known = current_objects.find(id) != current_objects.end();
+		ServerActiveObject *object = getActiveObject(id);
+
+		bool visible = object != NULL &&
+				!object->m_removed && !object->m_pending_deactivation &&
+				is_object_in_range(object, player_block, radius, player_radius);
+
+		if (visible && !known)
+			added_objects.push(id);
+		else if (!visible && known)
+			removed_objects.push(id);
+	}
+}
+
 void ServerEnvironment::setStaticForActiveObjectsInBlock(
 	v3s16 blockpos, bool static_exists, v3s16 static_block)
 {
@@ -1490,6 +1881,8 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 			<<"added (id="<<object->getId()<<")"<<std::endl;*/
 
 	m_active_objects[object->getId()] = object;
+	m_active_object_grid.insert(object->getId(), object->getBasePosition());
+	m_active_object_events.insert(object->getId());
 
 	verbosestream<<"ServerEnvironment::addActiveObjectRaw(): "
 			<<"Added id="<<object->getId()<<"; there are now "
@@ -1616,6 +2009,7 @@ void ServerEnvironment::removeRemovedObjects()
 	for(std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		m_active_object_grid.remove(*i);
 	}
 }
 
@@ -1728,7 +2122,11 @@ void ServerEnvironment::activateObjects(MapBlock *block, u32 dtime_s)
 		u16 id = i->first;
 		ServerActiveObject *object = getActiveObject(id);
 		assert(object);
-		object->m_pending_deactivation = false;
+		if (object->m_pending_deactivation) {
+			// Clients may have forgotten it already
+			object->m_pending_deactivation = false;
+			m_active_object_events.insert(id);
+		}
 	}
 
 	/*
@@ -1953,7 +2351,7 @@ void ServerEnvironment::deactivateFarObjects(bool force_delete)
 					<<"object id="<<id<<" is known by clients"
 					<<"; not deleting yet"<<std::endl;
 
-			obj->m_pending_deactivation = true;
+			obj->markForDeactivation();
 			continue;
 		}
 
@@ -1977,6 +2375,7 @@ void ServerEnvironment::deactivateFarObjects(bool force_delete)
 	for(std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		m_active_object_grid.remove(*i);
 	}
 }
 
@@ -53,6 +53,7 @@ class ClientMap;
 class GameScripting;
 class Player;
 class RemotePlayer;
+class WorkerPool;
 
 class Environment
 {
@@ -205,6 +206,36 @@ class ActiveBlockList
 private:
 };
 
+/*
+	Spatial index of active objects, used by ServerEnvironment.
+
+	Objects are bucketed by the MapBlock their base position is in, so
+	that area queries only look at the cells overlapping the query
+	instead of every active object. Results are candidates; callers
+	still have to do the exact distance check.
+*/
+
+class ActiveObjectGrid
+{
+public:
+	void insert(u16 id, v3f pos);
+	void remove(u16 id);
+	// Does nothing if the object is not in the grid.
+	// Returns true if the object moved to another cell.
+	bool update(u16 id, v3f pos);
+
+	// Appends the ids of all objects in cells overlapping the box
+	void getObjectsInArea(v3f minp, v3f maxp, std::vector<u16> &result) const;
+
+	// The cell of a position, which is the MapBlock it is in
+	static v3s16 getCell(v3f pos);
+
+private:
+
+	std::map<v3s16, std::set<u16> > m_cells;
+	std::map<u16, v3s16> m_object_cells;
+};
+
 /*
 	The server-side environment.
 
@@ -273,7 +304,9 @@ class ServerEnvironment : public Environment
 
 	/*
 		Find out what new objects have been added to
-		inside a radius around a position
+		inside a radius around a position.
+		The radii are in blocks and measured from the block of the player
+		to the block of the object, player_radius <= 0 is unlimited.
 	*/
 	void getAddedActiveObjects(Player *player, s16 radius,
 			s16 player_radius,
@@ -289,6 +322,26 @@ class ServerEnvironment : public Environment
 			std::set<u16> &current_objects,
 			std::queue<u16> &removed_objects);
 
+	/*
+		Same as the two above, but only looks at the objects that were
+		added, moved to another block or marked for removal since
+		clearActiveObjectEvents(). Only gives the right result if the
+		player stayed in the same block and current_objects was up to
+		date at that time.
+	*/
+	void getChangedActiveObjects(Player *player, s16 radius,
+			s16 player_radius,
+			std::set<u16> &current_objects,
+			std::queue<u16> &added_objects,
+			std::queue<u16> &removed_objects);
+
+	void clearActiveObjectEvents()
+		{ m_active_object_events.clear(); }
+
+	// Remembers a change of the object for getChangedActiveObjects()
+	void addActiveObjectEvent(u16 id)
+		{ m_active_object_events.insert(id); }
+
 	/*
 		Get the next message emitted by some active object.
 		Returns a message with id=0 if no messages are available.
@@ -321,6 +374,9 @@ class ServerEnvironment : public Environment
 	// Find all active objects inside a radius around a point
 	void getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius);
 
+	// Called by ServerActiveObject when its base position changes
+	void updateActiveObjectPosition(ServerActiveObject *obj);
+
 	// Clear all objects, loading and going through every MapBlock
 	void clearAllObjects();
 
@@ -396,6 +452,11 @@ class ServerEnvironment : public Environment
 	const std::string m_path_world;
 	// Active object list
 	std::map<u16, ServerActiveObject*> m_active_objects;
+	// Active objects by position, for area queries
+	ActiveObjectGrid m_active_object_grid;
+	// Objects that changed in a way that matters to the clients knowing
+	// them, see getChangedActiveObjects()
+	std::set<u16> m_active_object_events;
 	// Outgoing network message buffer for active objects
 	std::queue<ActiveObjectMessage> m_active_object_messages;
 	// Some timers
@@ -418,6 +479,8 @@ class ServerEnvironment : public Environment
 	// Estimate for general maximum lag as determined by server.
 	// Can raise to high values like 15s with eg. map generation mods.
 	float m_max_lag_estimate;
+	// Threads for finding ABM candidates, NULL if disabled
+	WorkerPool *m_abm_workers;
 };
 
 #ifndef SERVER
@@ -1394,6 +1394,17 @@ struct RunStats {
 	Jitter dtime_jitter, busy_time_jitter;
 };
 
+/* Frame statistics of the --benchmark mode
+ */
+struct BenchmarkStats {
+	u32 frames;
+	u32 last_time_us;
+	u64 total_time_us;
+	u32 max_frame_time_us;
+	u64 draw_calls;
+	u64 material_changes;
+};
+
 /* Flags that can, or may, change during main game loop
  */
 struct VolatileRunFlags {
@@ -1426,6 +1437,7 @@ class Game {
 
 	bool startup(bool *kill,
 			bool random_input,
+			u32 benchmark_frames,
 			InputHandler *input,
 			IrrlichtDevice *device,
 			const std::string &map_dir,
@@ -1477,6 +1489,8 @@ class Game {
 	void addProfilerGraphs(const RunStats &stats, const FpsControl &draw_times,
 			f32 dtime);
 	void updateStats(RunStats *stats, const FpsControl &draw_times, f32 dtime);
+	// Returns true when the benchmark is done
+	bool updateBenchmark(BenchmarkStats *stats);
 
 	void processUserInput(VolatileRunFlags *flags, GameRunData *runData,
 			f32 dtime);
@@ -1598,6 +1612,7 @@ class Game {
 	scene::ISceneNode *skybox;
 
 	bool random_input;
+	u32 benchmark_frames;
 	bool simple_singleplayer_mode;
 	/* End 'cache' */
 
@@ -1733,6 +1748,7 @@ Game::~Game()
 
 bool Game::startup(bool *kill,
 		bool random_input,
+		u32 benchmark_frames,
 		InputHandler *input,
 		IrrlichtDevice *device,
 		const std::string &map_dir,
@@ -1752,6 +1768,7 @@ bool Game::startup(bool *kill,
 	this->error_message       = &error_message;
 	this->reconnect_requested = reconnect;
 	this->random_input        = random_input;
+	this->benchmark_frames    = benchmark_frames;
 	this->input               = input;
 	this->chat_backend        = chat_backend;
 	this->simple_singleplayer_mode = simple_singleplayer_mode;
@@ -1779,6 +1796,7 @@ void Game::run()
 	CameraOrientation cam_view  = { 0 };
 	GameRunData runData         = { 0 };
 	FpsControl draw_times       = { 0 };
+	BenchmarkStats benchmark    = { 0 };
 	VolatileRunFlags flags      = { 0 };
 	f32 dtime; // in seconds
 
@@ -1798,6 +1816,7 @@ void Game::run()
 	g_profiler->graphGet(dummyvalues);
 
 	draw_times.last_time = device->getTimer()->getTime();
+	benchmark.last_time_us = porting::getTimeUs();
 
 	shader_src->addGlobalConstantSetter(new GameGlobalShaderConstantSetter(
 			sky,
@@ -1862,6 +1881,9 @@ void Game::run()
 
 		// Update if minimap has been disabled by the server
 		flags.show_minimap &= !client->isMinimapDisabledByServer();
+
+		if (benchmark_frames != 0 && updateBenchmark(&benchmark))
+			break;
 	}
 }
 
@@ -2504,6 +2526,34 @@ void Game::addProfilerGraphs(const RunStats &stats,
 }
 
 
+bool Game::updateBenchmark(BenchmarkStats *stats)
+{
+	u32 time = porting::getTimeUs();
+	u32 frame_time = time - stats->last_time_us;
+	stats->last_time_us = time;
+
+	stats->frames++;
+	stats->total_time_us += frame_time;
+	stats->max_frame_time_us = MYMAX(stats->max_frame_time_us, frame_time);
+
+	ClientMap &map = client->getEnv().getClientMap();
+	stats->draw_calls += map.getDrawCallCount();
+	stats->material_changes += map.getMaterialChangeCount();
+
+	if (stats->frames < benchmark_frames)
+		return false;
+
+	rawstream << "Benchmark: " << stats->frames << " frames, "
+			<< "average frame time "
+			<< stats->total_time_us / stats->frames / 1000.0 << " ms, "
+			<< "maximum " << stats->max_frame_time_us / 1000.0 << " ms, "
+			<< "average draw calls "
+			<< (float)stats->draw_calls / stats->frames << ", "
+			<< "average material changes "
+			<< (float)stats->material_changes / stats->frames << std::endl;
+	return true;
+}
+
 void Game::updateStats(RunStats *stats, const FpsControl &draw_times,
 		f32 dtime)
 {
@@ -4295,7 +4345,7 @@ inline void Game::limitFps(FpsControl *fps_timings, f32 *dtime)
 			? g_settings->getFloat("pause_fps_max")
 			: g_settings->getFloat("fps_max"));
 
-	if (fps_timings->busy_time < frametime_min) {
+	if (fps_timings->busy_time < frametime_min && benchmark_frames == 0) {
 		fps_timings->sleep_time = frametime_min - fps_timings->busy_time;
 		device->sleep(fps_timings->sleep_time);
 	} else {
@@ -4383,6 +4433,7 @@ void Game::extendedResourceCleanup()
 
 void the_game(bool *kill,
 		bool random_input,
+		u32 benchmark_frames,
 		InputHandler *input,
 		IrrlichtDevice *device,
 
@@ -4408,10 +4459,10 @@ void the_game(bool *kill,
 
 	try {
 
-		if (game.startup(kill, random_input, input, device, map_dir,
-				playername, password, &server_address, port, error_message,
-				reconnect_requested, &chat_backend, gamespec,
-				simple_singleplayer_mode)) {
+		if (game.startup(kill, random_input, benchmark_frames, input,
+				device, map_dir, playername, password, &server_address,
+				port, error_message, reconnect_requested, &chat_backend,
+				gamespec, simple_singleplayer_mode)) {
 			game.run();
 			game.shutdown();
 		}
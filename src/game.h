@@ -138,6 +138,7 @@ struct SubgameSpec;
 
 void the_game(bool *kill,
 		bool random_input,
+		u32 benchmark_frames, // Exit after this many frames if not 0
 		InputHandler *input,
 		IrrlichtDevice *device,
 		const std::string &map_dir,
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "genericobject.h"
 #include <sstream>
 #include "util/serialize.h"
+#include "util/numeric.h"
 
 std::string gob_cmd_set_properties(const ObjectProperties &prop)
 {
@@ -65,6 +66,67 @@ std::string gob_cmd_update_position(
 	return os.str();
 }
 
+#define COMPACT_POSITION_INTERPOLATE 0x01
+#define COMPACT_POSITION_MOVEMENT_END 0x02
+#define COMPACT_POSITION_VELOCITY 0x04
+#define COMPACT_POSITION_ACCELERATION 0x08
+
+std::string gob_cmd_update_position_compact(
+	v3f position,
+	v3f velocity,
+	v3f acceleration,
+	f32 yaw,
+	bool do_interpolate,
+	bool is_movement_end,
+	f32 update_interval
+){
+	u8 flags = 0;
+	if (do_interpolate)
+		flags |= COMPACT_POSITION_INTERPOLATE;
+	if (is_movement_end)
+		flags |= COMPACT_POSITION_MOVEMENT_END;
+	if (velocity != v3f(0,0,0))
+		flags |= COMPACT_POSITION_VELOCITY;
+	if (acceleration != v3f(0,0,0))
+		flags |= COMPACT_POSITION_ACCELERATION;
+
+	std::ostringstream os(std::ios::binary);
+	// command
+	writeU8(os, GENERIC_CMD_UPDATE_POSITION_COMPACT);
+	writeU8(os, flags);
+	writeV3F1000(os, position);
+	if (flags & COMPACT_POSITION_VELOCITY)
+		writeV3F1000(os, velocity);
+	if (flags & COMPACT_POSITION_ACCELERATION)
+		writeV3F1000(os, acceleration);
+	// yaw, 65536 = 360 degrees
+	writeU16(os, (u32)(wrapDegrees_0_360(yaw) * 65536 / 360 + 0.5) & 0xffff);
+	// update_interval in milliseconds
+	writeU16(os, MYMIN(update_interval * 1000 + 0.5, 65535));
+	return os.str();
+}
+
+void gob_read_update_position_compact(std::istream &is,
+	v3f *position,
+	v3f *velocity,
+	v3f *acceleration,
+	f32 *yaw,
+	bool *do_interpolate,
+	bool *is_movement_end,
+	f32 *update_interval
+){
+	u8 flags = readU8(is);
+	*do_interpolate = flags & COMPACT_POSITION_INTERPOLATE;
+	*is_movement_end = flags & COMPACT_POSITION_MOVEMENT_END;
+	*position = readV3F1000(is);
+	*velocity = (flags & COMPACT_POSITION_VELOCITY) ?
+		readV3F1000(is) : v3f(0,0,0);
+	*acceleration = (flags & COMPACT_POSITION_ACCELERATION) ?
+		readV3F1000(is) : v3f(0,0,0);
+	*yaw = readU16(is) * 360.0 / 65536;
+	*update_interval = readU16(is) / 1000.0;
+}
+
 std::string gob_cmd_set_texture_mod(const std::string &mod)
 {
 	std::ostringstream os(std::ios::binary);
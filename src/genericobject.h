@@ -35,7 +35,8 @@ enum GenericCMD {
 	GENERIC_CMD_SET_BONE_POSITION,
 	GENERIC_CMD_ATTACH_TO,
 	GENERIC_CMD_SET_PHYSICS_OVERRIDE,
-	GENERIC_CMD_UPDATE_NAMETAG_ATTRIBUTES
+	GENERIC_CMD_UPDATE_NAMETAG_ATTRIBUTES,
+	GENERIC_CMD_UPDATE_POSITION_COMPACT
 };
 
 #include "object_properties.h"
@@ -52,6 +53,30 @@ std::string gob_cmd_update_position(
 	f32 update_interval
 );
 
+/*
+	Same as the above, but leaves out zero velocity and acceleration and
+	quantizes yaw and update_interval. Needs protocol version 27.
+*/
+std::string gob_cmd_update_position_compact(
+	v3f position,
+	v3f velocity,
+	v3f acceleration,
+	f32 yaw,
+	bool do_interpolate,
+	bool is_movement_end,
+	f32 update_interval
+);
+// Reads the message after the command byte
+void gob_read_update_position_compact(std::istream &is,
+	v3f *position,
+	v3f *velocity,
+	v3f *acceleration,
+	f32 *yaw,
+	bool *do_interpolate,
+	bool *is_movement_end,
+	f32 *update_interval
+);
+
 std::string gob_cmd_set_texture_mod(const std::string &mod);
 
 std::string gob_cmd_set_sprite(
@@ -0,0 +1,161 @@
+/*
+Minetest
+Copyright (C) 2026 agent <agent@local>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "liquidqueue.h"
+#include <algorithm>
+#include <cstring>
+#include "util/numeric.h"
+
+LiquidQueue::Block::Block(u64 order_) :
+	order(order_)
+{
+	memset(queued, 0, sizeof(queued));
+}
+
+LiquidQueue::LiquidQueue() :
+	m_next_order(0),
+	m_size(0)
+{
+}
+
+LiquidQueue::~LiquidQueue()
+{
+	clear();
+}
+
+bool LiquidQueue::push(v3s16 p)
+{
+	v3s16 blockpos = getContainerPos(p, MAP_BLOCKSIZE);
+	v3s16 relpos = p - blockpos * MAP_BLOCKSIZE;
+	u16 index = (relpos.Z * MAP_BLOCKSIZE + relpos.Y) * MAP_BLOCKSIZE
+			+ relpos.X;
+
+	Block *block;
+	std::map<v3s16, Block *>::iterator i = m_blocks.find(blockpos);
+	if (i != m_blocks.end()) {
+		block = i->second;
+		if (block->queued[index >> 3] & (1 << (index & 7)))
+			return false;
+	} else {
+		block = new Block(m_next_order++);
+		m_blocks[blockpos] = block;
+	}
+
+	block->queued[index >> 3] |= 1 << (index & 7);
+	block->nodes.push_back(index);
+	m_size++;
+	return true;
+}
+
+void LiquidQueue::pop(u32 count, std::vector<v3s16> &nodes)
+{
+	if (count == 0 || m_size == 0)
+		return;
+
+	std::vector<BlockOrder> blocks;
+	getBlockOrder(blocks);
+
+	for (std::vector<BlockOrder>::iterator
+			i = blocks.begin(); i != blocks.end() && count > 0; ++i) {
+		Block *block = i->block;
+		v3s16 pos_relative = i->pos * MAP_BLOCKSIZE;
+		u32 n = MYMIN(count, block->nodes.size());
+		for (u32 j = 0; j < n; j++) {
+			u16 index = block->nodes[j];
+			block->queued[index >> 3] &= ~(1 << (index & 7));
+			nodes.push_back(pos_relative + v3s16(
+					index % MAP_BLOCKSIZE,
+					index / MAP_BLOCKSIZE % MAP_BLOCKSIZE,
+					index / (MAP_BLOCKSIZE * MAP_BLOCKSIZE)));
+		}
+		count -= n;
+		m_size -= n;
+
+		if (n == block->nodes.size()) {
+			m_blocks.erase(i->pos);
+			delete block;
+		} else {
+			block->nodes.erase(block->nodes.begin(),
+					block->nodes.begin() + n);
+		}
+	}
+}
+
+u32 LiquidQueue::removeBlock(v3s16 blockpos)
+{
+	std::map<v3s16, Block *>::iterator i = m_blocks.find(blockpos);
+	if (i == m_blocks.end())
+		return 0;
+
+	u32 count = i->second->nodes.size();
+	m_size -= count;
+	delete i->second;
+	m_blocks.erase(i);
+	return count;
+}
+
+void LiquidQueue::getFarthestBlocks(u32 count, std::vector<v3s16> &blocks)
+{
+	std::vector<BlockOrder> order;
+	getBlockOrder(order);
+
+	u32 found = 0;
+	for (std::vector<BlockOrder>::reverse_iterator
+			i = order.rbegin(); i != order.rend() && found < count; ++i) {
+		blocks.push_back(i->pos);
+		found += i->block->nodes.size();
+	}
+}
+
+u32 LiquidQueue::getFocusDistance(v3s16 blockpos) const
+{
+	u32 distance = 0;
+	for (u32 i = 0; i < m_focus.size(); i++) {
+		v3s32 d(blockpos.X - m_focus[i].X, blockpos.Y - m_focus[i].Y,
+				blockpos.Z - m_focus[i].Z);
+		u32 d2 = d.X * d.X + d.Y * d.Y + d.Z * d.Z;
+		if (i == 0 || d2 < distance)
+			distance = d2;
+	}
+	return distance;
+}
+
+void LiquidQueue::clear()
+{
+	for (std::map<v3s16, Block *>::iterator
+			i = m_blocks.begin(); i != m_blocks.end(); ++i)
+		delete i->second;
+	m_blocks.clear();
+	m_size = 0;
+}
+
+void LiquidQueue::getBlockOrder(std::vector<BlockOrder> &blocks)
+{
+	blocks.reserve(m_blocks.size());
+	for (std::map<v3s16, Block *>::iterator
+			i = m_blocks.begin(); i != m_blocks.end(); ++i) {
+		BlockOrder block;
+		block.order = i->second->order;
+		block.pos = i->first;
+		block.block = i->second;
+		block.distance = getFocusDistance(i->first);
+		blocks.push_back(block);
+	}
+	std::sort(blocks.begin(), blocks.end());
+}
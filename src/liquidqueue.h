@@ -0,0 +1,105 @@
+/*
+Minetest
+Copyright (C) 2026 agent <agent@local>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef LIQUIDQUEUE_HEADER
+#define LIQUIDQUEUE_HEADER
+
+#include <map>
+#include <vector>
+#include "irr_v3d.h"
+#include "constants.h"
+
+/*
+	Liquid nodes waiting to be transformed, kept by map block.
+
+	A node is in the queue at most once; checking for that is a bit test
+	in its block. The nodes of a block are taken in the order they were
+	queued. Blocks closest to the focus blocks are taken first, blocks
+	at the same distance in the order they got their first node.
+*/
+class LiquidQueue
+{
+public:
+	LiquidQueue();
+	~LiquidQueue();
+
+	// Returns false if the node is queued already
+	bool push(v3s16 p);
+
+	// Takes up to count nodes out of the queue
+	void pop(u32 count, std::vector<v3s16> &nodes);
+
+	// Drops the queued nodes of a block, returns how many there were
+	u32 removeBlock(v3s16 blockpos);
+
+	// Gets the blocks farthest from the focus that together hold at
+	// least count nodes, farthest first
+	void getFarthestBlocks(u32 count, std::vector<v3s16> &blocks);
+
+	// Positions of the blocks to take nodes near to first, usually the
+	// blocks of the players. Nothing is preferred if empty.
+	void setFocus(const std::vector<v3s16> &focus) { m_focus = focus; }
+
+	// Squared distance of a block to the nearest focus block, 0 if
+	// there is no focus
+	u32 getFocusDistance(v3s16 blockpos) const;
+
+	void clear();
+
+	u32 size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+private:
+	struct Block
+	{
+		Block(u64 order_);
+
+		// When the block got its first node
+		u64 order;
+		// Indices of the queued nodes in the block, in queue order
+		std::vector<u16> nodes;
+		// Bit for every node of the block that is in nodes
+		u8 queued[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE / 8];
+	};
+
+	struct BlockOrder
+	{
+		u32 distance;
+		u64 order;
+		v3s16 pos;
+		Block *block;
+
+		bool operator<(const BlockOrder &other) const
+		{
+			if (distance != other.distance)
+				return distance < other.distance;
+			return order < other.order;
+		}
+	};
+
+	// Gets all blocks, the ones to take first first
+	void getBlockOrder(std::vector<BlockOrder> &blocks);
+
+	std::map<v3s16, Block *> m_blocks;
+	std::vector<v3s16> m_focus;
+	u64 m_next_order;
+	u32 m_size;
+};
+
+#endif
@@ -46,6 +46,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "guiEngine.h"
 #include "map.h"
 #include "mapsector.h"
+#include "mapblock.h"
 #include "fontengine.h"
 #include "gameparams.h"
 #include "database.h"
@@ -100,6 +101,7 @@ static bool determine_subgame(GameParams *game_params);
 
 static bool run_dedicated_server(const GameParams &game_params, const Settings &cmd_args);
 static bool migrate_database(const GameParams &game_params, const Settings &cmd_args);
+static bool pregenerate_map(const GameParams &game_params, const Settings &cmd_args);
 
 /**********************************************************************/
 
@@ -277,6 +279,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Set gameid (\"--gameid list\" prints available ones)"))));
 	allowed_options->insert(std::make_pair("migrate", ValueSpec(VALUETYPE_STRING,
 			_("Migrate from current map backend to another (Only works when using minetestserver or with --server)"))));
+	allowed_options->insert(std::make_pair("pregenerate", ValueSpec(VALUETYPE_STRING,
+			_("Generate the map between two node positions \"(x,y,z) (x,y,z)\" and exit (Only works when using minetestserver or with --server)"))));
 #ifndef SERVER
 	allowed_options->insert(std::make_pair("videomodes", ValueSpec(VALUETYPE_FLAG,
 			_("Show available video modes"))));
@@ -286,6 +290,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Address to connect to. ('' = local game)"))));
 	allowed_options->insert(std::make_pair("random-input", ValueSpec(VALUETYPE_FLAG,
 			_("Enable random user input, for testing"))));
+	allowed_options->insert(std::make_pair("benchmark", ValueSpec(VALUETYPE_STRING,
+			_("Draw the given number of frames, print frame statistics and exit"))));
 	allowed_options->insert(std::make_pair("server", ValueSpec(VALUETYPE_FLAG,
 			_("Run dedicated server"))));
 	allowed_options->insert(std::make_pair("name", ValueSpec(VALUETYPE_STRING,
@@ -816,6 +822,10 @@ static bool run_dedicated_server(const GameParams &game_params, const Settings &
 	if (cmd_args.exists("migrate"))
 		return migrate_database(game_params, cmd_args);
 
+	// Offline map generation
+	if (cmd_args.exists("pregenerate"))
+		return pregenerate_map(game_params, cmd_args);
+
 	try {
 		// Create server
 		Server server(game_params.world_path, game_params.game_spec, false,
@@ -900,3 +910,35 @@ static bool migrate_database(const GameParams &game_params, const Settings &cmd_
 	return true;
 }
 
+static bool pregenerate_map(const GameParams &game_params, const Settings &cmd_args)
+{
+	v3s16 minp, maxp;
+	if (sscanf(cmd_args.get("pregenerate").c_str(),
+			" ( %hd , %hd , %hd ) ( %hd , %hd , %hd )",
+			&minp.X, &minp.Y, &minp.Z, &maxp.X, &maxp.Y, &maxp.Z) != 6) {
+		errorstream << "Invalid area for --pregenerate, expected "
+			<< "\"(x,y,z) (x,y,z)\"" << std::endl;
+		return false;
+	}
+
+	try {
+		// The server is never started, so no clients can connect
+		Server server(game_params.world_path, game_params.game_spec, false,
+			false);
+
+		bool &kill = *porting::signal_handler_killstatus();
+		if (!server.pregenerateMap(getNodeBlockPos(minp), getNodeBlockPos(maxp),
+				kill))
+			return false;
+	} catch (const ModError &e) {
+		errorstream << "ModError: " << e.what() << std::endl;
+		return false;
+	} catch (const ServerError &e) {
+		errorstream << "ServerError: " << e.what() << std::endl;
+		return false;
+	}
+
+	actionstream << "Pregeneration finished" << std::endl;
+	return true;
+}
+
@@ -42,6 +42,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "database.h"
 #include "database-dummy.h"
 #include "database-sqlite3.h"
+#include "mapsaver.h"
+#include "threads.h"
+#include "util/thread.h"
+#include "threading/atomic.h"
+#include <algorithm>
 #include <deque>
 #include <queue>
 #if USE_LEVELDB
@@ -58,19 +63,60 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	Map
 */
 
+// Number of blocks each thread remembers in getBlockNoCreateNoEx()
+#define RECENT_BLOCKS_COUNT 4
+
+struct RecentBlocks
+{
+	const Map *map;
+	// Forget everything when it differs from g_recent_blocks_generation
+	u32 generation;
+	u32 count;
+	// Most recently used first
+	s16 x[RECENT_BLOCKS_COUNT];
+	s16 y[RECENT_BLOCKS_COUNT];
+	s16 z[RECENT_BLOCKS_COUNT];
+	MapBlock *blocks[RECENT_BLOCKS_COUNT];
+};
+
+static THREAD_LOCAL RecentBlocks t_recent_blocks;
+// Changed whenever a block is deleted or a map is made
+static Atomic<u32> g_recent_blocks_generation(0);
+
+// Puts the block first, moving the entries before entry i one back
+static void putRecentBlock(RecentBlocks &recent, u32 i, v3s16 p,
+		MapBlock *block)
+{
+	for (; i > 0; i--) {
+		recent.x[i] = recent.x[i - 1];
+		recent.y[i] = recent.y[i - 1];
+		recent.z[i] = recent.z[i - 1];
+		recent.blocks[i] = recent.blocks[i - 1];
+	}
+	recent.x[0] = p.X;
+	recent.y[0] = p.Y;
+	recent.z[0] = p.Z;
+	recent.blocks[0] = block;
+}
+
 Map::Map(std::ostream &dout, IGameDef *gamedef):
 	m_dout(dout),
 	m_gamedef(gamedef),
 	m_sector_cache(NULL),
+	m_liquid_workers(NULL),
 	m_transforming_liquid_loop_count_multiplier(1.0f),
 	m_unprocessed_count(0),
 	m_inc_trending_up_start_time(0),
 	m_queue_size_timer_started(false)
 {
+	// Another map may have been at the same address
+	g_recent_blocks_generation++;
 }
 
 Map::~Map()
 {
+	delete m_liquid_workers;
+
 	/*
 		Free all MapSectors
 	*/
@@ -138,14 +184,51 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 
 MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerateNoEx(p2d);
-	if(sector == NULL)
+	RecentBlocks &recent = t_recent_blocks;
+	u32 generation = g_recent_blocks_generation;
+	if (recent.map != this || recent.generation != generation) {
+		recent.map = this;
+		recent.generation = generation;
+		recent.count = 0;
+	}
+
+	for (u32 i = 0; i < recent.count; i++) {
+		if (recent.x[i] == p3d.X && recent.y[i] == p3d.Y &&
+				recent.z[i] == p3d.Z) {
+			MapBlock *block = recent.blocks[i];
+			putRecentBlock(recent, i, p3d, block);
+			return block;
+		}
+	}
+
+	MapBlock *block = m_blocks.get(p3d);
+	if (block == NULL)
 		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
+
+	// Forget the least recently used block if needed
+	if (recent.count < RECENT_BLOCKS_COUNT)
+		recent.count++;
+	putRecentBlock(recent, recent.count - 1, p3d, block);
 	return block;
 }
 
+MapBlock * Map::getBlockNoCreateNoExNoCache(v3s16 p3d) const
+{
+	return m_blocks.get(p3d);
+}
+
+void Map::addBlockToIndex(MapBlock *block)
+{
+	bool inserted = m_blocks.insert(block->getPos(), block);
+	sanity_check(inserted);
+}
+
+void Map::removeBlockFromIndex(v3s16 p)
+{
+	m_blocks.erase(p);
+	g_recent_blocks_generation++;
+}
+
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -233,181 +316,246 @@ void Map::setNode(v3s16 p, MapNode & n)
 
 
 /*
-	Goes recursively through the neighbours of the node.
-
-	Alters only transparent nodes.
-
-	If the lighting of the neighbour is lower than the lighting of
-	the node was (before changing it to 0 at the step before), the
-	lighting of the neighbour is set to 0 and then the same stuff
-	repeats for the neighbour.
+	Light is added and removed breadth first, one light level at a time.
 
-	The ending nodes of the routine are stored in light_sources.
-	This is useful when a light is removed. In such case, this
-	routine can be called for the light node and then again for
-	light_sources to re-light the area without the removed light.
-
-	values of from_nodes are lighting values.
+	The queued nodes are kept in buckets by light level and always the
+	brightest bucket is handled next, so a node is usually only touched
+	once per level. Nodes are accessed straight from their blocks and
+	neighbours are looked up from the same block when they are in it.
 */
-void Map::unspreadLight(enum LightBank bank,
-		std::map<v3s16, u8> & from_nodes,
-		std::set<v3s16> & light_sources,
-		std::map<v3s16, MapBlock*>  & modified_blocks)
+struct LightQueue
 {
-	INodeDefManager *nodemgr = m_gamedef->ndef();
+	struct Entry
+	{
+		Entry(MapBlock *block_, v3s16 relpos_):
+			block(block_), relpos(relpos_)
+		{}
 
-	v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
+		MapBlock *block;
+		v3s16 relpos;
 	};
 
-	if(from_nodes.empty())
-		return;
-
-	u32 blockchangecount = 0;
-
-	std::map<v3s16, u8> unlighted_nodes;
+	LightQueue():
+		top(-1)
+	{}
 
-	/*
-		Initialize block cache
-	*/
-	v3s16 blockpos_last;
-	MapBlock *block = NULL;
-	// Cache this a bit, too
-	bool block_checked_in_modified = false;
+	void push(u8 light, MapBlock *block, v3s16 relpos)
+	{
+		light = MYMIN(light, LIGHT_SUN);
+		buckets[light].push_back(Entry(block, relpos));
+		if ((s16)light > top)
+			top = light;
+	}
 
-	for(std::map<v3s16, u8>::iterator j = from_nodes.begin();
-		j != from_nodes.end(); ++j)
+	bool pop(u8 &light, MapBlock *&block, v3s16 &relpos)
 	{
-		v3s16 pos = j->first;
-		v3s16 blockpos = getNodeBlockPos(pos);
+		while (top >= 0 && buckets[top].empty())
+			top--;
+		if (top < 0)
+			return false;
 
-		// Only fetch a new block if the block position has changed
-		try{
-			if(block == NULL || blockpos != blockpos_last){
-				block = getBlockNoCreate(blockpos);
-				blockpos_last = blockpos;
+		const Entry &entry = buckets[top].back();
+		light = top;
+		block = entry.block;
+		relpos = entry.relpos;
+		buckets[top].pop_back();
+		return true;
+	}
 
-				block_checked_in_modified = false;
-				blockchangecount++;
-			}
-		}
-		catch(InvalidPositionException &e)
-		{
-			continue;
-		}
+	std::vector<Entry> buckets[LIGHT_SUN + 1];
+	// Highest bucket that may contain something, -1 if none
+	s16 top;
+};
 
-		if(block->isDummy())
-			continue;
+/*
+	Returns the block of the neighbour of a node and changes relpos to be
+	relative to that block. Returns NULL if the block is not loaded.
+*/
+static inline MapBlock *getLightNeighborBlock(Map *map, MapBlock *block,
+		v3s16 &relpos)
+{
+	if (relpos.X >= 0 && relpos.X < MAP_BLOCKSIZE &&
+			relpos.Y >= 0 && relpos.Y < MAP_BLOCKSIZE &&
+			relpos.Z >= 0 && relpos.Z < MAP_BLOCKSIZE)
+		return block;
 
-		// Calculate relative position in block
-		//v3s16 relpos = pos - blockpos_last * MAP_BLOCKSIZE;
+	v3s16 blockpos = block->getPos();
+	if (relpos.X < 0) {
+		relpos.X += MAP_BLOCKSIZE;
+		blockpos.X--;
+	} else if (relpos.X >= MAP_BLOCKSIZE) {
+		relpos.X -= MAP_BLOCKSIZE;
+		blockpos.X++;
+	}
+	if (relpos.Y < 0) {
+		relpos.Y += MAP_BLOCKSIZE;
+		blockpos.Y--;
+	} else if (relpos.Y >= MAP_BLOCKSIZE) {
+		relpos.Y -= MAP_BLOCKSIZE;
+		blockpos.Y++;
+	}
+	if (relpos.Z < 0) {
+		relpos.Z += MAP_BLOCKSIZE;
+		blockpos.Z--;
+	} else if (relpos.Z >= MAP_BLOCKSIZE) {
+		relpos.Z -= MAP_BLOCKSIZE;
+		blockpos.Z++;
+	}
+	return map->getBlockNoCreateNoEx(blockpos);
+}
 
-		// Get node straight from the block
-		//MapNode n = block->getNode(relpos);
+static inline void addModifiedBlock(MapBlock *block, MapBlock *&last_modified,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	if (block == last_modified)
+		return;
+	modified_blocks[block->getPos()] = block;
+	last_modified = block;
+}
 
-		u8 oldlight = j->second;
+/*
+	Goes through the neighbours of the queued nodes, brightest first.
 
-		// Loop through 6 neighbors
-		for(u16 i=0; i<6; i++)
-		{
-			// Get the position of the neighbor node
-			v3s16 n2pos = pos + dirs[i];
+	Alters only transparent nodes.
 
-			// Get the block where the node is located
-			v3s16 blockpos, relpos;
-			getNodeBlockPosWithOffset(n2pos, blockpos, relpos);
+	If the lighting of the neighbour is lower than the lighting of
+	the node was (before changing it to 0 at the step before), the
+	lighting of the neighbour is set to 0 and it is queued with its
+	old lighting.
 
-			// Only fetch a new block if the block position has changed
-			try {
-				if(block == NULL || blockpos != blockpos_last){
-					block = getBlockNoCreate(blockpos);
-					blockpos_last = blockpos;
+	Neighbours at least as bright as the queued node are the ending
+	nodes of the routine and are added to sources.
+*/
+static void unspreadLightQueue(Map *map, INodeDefManager *nodemgr,
+		enum LightBank bank, LightQueue &from, LightQueue &sources,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	MapBlock *last_modified = NULL;
 
-					block_checked_in_modified = false;
-					blockchangecount++;
-				}
-			}
-			catch(InvalidPositionException &e) {
+	u8 oldlight;
+	MapBlock *block;
+	v3s16 relpos;
+	while (from.pop(oldlight, block, relpos)) {
+		for (u16 i = 0; i < 6; i++) {
+			v3s16 relpos2 = relpos + g_6dirs[i];
+			MapBlock *block2 = getLightNeighborBlock(map, block, relpos2);
+			if (block2 == NULL)
 				continue;
-			}
 
-			// Get node straight from the block
 			bool is_valid_position;
-			MapNode n2 = block->getNode(relpos, &is_valid_position);
+			MapNode n2 = block2->getNode(relpos2, &is_valid_position);
 			if (!is_valid_position)
 				continue;
 
-			bool changed = false;
+			u8 light2 = n2.getLight(bank, nodemgr);
+			if (light2 >= oldlight) {
+				sources.push(light2, block2, relpos2);
+				continue;
+			}
 
-			//TODO: Optimize output by optimizing light_sources?
+			if (light2 == 0 || !nodemgr->get(n2).light_propagates)
+				continue;
 
-			/*
-				If the neighbor is dimmer than what was specified
-				as oldlight (the light of the previous node)
-			*/
-			if(n2.getLight(bank, nodemgr) < oldlight)
-			{
-				/*
-					And the neighbor is transparent and it has some light
-				*/
-				if(nodemgr->get(n2).light_propagates
-						&& n2.getLight(bank, nodemgr) != 0)
-				{
-					/*
-						Set light to 0 and add to queue
-					*/
+			n2.setLight(bank, 0, nodemgr);
+			block2->setNode(relpos2, n2);
+			from.push(light2, block2, relpos2);
+			addModifiedBlock(block2, last_modified, modified_blocks);
+		}
+	}
+}
 
-					u8 current_light = n2.getLight(bank, nodemgr);
-					n2.setLight(bank, 0, nodemgr);
-					block->setNode(relpos, n2);
+/*
+	Lights the neighbours of the queued nodes, brightest first, and
+	queues the neighbours that got light.
 
-					unlighted_nodes[n2pos] = current_light;
-					changed = true;
+	Neighbours that are brighter than what the node could have got
+	from them are queued too, they light up the node on their turn.
+*/
+static void spreadLightQueue(Map *map, INodeDefManager *nodemgr,
+		enum LightBank bank, LightQueue &from,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	MapBlock *last_modified = NULL;
 
-					/*
-						Remove from light_sources if it is there
-						NOTE: This doesn't happen nearly at all
-					*/
-					/*if(light_sources.find(n2pos))
-					{
-						infostream<<"Removed from light_sources"<<std::endl;
-						light_sources.remove(n2pos);
-					}*/
-				}
+	u8 queued_light;
+	MapBlock *block;
+	v3s16 relpos;
+	while (from.pop(queued_light, block, relpos)) {
+		bool is_valid_position;
+		MapNode n = block->getNode(relpos, &is_valid_position);
+		u8 oldlight = is_valid_position ? n.getLight(bank, nodemgr) : 0;
 
-				/*// DEBUG
-				if(light_sources.find(n2pos) != NULL)
-					light_sources.remove(n2pos);*/
-			}
-			else{
-				light_sources.insert(n2pos);
-			}
+		// The node has got more light since, it is queued again
+		if (oldlight > queued_light)
+			continue;
 
-			// Add to modified_blocks
-			if(changed == true && block_checked_in_modified == false)
-			{
-				// If the block is not found in modified_blocks, add.
-				if(modified_blocks.find(blockpos) == modified_blocks.end())
-				{
-					modified_blocks[blockpos] = block;
-				}
-				block_checked_in_modified = true;
+		u8 newlight = diminish_light(oldlight);
+
+		for (u16 i = 0; i < 6; i++) {
+			v3s16 relpos2 = relpos + g_6dirs[i];
+			MapBlock *block2 = getLightNeighborBlock(map, block, relpos2);
+			if (block2 == NULL)
+				continue;
+
+			MapNode n2 = block2->getNode(relpos2, &is_valid_position);
+			if (!is_valid_position)
+				continue;
+
+			u8 light2 = n2.getLight(bank, nodemgr);
+			if (light2 > undiminish_light(oldlight)) {
+				from.push(light2, block2, relpos2);
+			} else if (light2 < newlight &&
+					nodemgr->get(n2).light_propagates) {
+				n2.setLight(bank, newlight, nodemgr);
+				block2->setNode(relpos2, n2);
+				from.push(newlight, block2, relpos2);
+				addModifiedBlock(block2, last_modified, modified_blocks);
 			}
 		}
 	}
+}
+
+/*
+	Goes through the neighbours of the nodes and sets the lighting of
+	all consequent dimmer transparent nodes to 0.
 
-	/*infostream<<"unspreadLight(): Changed block "
-	<<blockchangecount<<" times"
-	<<" for "<<from_nodes.size()<<" nodes"
-	<<std::endl;*/
+	The ending nodes of the routine are stored in light_sources.
+	This is useful when a light is removed. In such case, this
+	routine can be called for the light node and then again for
+	light_sources to re-light the area without the removed light.
 
-	if(!unlighted_nodes.empty())
-		unspreadLight(bank, unlighted_nodes, light_sources, modified_blocks);
+	values of from_nodes are lighting values.
+*/
+void Map::unspreadLight(enum LightBank bank,
+		std::map<v3s16, u8> & from_nodes,
+		std::set<v3s16> & light_sources,
+		std::map<v3s16, MapBlock*>  & modified_blocks)
+{
+	INodeDefManager *nodemgr = m_gamedef->ndef();
+
+	if(from_nodes.empty())
+		return;
+
+	LightQueue from;
+	for(std::map<v3s16, u8>::iterator j = from_nodes.begin();
+		j != from_nodes.end(); ++j)
+	{
+		v3s16 blockpos, relpos;
+		getNodeBlockPosWithOffset(j->first, blockpos, relpos);
+		MapBlock *block = getBlockNoCreateNoEx(blockpos);
+		if(block == NULL || block->isDummy())
+			continue;
+		from.push(j->second, block, relpos);
+	}
+
+	LightQueue sources;
+	unspreadLightQueue(this, nodemgr, bank, from, sources, modified_blocks);
+
+	u8 light;
+	MapBlock *block;
+	v3s16 relpos;
+	while(sources.pop(light, block, relpos))
+		light_sources.insert(block->getPosRelative() + relpos);
 }
 
 /*
@@ -425,8 +573,8 @@ void Map::unLightNeighbors(enum LightBank bank,
 }
 
 /*
-	Lights neighbors of from_nodes, collects all them and then
-	goes on recursively.
+	Lights neighbors of from_nodes and goes on through the nodes that
+	got light until no more light can be spread.
 */
 void Map::spreadLight(enum LightBank bank,
 		std::set<v3s16> & from_nodes,
@@ -434,135 +582,25 @@ void Map::spreadLight(enum LightBank bank,
 {
 	INodeDefManager *nodemgr = m_gamedef->ndef();
 
-	const v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
-	};
-
 	if(from_nodes.empty())
 		return;
 
-	u32 blockchangecount = 0;
-
-	std::set<v3s16> lighted_nodes;
-
-	/*
-		Initialize block cache
-	*/
-	v3s16 blockpos_last;
-	MapBlock *block = NULL;
-		// Cache this a bit, too
-	bool block_checked_in_modified = false;
-
+	LightQueue from;
 	for(std::set<v3s16>::iterator j = from_nodes.begin();
 		j != from_nodes.end(); ++j)
 	{
-		v3s16 pos = *j;
 		v3s16 blockpos, relpos;
-
-		getNodeBlockPosWithOffset(pos, blockpos, relpos);
-
-		// Only fetch a new block if the block position has changed
-		try {
-			if(block == NULL || blockpos != blockpos_last){
-				block = getBlockNoCreate(blockpos);
-				blockpos_last = blockpos;
-
-				block_checked_in_modified = false;
-				blockchangecount++;
-			}
-		}
-		catch(InvalidPositionException &e) {
-			continue;
-		}
-
-		if(block->isDummy())
+		getNodeBlockPosWithOffset(*j, blockpos, relpos);
+		MapBlock *block = getBlockNoCreateNoEx(blockpos);
+		if(block == NULL || block->isDummy())
 			continue;
-
-		// Get node straight from the block
 		bool is_valid_position;
 		MapNode n = block->getNode(relpos, &is_valid_position);
-
-		u8 oldlight = is_valid_position ? n.getLight(bank, nodemgr) : 0;
-		u8 newlight = diminish_light(oldlight);
-
-		// Loop through 6 neighbors
-		for(u16 i=0; i<6; i++){
-			// Get the position of the neighbor node
-			v3s16 n2pos = pos + dirs[i];
-
-			// Get the block where the node is located
-			v3s16 blockpos, relpos;
-			getNodeBlockPosWithOffset(n2pos, blockpos, relpos);
-
-			// Only fetch a new block if the block position has changed
-			try {
-				if(block == NULL || blockpos != blockpos_last){
-					block = getBlockNoCreate(blockpos);
-					blockpos_last = blockpos;
-
-					block_checked_in_modified = false;
-					blockchangecount++;
-				}
-			}
-			catch(InvalidPositionException &e) {
-				continue;
-			}
-
-			// Get node straight from the block
-			MapNode n2 = block->getNode(relpos, &is_valid_position);
-			if (!is_valid_position)
-				continue;
-
-			bool changed = false;
-			/*
-				If the neighbor is brighter than the current node,
-				add to list (it will light up this node on its turn)
-			*/
-			if(n2.getLight(bank, nodemgr) > undiminish_light(oldlight))
-			{
-				lighted_nodes.insert(n2pos);
-				changed = true;
-			}
-			/*
-				If the neighbor is dimmer than how much light this node
-				would spread on it, add to list
-			*/
-			if(n2.getLight(bank, nodemgr) < newlight)
-			{
-				if(nodemgr->get(n2).light_propagates)
-				{
-					n2.setLight(bank, newlight, nodemgr);
-					block->setNode(relpos, n2);
-					lighted_nodes.insert(n2pos);
-					changed = true;
-				}
-			}
-
-			// Add to modified_blocks
-			if(changed == true && block_checked_in_modified == false)
-			{
-				// If the block is not found in modified_blocks, add.
-				if(modified_blocks.find(blockpos) == modified_blocks.end())
-				{
-					modified_blocks[blockpos] = block;
-				}
-				block_checked_in_modified = true;
-			}
-		}
+		from.push(is_valid_position ? n.getLight(bank, nodemgr) : 0,
+				block, relpos);
 	}
 
-	/*infostream<<"spreadLight(): Changed block "
-			<<blockchangecount<<" times"
-			<<" for "<<from_nodes.size()<<" nodes"
-			<<std::endl;*/
-
-	if(!lighted_nodes.empty())
-		spreadLight(bank, lighted_nodes, modified_blocks);
+	spreadLightQueue(this, nodemgr, bank, from, modified_blocks);
 }
 
 /*
@@ -901,11 +939,170 @@ void Map::updateLighting(enum LightBank bank,
 	//m_dout<<"Done ("<<getTimestamp()<<")"<<std::endl;
 }
 
-void Map::updateLighting(std::map<v3s16, MapBlock*> & a_blocks,
-		std::map<v3s16, MapBlock*> & modified_blocks)
-{
-	updateLighting(LIGHTBANK_DAY, a_blocks, modified_blocks);
-	updateLighting(LIGHTBANK_NIGHT, a_blocks, modified_blocks);
+void Map::updateLighting(std::map<v3s16, MapBlock*> & a_blocks,
+		std::map<v3s16, MapBlock*> & modified_blocks)
+{
+	updateLighting(LIGHTBANK_DAY, a_blocks, modified_blocks);
+	updateLighting(LIGHTBANK_NIGHT, a_blocks, modified_blocks);
+
+	/*
+		Update information about whether day and night light differ
+	*/
+	for(std::map<v3s16, MapBlock*>::iterator
+			i = modified_blocks.begin();
+			i != modified_blocks.end(); ++i)
+	{
+		MapBlock *block = i->second;
+		block->expireDayNightDiff();
+	}
+}
+
+/*
+	Sorts indices of changed nodes from the top to the bottom
+*/
+struct ChangedNodeHigher
+{
+	ChangedNodeHigher(const std::vector<std::pair<v3s16, MapNode> > &nodes_):
+		nodes(nodes_)
+	{}
+
+	bool operator()(u32 a, u32 b) const
+	{
+		return nodes[a].first.Y > nodes[b].first.Y;
+	}
+
+	const std::vector<std::pair<v3s16, MapNode> > &nodes;
+};
+
+/*
+	Updates the lighting around nodes that have been changed, all of them
+	in one pass per light bank. oldnodes contains the positions of the
+	changed nodes with the nodes that were there before; the new nodes
+	must already be on the map with the light values of the old ones.
+*/
+void Map::updateNodeLighting(
+		const std::vector<std::pair<v3s16, MapNode> > &oldnodes,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	INodeDefManager *nodemgr = m_gamedef->ndef();
+
+	if(oldnodes.empty())
+		return;
+
+	// Sunlight coming from above has to be known when getting to a node
+	std::vector<u32> order(oldnodes.size());
+	for(u32 i=0; i<order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), ChangedNodeHigher(oldnodes));
+
+	enum LightBank banks[] =
+	{
+		LIGHTBANK_DAY,
+		LIGHTBANK_NIGHT
+	};
+	for(s32 i=0; i<2; i++)
+	{
+		enum LightBank bank = banks[i];
+
+		LightQueue unlight_from;
+		LightQueue light_from;
+
+		for(u32 j=0; j<order.size(); j++)
+		{
+			const std::pair<v3s16, MapNode> &oldnode = oldnodes[order[j]];
+			v3s16 blockpos, relpos;
+			getNodeBlockPosWithOffset(oldnode.first, blockpos, relpos);
+			MapBlock *block = getBlockNoCreateNoEx(blockpos);
+			if(block == NULL || block->isDummy())
+				continue;
+
+			bool is_valid_position;
+			MapNode n = block->getNode(relpos, &is_valid_position);
+			if(!is_valid_position)
+				continue;
+
+			// Remove the light that has come out of the old node
+			n.setLight(bank, 0, nodemgr);
+			block->setNode(relpos, n);
+			modified_blocks[blockpos] = block;
+			unlight_from.push(oldnode.second.getLight(bank, nodemgr),
+					block, relpos);
+
+			// Spread from the new node; this also brings in the light
+			// of brighter neighbours
+			light_from.push(n.getLight(bank, nodemgr), block, relpos);
+		}
+
+		/*
+			Sunlight going down from the changed nodes
+		*/
+		if(bank == LIGHTBANK_DAY)
+		{
+			for(u32 j=0; j<order.size(); j++)
+			{
+				const std::pair<v3s16, MapNode> &oldnode =
+						oldnodes[order[j]];
+				v3s16 p = oldnode.first;
+				bool is_valid_position;
+				MapNode n = getNodeNoEx(p, &is_valid_position);
+				if(!is_valid_position)
+					continue;
+
+				MapNode topnode = getNodeNoEx(p + v3s16(0,1,0),
+						&is_valid_position);
+				bool node_under_sunlight = !is_valid_position ||
+						topnode.getLight(LIGHTBANK_DAY, nodemgr) == LIGHT_SUN;
+
+				if(node_under_sunlight && nodemgr->get(n).sunlight_propagates)
+				{
+					// Let sunlight down from the node
+					for(v3s16 p2 = p;; p2.Y--)
+					{
+						v3s16 blockpos, relpos;
+						getNodeBlockPosWithOffset(p2, blockpos, relpos);
+						MapBlock *block = getBlockNoCreateNoEx(blockpos);
+						if(block == NULL || block->isDummy())
+							break;
+						MapNode n2 = block->getNode(relpos, &is_valid_position);
+						if(!is_valid_position ||
+								!nodemgr->get(n2).sunlight_propagates)
+							break;
+						if(p2 != p &&
+								n2.getLight(LIGHTBANK_DAY, nodemgr) == LIGHT_SUN)
+							break;
+						n2.setLight(LIGHTBANK_DAY, LIGHT_SUN, nodemgr);
+						block->setNode(relpos, n2);
+						modified_blocks[blockpos] = block;
+						light_from.push(LIGHT_SUN, block, relpos);
+					}
+				}
+				else if(oldnode.second.getLight(LIGHTBANK_DAY, nodemgr) == LIGHT_SUN)
+				{
+					// Sunlight does not go down from the node anymore
+					for(v3s16 p2 = p - v3s16(0,1,0);; p2.Y--)
+					{
+						v3s16 blockpos, relpos;
+						getNodeBlockPosWithOffset(p2, blockpos, relpos);
+						MapBlock *block = getBlockNoCreateNoEx(blockpos);
+						if(block == NULL || block->isDummy())
+							break;
+						MapNode n2 = block->getNode(relpos, &is_valid_position);
+						if(!is_valid_position ||
+								n2.getLight(LIGHTBANK_DAY, nodemgr) != LIGHT_SUN)
+							break;
+						n2.setLight(LIGHTBANK_DAY, 0, nodemgr);
+						block->setNode(relpos, n2);
+						modified_blocks[blockpos] = block;
+						unlight_from.push(LIGHT_SUN, block, relpos);
+					}
+				}
+			}
+		}
+
+		unspreadLightQueue(this, nodemgr, bank, unlight_from, light_from,
+				modified_blocks);
+		spreadLightQueue(this, nodemgr, bank, light_from, modified_blocks);
+	}
 
 	/*
 		Update information about whether day and night light differ
@@ -1102,7 +1299,7 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 		if(is_valid_position
 				&& (ndef->get(n2).isLiquid() || n2.getContent() == CONTENT_AIR))
 		{
-			m_transforming_liquid.push_back(p2);
+			m_transforming_liquid.push(p2);
 		}
 	}
 }
@@ -1281,7 +1478,7 @@ void Map::removeNodeAndUpdate(v3s16 p,
 		if (is_position_valid
 				&& (ndef->get(n2).isLiquid() || n2.getContent() == CONTENT_AIR))
 		{
-			m_transforming_liquid.push_back(p2);
+			m_transforming_liquid.push(p2);
 		}
 	}
 }
@@ -1454,6 +1651,9 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 						&& block->getUsageTimer() > unload_timeout) {
 					v3s16 p = block->getPos();
 
+					// Keep the queued liquid updates with the block
+					setLiquidsAside(block);
+
 					// Save if modified
 					if (block->getModified() != MOD_STATE_CLEAN
 							&& save_before_unloading) {
@@ -1511,6 +1711,9 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 
 			v3s16 p = block->getPos();
 
+			// Keep the queued liquid updates with the block
+			setLiquidsAside(block);
+
 			// Save if modified
 			if (block->getModified() != MOD_STATE_CLEAN && save_before_unloading) {
 				modprofiler.add(block->getModifiedReasonString(), 1);
@@ -1607,23 +1810,443 @@ struct NodeNeighbor {
 };
 
 void Map::transforming_liquid_add(v3s16 p) {
-        m_transforming_liquid.push_back(p);
+        m_transforming_liquid.push(p);
 }
 
 s32 Map::transforming_liquid_size() {
         return m_transforming_liquid.size();
 }
 
-void Map::transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks)
+void Map::setLiquidsAside(MapBlock *block)
+{
+	v3s16 p = block->getPos();
+	if (m_transforming_liquid.removeBlock(p) == 0)
+		return;
+	block->setLiquidsPending(true);
+	m_liquids_set_aside.insert(p);
+}
+
+void Map::requeueLiquids(MapBlock *block)
+{
+	INodeDefManager *nodemgr = m_gamedef->ndef();
+	v3s16 p_base = block->getPosRelative();
+	v3s16 p;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+		MapNode n = block->getNodeNoEx(p);
+		if (nodemgr->get(n).liquid_type != LIQUID_NONE) {
+			m_transforming_liquid.push(p_base + p);
+			continue;
+		}
+		// The queue also held air next to liquids, like where a node
+		// beside water was dug. Neighbours in other blocks count too.
+		if (n.getContent() != CONTENT_AIR)
+			continue;
+		for (u16 i = 0; i < 6; i++) {
+			v3s16 p2 = p + g_6dirs[i];
+			MapNode n2 = block->isValidPosition(p2) ?
+					block->getNodeNoEx(p2) : getNodeNoEx(p_base + p2);
+			if (nodemgr->get(n2).liquid_type != LIQUID_NONE) {
+				m_transforming_liquid.push(p_base + p);
+				break;
+			}
+		}
+	}
+	block->setLiquidsPending(false);
+}
+
+/*
+	Decides what a queued liquid node turns into. Returns false if it stays
+	the same, otherwise n00 is the node and n0 what it should become.
+	Nodes that have to be transformed next are added to queued.
+
+	Only reads the map, so nodes that are not next to each other can be
+	handled at the same time.
+*/
+bool Map::transformLiquidNode(v3s16 p0, MapNode &n0, MapNode &n00,
+		std::vector<v3s16> &queued, std::deque<v3s16> &must_reflow)
 {
+	INodeDefManager *nodemgr = m_gamedef->ndef();
+
+	n0 = getNodeNoEx(p0);
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	content_t liquid_kind = CONTENT_IGNORE;
+	LiquidType liquid_type = nodemgr->get(n0).liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = nodemgr->getId(nodemgr->get(n0).liquid_alternative_flowing);
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this is an air node, it *could* be transformed into a liquid. otherwise,
+			// continue with the next node.
+			if (n0.getContent() != CONTENT_AIR)
+				return false;
+			liquid_kind = CONTENT_AIR;
+			break;
+	}
+
+	/*
+		Collect information about the environment
+	 */
+	const v3s16 *dirs = g_6dirs;
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	NodeNeighbor airs[6]; // surrounding air
+	int num_airs = 0;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 1:
+				nt = NEIGHBOR_UPPER;
+				break;
+			case 4:
+				nt = NEIGHBOR_LOWER;
+				break;
+		}
+		v3s16 npos = p0 + dirs[i];
+		NodeNeighbor nb(getNodeNoEx(npos), nt, npos);
+		switch (nodemgr->get(nb.n.getContent()).liquid_type) {
+			case LIQUID_NONE:
+				if (nb.n.getContent() == CONTENT_AIR) {
+					airs[num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
+						queued.push_back(npos);
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER) {
+						flowing_down = true;
+					}
+				} else {
+					neutrals[num_neutrals++] = nb;
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing);
+				if (nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing) != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(dirs[i].Y != -1)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing);
+				if (nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing) != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+		}
+	}
 
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = nodemgr->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX+1)
+		range = LIQUID_LEVEL_MAX+1;
+
+	if ((num_sources >= 2 && nodemgr->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = nodemgr->getId(nodemgr->get(liquid_kind).liquid_alternative_source);
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		new_node_content = liquid_kind;
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level < (LIQUID_LEVEL_MAX+1-range))
+			new_node_content = CONTENT_AIR;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
+			switch (flows[i].t) {
+				case NEIGHBOR_UPPER:
+					if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
+						max_node_level = LIQUID_LEVEL_MAX;
+						if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+							max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+					} else if (nb_liquid_level > max_node_level)
+						max_node_level = nb_liquid_level;
+					break;
+				case NEIGHBOR_LOWER:
+					break;
+				case NEIGHBOR_SAME_LEVEL:
+					if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+						nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level) {
+						max_node_level = nb_liquid_level - 1;
+					}
+					break;
+			}
+		}
+
+		u8 viscosity = nodemgr->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				must_reflow.push_back(p0);
+		} else
+			new_node_level = max_node_level;
+
+		if (max_node_level >= (LIQUID_LEVEL_MAX+1-range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = CONTENT_AIR;
+
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() && (nodemgr->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+									 ((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+									 ((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+									 == flowing_down)))
+		return false;
+
+
+	/*
+		update the current node
+	 */
+	n00 = n0;
+	//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
+	if (nodemgr->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bit to 0
+		n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+	n0.setContent(new_node_content);
+
+	/*
+		enqueue neighbors for update if neccessary
+	 */
+	switch (nodemgr->get(n0.getContent()).liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < num_flows; i++)
+				if (flows[i].t != NEIGHBOR_UPPER)
+					queued.push_back(flows[i].p);
+			for (u16 i = 0; i < num_airs; i++)
+				if (airs[i].t != NEIGHBOR_UPPER)
+					queued.push_back(airs[i].p);
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < num_flows; i++)
+				queued.push_back(flows[i].p);
+			break;
+	}
+
+	return true;
+}
+
+/*
+	Reports a transformed liquid node that has been set on the map
+*/
+void Map::recordLiquidChange(v3s16 p0, const MapNode &n00, const MapNode &n0,
+		std::map<v3s16, MapBlock*> &modified_blocks,
+		std::vector<std::pair<v3s16, MapNode> > &lighting_changed_nodes)
+{
 	INodeDefManager *nodemgr = m_gamedef->ndef();
 
+	// Find out whether there is a suspect for this action
+	std::string suspect;
+	if(m_gamedef->rollback()) {
+		suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
+	}
+
+	if(m_gamedef->rollback() && !suspect.empty()){
+		// Blame suspect
+		RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
+		RollbackNode rollback_newnode(this, p0, m_gamedef);
+		// Liquids leave the metadata as it is
+		RollbackNode rollback_oldnode = rollback_newnode;
+		rollback_oldnode.name = nodemgr->get(n00).name;
+		rollback_oldnode.param1 = n00.param1;
+		rollback_oldnode.param2 = n00.param2;
+		// Report
+		RollbackAction action;
+		action.setSetNode(p0, rollback_oldnode, rollback_newnode);
+		m_gamedef->rollback()->reportAction(action);
+	}
+
+	v3s16 blockpos = getNodeBlockPos(p0);
+	MapBlock *block = getBlockNoCreateNoEx(blockpos);
+	if(block != NULL) {
+		modified_blocks[blockpos] =  block;
+		// If new or old node emits light, the lighting around it
+		// requires an update
+		if(nodemgr->get(n0).light_source != 0 ||
+				nodemgr->get(n00).light_source != 0)
+			lighting_changed_nodes.push_back(
+					std::make_pair(p0, n00));
+	}
+}
+
+/*
+	Transforms the queued liquid nodes of one mapblock, in queue order.
+	The results are kept here until they are merged on the calling thread.
+*/
+class LiquidBlockJob : public WorkerPool::Job
+{
+public:
+	LiquidBlockJob(Map *map_):
+		map(map_)
+	{}
+
+	void run()
+	{
+		for(std::vector<v3s16>::iterator
+				i = nodes.begin(); i != nodes.end(); ++i) {
+			MapNode n0, n00;
+			if(!map->transformLiquidNode(*i, n0, n00, queued, must_reflow))
+				continue;
+			map->setNode(*i, n0);
+			changed.push_back(std::make_pair(*i, n00));
+		}
+	}
+
+	Map *map;
+	std::vector<v3s16> nodes;
+
+	std::vector<v3s16> queued;
+	std::deque<v3s16> must_reflow;
+	// Position and old node
+	std::vector<std::pair<v3s16, MapNode> > changed;
+};
+
+/*
+	Transforms count liquid nodes from the queue on the worker pool.
+
+	A node only looks at its neighbours, so the blocks are split in eight
+	groups where no two blocks touch each other and the blocks of a group
+	are done at the same time. The results are merged in a fixed order so
+	that they do not depend on the number of threads.
+*/
+void Map::transformLiquidsParallel(u32 count,
+		std::deque<v3s16> &must_reflow,
+		std::vector<std::pair<v3s16, MapNode> > &lighting_changed_nodes,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	std::vector<v3s16> nodes;
+	m_transforming_liquid.pop(count, nodes);
+
+	std::map<v3s16, u32> block_jobs;
+	std::vector<LiquidBlockJob> jobs;
+	for(u32 i = 0; i < nodes.size(); i++) {
+		v3s16 p0 = nodes[i];
+
+		v3s16 blockpos = getNodeBlockPos(p0);
+		std::map<v3s16, u32>::iterator j = block_jobs.find(blockpos);
+		if(j == block_jobs.end()) {
+			j = block_jobs.insert(std::make_pair(blockpos,
+					(u32)jobs.size())).first;
+			jobs.push_back(LiquidBlockJob(this));
+		}
+		jobs[j->second].nodes.push_back(p0);
+	}
+
+	std::vector<WorkerPool::Job *> groups[8];
+	for(std::map<v3s16, u32>::iterator
+			i = block_jobs.begin(); i != block_jobs.end(); ++i) {
+		v3s16 p = i->first;
+		u32 group = (p.X & 1) | (p.Y & 1) << 1 | (p.Z & 1) << 2;
+		groups[group].push_back(&jobs[i->second]);
+	}
+
+	for(u32 i = 0; i < 8; i++)
+		m_liquid_workers->run(groups[i]);
+
+	for(u32 i = 0; i < 8; i++) {
+		for(std::vector<WorkerPool::Job *>::iterator
+				j = groups[i].begin(); j != groups[i].end(); ++j) {
+			LiquidBlockJob *job = (LiquidBlockJob *)*j;
+			for(std::vector<std::pair<v3s16, MapNode> >::iterator
+					k = job->changed.begin(); k != job->changed.end(); ++k)
+				recordLiquidChange(k->first, k->second, getNodeNoEx(k->first),
+						modified_blocks, lighting_changed_nodes);
+			for(std::vector<v3s16>::iterator
+					k = job->queued.begin(); k != job->queued.end(); ++k)
+				m_transforming_liquid.push(*k);
+			must_reflow.insert(must_reflow.end(),
+					job->must_reflow.begin(), job->must_reflow.end());
+		}
+	}
+}
+
+void Map::transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks,
+		const std::vector<v3s16> &focus_blocks)
+{
 	DSTACK(FUNCTION_NAME);
 	//TimeTaker timer("transformLiquids()");
 
-	u32 loopcount = 0;
+	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
+	u32 loop_max = liquid_loop_max;
+
+	m_transforming_liquid.setFocus(focus_blocks);
+
+	// Resume the liquid updates set aside by the purge once there is
+	// time, nearest to the focus first
+	if (!m_liquids_set_aside.empty()
+			&& m_transforming_liquid.size() < liquid_loop_max) {
+		std::multimap<u32, v3s16> set_aside;
+		for (std::set<v3s16>::iterator i = m_liquids_set_aside.begin();
+				i != m_liquids_set_aside.end(); ++i)
+			set_aside.insert(std::make_pair(
+					m_transforming_liquid.getFocusDistance(*i), *i));
+		for (std::multimap<u32, v3s16>::iterator i = set_aside.begin();
+				i != set_aside.end() &&
+				m_transforming_liquid.size() < liquid_loop_max; ++i) {
+			MapBlock *block = getBlockNoCreateNoEx(i->second);
+			m_liquids_set_aside.erase(i->second);
+			if (block != NULL && block->getLiquidsPending())
+				requeueLiquids(block);
+		}
+	}
+
 	u32 initial_size = m_transforming_liquid.size();
+	g_profiler->avg("Map: liquid queue length", initial_size);
 
 	/*if(initial_size != 0)
 		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
@@ -1631,11 +2254,8 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks)
 	// list of nodes that due to viscosity have not reached their max level height
 	std::deque<v3s16> must_reflow;
 
-	// List of MapBlocks that will require a lighting update (due to lava)
-	std::map<v3s16, MapBlock*> lighting_modified_blocks;
-
-	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
-	u32 loop_max = liquid_loop_max;
+	// Changed nodes whose old or new node emits light, with the old node
+	std::vector<std::pair<v3s16, MapNode> > lighting_changed_nodes;
 
 #if 0
 
@@ -1654,267 +2274,46 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks)
 	loop_max *= m_transforming_liquid_loop_count_multiplier;
 #endif
 
-	while(m_transforming_liquid.size() != 0)
-	{
-		// This should be done here so that it is done when continue is used
-		if(loopcount >= initial_size || loopcount >= loop_max)
-			break;
-		loopcount++;
-
-		/*
-			Get a queued transforming liquid node
-		*/
-		v3s16 p0 = m_transforming_liquid.front();
-		m_transforming_liquid.pop_front();
-
-		MapNode n0 = getNodeNoEx(p0);
-
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		content_t liquid_kind = CONTENT_IGNORE;
-		LiquidType liquid_type = nodemgr->get(n0).liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = nodemgr->getId(nodemgr->get(n0).liquid_alternative_flowing);
-				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
-				break;
-			case LIQUID_NONE:
-				// if this is an air node, it *could* be transformed into a liquid. otherwise,
-				// continue with the next node.
-				if (n0.getContent() != CONTENT_AIR)
-					continue;
-				liquid_kind = CONTENT_AIR;
-				break;
-		}
+	u32 loopcount = MYMIN(initial_size, loop_max);
+	g_profiler->avg("Map: liquid nodes transformed", loopcount);
 
-		/*
-			Collect information about the environment
-		 */
-		const v3s16 *dirs = g_6dirs;
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 1:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 4:
-					nt = NEIGHBOR_LOWER;
-					break;
-			}
-			v3s16 npos = p0 + dirs[i];
-			NodeNeighbor nb(getNodeNoEx(npos), nt, npos);
-			switch (nodemgr->get(nb.n.getContent()).liquid_type) {
-				case LIQUID_NONE:
-					if (nb.n.getContent() == CONTENT_AIR) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
-						if (nb.t == NEIGHBOR_LOWER) {
-							flowing_down = true;
-						}
-					} else {
-						neutrals[num_neutrals++] = nb;
-					}
-					break;
-				case LIQUID_SOURCE:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing);
-					if (nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(dirs[i].Y != -1)
-							sources[num_sources++] = nb;
-					}
-					break;
-				case LIQUID_FLOWING:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing);
-					if (nodemgr->getId(nodemgr->get(nb.n).liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
-					break;
-			}
-		}
+	{
+		ScopeProfiler sp(g_profiler, "Map: liquid transform avg", SPT_AVG);
 
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = nodemgr->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX+1)
-			range = LIQUID_LEVEL_MAX+1;
-
-		if ((num_sources >= 2 && nodemgr->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = nodemgr->getId(nodemgr->get(liquid_kind).liquid_alternative_source);
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			new_node_content = liquid_kind;
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level < (LIQUID_LEVEL_MAX+1-range))
-				new_node_content = CONTENT_AIR;
+		if(m_liquid_workers != NULL) {
+			transformLiquidsParallel(loopcount, must_reflow,
+					lighting_changed_nodes, modified_blocks);
 		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level)
-							max_node_level = nb_liquid_level;
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-							nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level) {
-							max_node_level = nb_liquid_level - 1;
-						}
-						break;
+			std::vector<v3s16> nodes;
+			m_transforming_liquid.pop(loopcount, nodes);
+
+			std::vector<v3s16> queued;
+			for(u32 i = 0; i < nodes.size(); i++) {
+				v3s16 p0 = nodes[i];
+
+				MapNode n0, n00;
+				if(transformLiquidNode(p0, n0, n00, queued, must_reflow)) {
+					setNode(p0, n0);
+					recordLiquidChange(p0, n00, n0, modified_blocks,
+							lighting_changed_nodes);
 				}
-			}
-
-			u8 viscosity = nodemgr->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else
-				new_node_level = max_node_level;
-
-			if (max_node_level >= (LIQUID_LEVEL_MAX+1-range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = CONTENT_AIR;
-
-		}
-
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() && (nodemgr->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-										 ((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-										 ((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-										 == flowing_down)))
-			continue;
-
-
-		/*
-			update the current node
-		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (nodemgr->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bit to 0
-			n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
-		n0.setContent(new_node_content);
-
-		// Find out whether there is a suspect for this action
-		std::string suspect;
-		if(m_gamedef->rollback()) {
-			suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
-		}
-
-		if(m_gamedef->rollback() && !suspect.empty()){
-			// Blame suspect
-			RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
-			// Get old node for rollback
-			RollbackNode rollback_oldnode(this, p0, m_gamedef);
-			// Set node
-			setNode(p0, n0);
-			// Report
-			RollbackNode rollback_newnode(this, p0, m_gamedef);
-			RollbackAction action;
-			action.setSetNode(p0, rollback_oldnode, rollback_newnode);
-			m_gamedef->rollback()->reportAction(action);
-		} else {
-			// Set node
-			setNode(p0, n0);
-		}
-
-		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
-		if(block != NULL) {
-			modified_blocks[blockpos] =  block;
-			// If new or old node emits light, MapBlock requires lighting update
-			if(nodemgr->get(n0).light_source != 0 ||
-					nodemgr->get(n00).light_source != 0)
-				lighting_modified_blocks[block->getPos()] = block;
-		}
 
-		/*
-			enqueue neighbors for update if neccessary
-		 */
-		switch (nodemgr->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
-				break;
+				for(std::vector<v3s16>::iterator
+						j = queued.begin(); j != queued.end(); ++j)
+					m_transforming_liquid.push(*j);
+				queued.clear();
+			}
 		}
 	}
 	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
 
 	for (std::deque<v3s16>::iterator iter = must_reflow.begin(); iter != must_reflow.end(); ++iter)
-		m_transforming_liquid.push_back(*iter);
+		m_transforming_liquid.push(*iter);
 
-	updateLighting(lighting_modified_blocks, modified_blocks);
+	{
+		ScopeProfiler sp(g_profiler, "Map: liquid lighting avg", SPT_AVG);
+		updateNodeLighting(lighting_changed_nodes, modified_blocks);
+	}
 
 
 	/* ----------------------------------------------------------------------
@@ -1945,21 +2344,30 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks)
 		m_queue_size_timer_started = false;
 
 	/* If the queue has been growing for more than liquid_queue_purge_time seconds
-	 * and the number of unprocessed blocks is still > liquid_loop_max then we
-	 * cannot keep up; dump the oldest blocks from the queue so that the queue
-	 * has liquid_loop_max items in it
+	 * and the number of unprocessed nodes is still > liquid_loop_max then we
+	 * cannot keep up; set aside the blocks farthest from the players so that
+	 * the queue has about liquid_loop_max items in it. The liquids of those
+	 * blocks are queued again when the queue is short or the block is loaded.
 	 */
 	if (m_queue_size_timer_started
 			&& curr_time - m_inc_trending_up_start_time > time_until_purge
 			&& m_unprocessed_count > liquid_loop_max) {
 
-		size_t dump_qty = m_unprocessed_count - liquid_loop_max;
+		std::vector<v3s16> blocks;
+		m_transforming_liquid.getFarthestBlocks(
+				m_unprocessed_count - liquid_loop_max, blocks);
 
-		infostream << "transformLiquids(): DUMPING " << dump_qty
-		           << " blocks from the queue" << std::endl;
+		infostream << "transformLiquids(): setting aside the liquids of "
+		           << blocks.size() << " blocks" << std::endl;
 
-		while (dump_qty--)
-			m_transforming_liquid.pop_front();
+		for (std::vector<v3s16>::iterator
+				i = blocks.begin(); i != blocks.end(); ++i) {
+			MapBlock *block = getBlockNoCreateNoEx(*i);
+			if (block != NULL)
+				setLiquidsAside(block);
+			else
+				m_transforming_liquid.removeBlock(*i);
+		}
 
 		m_queue_size_timer_started = false; // optimistically assume we can keep up now
 		m_unprocessed_count = m_transforming_liquid.size();
@@ -2120,6 +2528,10 @@ ServerMap::ServerMap(std::string savedir, IGameDef *gamedef, EmergeManager *emer
 {
 	verbosestream<<FUNCTION_NAME<<std::endl;
 
+	u16 num_liquid_threads = g_settings->getU16("num_liquid_threads");
+	if (num_liquid_threads > 0)
+		m_liquid_workers = new WorkerPool("Liquid", num_liquid_threads);
+
 	/*
 		Try to load map; if not found, create a new one.
 	*/
@@ -2133,7 +2545,27 @@ ServerMap::ServerMap(std::string savedir, IGameDef *gamedef, EmergeManager *emer
 		conf.set("backend", "sqlite3");
 	}
 	std::string backend = conf.get("backend");
+
+	// Blocks are only compressed with zstd on disk if the world asks for
+	// it, as builds without zstd can't read them
+	m_disk_ser_ver = SER_FMT_VER_HIGHEST_WRITE;
+	if (conf.exists("map_compression")) {
+		std::string compression = conf.get("map_compression");
+		if (compression == "zstd") {
+#if USE_ZSTD
+			m_disk_ser_ver = SER_FMT_VER_ZSTD;
+#else
+			throw BaseException("The world uses zstd map compression, "
+				"but this build has no zstd support.");
+#endif
+		} else if (compression != "zlib") {
+			throw BaseException("Unknown map_compression \""
+				+ compression + "\" in world.mt.");
+		}
+	}
+
 	dbase = createDatabase(backend, savedir, conf);
+	m_saver = new MapSaver(dbase, g_settings->getU16("num_map_save_threads"));
 
 	if (!conf.updateConfigFile(conf_path.c_str()))
 		errorstream << "ServerMap::ServerMap(): Failed to update world.mt!" << std::endl;
@@ -2229,6 +2661,7 @@ ServerMap::~ServerMap()
 	/*
 		Close database if it was opened
 	*/
+	delete m_saver;
 	delete dbase;
 
 #if 0
@@ -2278,6 +2711,16 @@ bool ServerMap::initBlockMake(v3s16 blockpos, BlockMakeData *data)
 	data->blockpos_requested = blockpos;
 	data->nodedef = m_gamedef->ndef();
 
+	/*
+		Load what exists of the area in one go
+	*/
+	std::vector<v3s16> blockpos_list;
+	for (s16 x = full_bpmin.X; x <= full_bpmax.X; x++)
+	for (s16 z = full_bpmin.Z; z <= full_bpmax.Z; z++)
+	for (s16 y = full_bpmin.Y; y <= full_bpmax.Y; y++)
+		blockpos_list.push_back(v3s16(x, y, z));
+	loadBlocks(blockpos_list);
+
 	/*
 		Create the whole area of this and the neighboring blocks
 	*/
@@ -2291,8 +2734,9 @@ bool ServerMap::initBlockMake(v3s16 blockpos, BlockMakeData *data)
 		for (s16 y = full_bpmin.Y; y <= full_bpmax.Y; y++) {
 			v3s16 p(x, y, z);
 
-			MapBlock *block = emergeBlock(p, false);
-			if (block == NULL) {
+			// Anything not in memory now does not exist on disk either
+			MapBlock *block = getBlockNoCreateNoEx(p);
+			if (block == NULL || block->isDummy()) {
 				block = createBlock(p);
 
 				// Block gets sunlight if this is true.
@@ -2377,7 +2821,7 @@ void ServerMap::finishBlockMake(BlockMakeData *data,
 		Copy transforming liquid information
 	*/
 	while (data->transforming_liquid.size()) {
-		m_transforming_liquid.push_back(data->transforming_liquid.front());
+		m_transforming_liquid.push(data->transforming_liquid.front());
 		data->transforming_liquid.pop_front();
 	}
 
@@ -2969,7 +3413,7 @@ void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 		errorstream << "Map::listAllLoadableBlocks(): Result will be missing "
 				<< "all blocks that are stored in flat files." << std::endl;
 	}
-	dbase->listAllLoadableBlocks(dst);
+	m_saver->listAllLoadableBlocks(dst);
 }
 
 void ServerMap::listAllLoadedBlocks(std::vector<v3s16> &dst)
@@ -3235,19 +3679,27 @@ Database *ServerMap::createDatabase(
 		throw BaseException(std::string("Database backend ") + name + " not supported.");
 }
 
-void ServerMap::beginSave()
-{
-	dbase->beginSave();
-}
-
 void ServerMap::endSave()
 {
-	dbase->endSave();
+	m_saver->flush();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase);
+	// Dummy blocks are not written
+	if (block->isDummy()) {
+		warningstream << "saveBlock: Not writing dummy block "
+			<< PP(block->getPos()) << std::endl;
+		return true;
+	}
+
+	// Only the copy is made here, the saver compresses and writes it
+	MapBlockSnapshot *snapshot = new MapBlockSnapshot;
+	block->snapshot(snapshot, m_disk_ser_ver);
+	m_saver->saveBlock(snapshot);
+
+	block->resetModified();
+	return true;
 }
 
 bool ServerMap::saveBlock(MapBlock *block, Database *db)
@@ -3337,12 +3789,17 @@ void ServerMap::loadBlock(std::string sectordir, std::string blockfile,
 			saveBlock(block);
 
 			// Should be in database now, so delete the old file
+			m_saver->sync();
 			fs::RecursiveDelete(fullpath);
 		}
 
 		// We just loaded it from the disk, so it's up-to-date.
 		block->resetModified();
 
+		// Resume the liquid updates that were pending when it was saved
+		if (block->getLiquidsPending())
+			requeueLiquids(block);
+
 	}
 	catch(SerializationError &e)
 	{
@@ -3407,6 +3864,16 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 		// We just loaded it from, so it's up-to-date.
 		block->resetModified();
 
+		// In worlds that opted in to zstd, write blocks of an older
+		// format in it when unloaded
+		if(m_disk_ser_ver == SER_FMT_VER_ZSTD && version < m_disk_ser_ver)
+			block->raiseModified(MOD_STATE_WRITE_AT_UNLOAD,
+				MOD_REASON_OLD_SER_VER);
+
+		// Resume the liquid updates that were pending when it was saved
+		if (block->getLiquidsPending())
+			requeueLiquids(block);
+
 	}
 	catch(SerializationError &e)
 	{
@@ -3434,12 +3901,43 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 
 	std::string ret;
 
-	ret = dbase->loadBlock(blockpos);
+	ret = m_saver->loadBlock(blockpos);
 	if (ret != "") {
 		loadBlock(&ret, blockpos, createSector(p2d), false);
 		return getBlockNoCreateNoEx(blockpos);
 	}
 	// Not found in database, try the files
+	return loadBlockFromFolders(blockpos);
+}
+
+void ServerMap::loadBlocks(const std::vector<v3s16> &blockpos_list)
+{
+	DSTACK(FUNCTION_NAME);
+
+	std::vector<v3s16> load_list;
+	for (size_t i = 0; i < blockpos_list.size(); i++) {
+		MapBlock *block = getBlockNoCreateNoEx(blockpos_list[i]);
+		if (block == NULL || block->isDummy())
+			load_list.push_back(blockpos_list[i]);
+	}
+	if (load_list.empty())
+		return;
+
+	std::vector<std::string> blobs;
+	m_saver->loadBlocks(load_list, blobs);
+
+	for (size_t i = 0; i < load_list.size(); i++) {
+		v3s16 p = load_list[i];
+		if (blobs[i].empty())
+			loadBlockFromFolders(p);
+		else
+			loadBlock(&blobs[i], p, createSector(v2s16(p.X, p.Z)), false);
+	}
+}
+
+MapBlock *ServerMap::loadBlockFromFolders(v3s16 blockpos)
+{
+	v2s16 p2d(blockpos.X, blockpos.Z);
 
 	// The directory layout we're going to load from.
 	//  1 - original sectors/xxxxzzzz/
@@ -3500,8 +3998,7 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
-		return false;
+	m_saver->deleteBlock(blockpos);
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
@@ -3555,6 +4052,19 @@ void MMVManip::initialEmerge(v3s16 blockpos_min, v3s16 blockpos_max,
 
 	addArea(block_area_nodes);
 
+	if (load_if_inexistent) {
+		std::vector<v3s16> blockpos_list;
+		for(s32 z=p_min.Z; z<=p_max.Z; z++)
+		for(s32 y=p_min.Y; y<=p_max.Y; y++)
+		for(s32 x=p_min.X; x<=p_max.X; x++)
+		{
+			v3s16 p(x,y,z);
+			if (m_loaded_blocks.find(p) == m_loaded_blocks.end())
+				blockpos_list.push_back(p);
+		}
+		((ServerMap *)m_map)->loadBlocks(blockpos_list);
+	}
+
 	for(s32 z=p_min.Z; z<=p_max.Z; z++)
 	for(s32 y=p_min.Y; y<=p_max.Y; y++)
 	for(s32 x=p_min.X; x<=p_max.X; x++)
@@ -3587,10 +4097,9 @@ void MMVManip::initialEmerge(v3s16 blockpos_min, v3s16 blockpos_max,
 		{
 
 			if (load_if_inexistent) {
+				// loadBlocks() above did not find it on disk
 				ServerMap *svrmap = (ServerMap *)m_map;
-				block = svrmap->emergeBlock(p, false);
-				if (block == NULL)
-					block = svrmap->createBlock(p);
+				block = svrmap->createBlock(p);
 				block->copyTo(*this);
 			} else {
 				flags |= VMANIP_BLOCK_DATA_INEXIST;
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <deque>
 
 #include "irrlichttypes_bloated.h"
 #include "mapnode.h"
@@ -32,10 +33,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "voxel.h"
 #include "modifiedstate.h"
 #include "util/container.h"
+#include "liquidqueue.h"
 #include "nodetimer.h"
 
 class Settings;
 class Database;
+class MapSaver;
 class ClientMap;
 class MapSector;
 class ServerMapSector;
@@ -45,6 +48,7 @@ class IGameDef;
 class IRollbackManager;
 class EmergeManager;
 class ServerEnvironment;
+class WorkerPool;
 struct BlockMakeData;
 struct MapgenParams;
 
@@ -186,8 +190,12 @@ class Map /*: public NodeContainer*/
 
 	// Returns InvalidPositionException if not found
 	MapBlock * getBlockNoCreate(v3s16 p);
-	// Returns NULL if not found
+	// Returns NULL if not found. Several threads can use it at once
+	// while nothing modifies the map.
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
+	// Same as the above, but doesn't touch the recently used blocks of
+	// the thread
+	MapBlock * getBlockNoCreateNoExNoCache(v3s16 p) const;
 
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
@@ -236,6 +244,15 @@ class Map /*: public NodeContainer*/
 	void updateLighting(std::map<v3s16, MapBlock*>  & a_blocks,
 			std::map<v3s16, MapBlock*> & modified_blocks);
 
+	/*
+		Updates lighting around nodes that have already been changed
+		on the map, in one pass for all of them. oldnodes contains the
+		positions of the changed nodes and the nodes that were there.
+	*/
+	void updateNodeLighting(
+			const std::vector<std::pair<v3s16, MapNode> > &oldnodes,
+			std::map<v3s16, MapBlock*> &modified_blocks);
+
 	/*
 		These handle lighting but not faces.
 	*/
@@ -294,7 +311,9 @@ class Map /*: public NodeContainer*/
 	// For debug printing. Prints "Map: ", "ServerMap: " or "ClientMap: "
 	virtual void PrintInfo(std::ostream &out);
 
-	void transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks);
+	// Liquids in the blocks nearest to focus_blocks are transformed first
+	void transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks,
+			const std::vector<v3s16> &focus_blocks);
 
 	/*
 		Node metadata
@@ -344,6 +363,9 @@ class Map /*: public NodeContainer*/
 
 protected:
 	friend class LuaVoxelManip;
+	// Keeps m_blocks up to date
+	friend class MapSector;
+	friend class LiquidBlockJob;
 
 	std::ostream &m_dout; // A bit deprecated, could be removed
 
@@ -357,10 +379,37 @@ class Map /*: public NodeContainer*/
 	MapSector *m_sector_cache;
 	v2s16 m_sector_cache_p;
 
+	// All blocks of the sectors by position
+	PosHashMap<MapBlock> m_blocks;
+
 	// Queued transforming water nodes
-	UniqueQueue<v3s16> m_transforming_liquid;
+	LiquidQueue m_transforming_liquid;
+
+	// Loaded blocks whose liquid updates were set aside by the purge
+	std::set<v3s16> m_liquids_set_aside;
+
+	// Transforms liquids in parallel if not NULL
+	WorkerPool *m_liquid_workers;
+
+	// Moves the queued liquid nodes of a block into the block
+	void setLiquidsAside(MapBlock *block);
+	// Queues the liquid nodes of a block that has liquids pending
+	void requeueLiquids(MapBlock *block);
 
 private:
+	void addBlockToIndex(MapBlock *block);
+	void removeBlockFromIndex(v3s16 p);
+
+	bool transformLiquidNode(v3s16 p0, MapNode &n0, MapNode &n00,
+			std::vector<v3s16> &queued, std::deque<v3s16> &must_reflow);
+	void recordLiquidChange(v3s16 p0, const MapNode &n00, const MapNode &n0,
+			std::map<v3s16, MapBlock*> &modified_blocks,
+			std::vector<std::pair<v3s16, MapNode> > &lighting_changed_nodes);
+	void transformLiquidsParallel(u32 count,
+			std::deque<v3s16> &must_reflow,
+			std::vector<std::pair<v3s16, MapNode> > &lighting_changed_nodes,
+			std::map<v3s16, MapBlock*> &modified_blocks);
+
 	f32 m_transforming_liquid_loop_count_multiplier;
 	u32 m_unprocessed_count;
 	u32 m_inc_trending_up_start_time; // milliseconds
@@ -456,8 +505,8 @@ class ServerMap : public Map
 	// Returns true if the database file does not exist
 	bool loadFromFolders();
 
-	// Call these before and after saving of blocks
-	void beginSave();
+	// Blocks are written in the background; endSave() starts writing
+	// the ones saved since the last call in one transaction
 	void endSave();
 
 	void save(ModifiedState save_level);
@@ -491,6 +540,9 @@ class ServerMap : public Map
 	// This will generate a sector with getSector if not found.
 	void loadBlock(std::string sectordir, std::string blockfile, MapSector *sector, bool save_after_load=false);
 	MapBlock* loadBlock(v3s16 p);
+	// Loads the blocks of the list that are not in memory yet, asking
+	// the database for all of them at once
+	void loadBlocks(const std::vector<v3s16> &blockpos_list);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
@@ -527,6 +579,13 @@ class ServerMap : public Map
 	*/
 	bool m_map_metadata_changed;
 	Database *dbase;
+
+	// Loads a block from the pre-database sector directories
+	MapBlock *loadBlockFromFolders(v3s16 blockpos);
+	// All access to dbase goes through this
+	MapSaver *m_saver;
+	// Serialization version blocks are saved in, see map_compression
+	u8 m_disk_ser_ver;
 };
 
 
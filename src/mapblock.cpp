@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock.h"
 
 #include <sstream>
+#include <algorithm>
 #include "map.h"
 #include "light.h"
 #include "nodedef.h"
@@ -35,6 +36,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #endif
 #include "util/string.h"
 #include "util/serialize.h"
+#include "util/directiontables.h"
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
 
@@ -58,6 +60,8 @@ static const char *modified_reason_strings[] = {
 	"deactivateFarObjects: Static data moved out",
 	"deactivateFarObjects: Static data changed considerably",
 	"finishBlockMake: expireDayNightDiff",
+	"setLiquidsPending",
+	"loadBlock: Saved in an older format",
 	"unknown",
 };
 
@@ -73,11 +77,15 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_gamedef(gamedef),
 		m_modified(MOD_STATE_WRITE_NEEDED),
 		m_modified_reason(MOD_REASON_INITIAL),
+		m_network_blob_timer(0),
 		is_underground(false),
 		m_lighting_expired(true),
 		m_day_night_differs(false),
 		m_day_night_differs_expired(true),
+		m_opaque_faces(0),
+		m_opaque_faces_expired(true),
 		m_generated(false),
+		m_liquids_pending(false),
 		m_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_disk_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_usage_timer(0),
@@ -86,6 +94,8 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 	data = NULL;
 	if(dummy == false)
 		reallocate();
+	else
+		updateContents();
 
 #ifndef SERVER
 	mesh = NULL;
@@ -370,6 +380,79 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+
+	updateContents();
+	actuallyUpdateOpaqueFaces();
+	expireNetworkBlob();
+}
+
+void MapBlock::updateContents()
+{
+	m_contents.clear();
+	m_content_counts.clear();
+	m_opaque_faces_expired = true;
+
+	if (data == NULL) {
+		m_contents.push_back(CONTENT_IGNORE);
+		m_content_counts.push_back(nodecount);
+		return;
+	}
+
+	// Count equal contents next to each other
+	content_t sorted[nodecount];
+	for (u32 i = 0; i < nodecount; i++)
+		sorted[i] = data[i].getContent();
+	std::sort(sorted, sorted + nodecount);
+
+	for (u32 i = 0; i < nodecount; i++) {
+		if (i == 0 || sorted[i] != sorted[i - 1]) {
+			m_contents.push_back(sorted[i]);
+			m_content_counts.push_back(0);
+		}
+		m_content_counts.back()++;
+	}
+}
+
+void MapBlock::updateContentCount(content_t c_old, content_t c_new)
+{
+	for (u32 i = 0; i < m_contents.size(); i++) {
+		if (m_contents[i] != c_old)
+			continue;
+		if (--m_content_counts[i] == 0) {
+			m_contents[i] = m_contents.back();
+			m_content_counts[i] = m_content_counts.back();
+			m_contents.pop_back();
+			m_content_counts.pop_back();
+		}
+		break;
+	}
+
+	for (u32 i = 0; i < m_contents.size(); i++) {
+		if (m_contents[i] == c_new) {
+			m_content_counts[i]++;
+			return;
+		}
+	}
+	m_contents.push_back(c_new);
+	m_content_counts.push_back(1);
+}
+
+u16 MapBlock::getContentCount(content_t c)
+{
+	for (u32 i = 0; i < m_contents.size(); i++) {
+		if (m_contents[i] == c)
+			return m_content_counts[i];
+	}
+	return 0;
+}
+
+bool MapBlock::containsAnyContent(const std::set<content_t> &contents)
+{
+	for (u32 i = 0; i < m_contents.size(); i++) {
+		if (contents.count(m_contents[i]) != 0)
+			return true;
+	}
+	return false;
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -384,11 +467,27 @@ void MapBlock::actuallyUpdateDayNightDiff()
 		return;
 	}
 
-	bool differs;
+	/*
+		Only nodes that store light can differ, and if the whole thing
+		is just air it doesn't matter that they do
+	*/
+	bool has_light_nodes = false;
+	for (u32 i = 0; i < m_contents.size(); i++) {
+		if (nodemgr->get(m_contents[i]).param_type == CPT_LIGHT) {
+			has_light_nodes = true;
+			break;
+		}
+	}
+	if (!has_light_nodes || (m_contents.size() == 1 &&
+			m_contents[0] == CONTENT_AIR)) {
+		m_day_night_differs = false;
+		return;
+	}
 
 	/*
 		Check if any lighting value differs
 	*/
+	bool differs = false;
 	for (u32 i = 0; i < nodecount; i++) {
 		MapNode &n = data[i];
 
@@ -397,23 +496,6 @@ void MapBlock::actuallyUpdateDayNightDiff()
 			break;
 	}
 
-	/*
-		If some lighting values differ, check if the whole thing is
-		just air. If it is just air, differs = false
-	*/
-	if (differs) {
-		bool only_air = true;
-		for (u32 i = 0; i < nodecount; i++) {
-			MapNode &n = data[i];
-			if (n.getContent() != CONTENT_AIR) {
-				only_air = false;
-				break;
-			}
-		}
-		if (only_air)
-			differs = false;
-	}
-
 	// Set member variable
 	m_day_night_differs = differs;
 }
@@ -431,6 +513,62 @@ void MapBlock::expireDayNightDiff()
 	m_day_night_differs_expired = true;
 }
 
+// Whether the nodes from from to to, inclusive, are all opaque cubes
+static bool is_area_opaque(const MapNode *data, INodeDefManager *nodemgr,
+	v3s16 from, v3s16 to)
+{
+	v3s16 p;
+	for (p.Z = from.Z; p.Z <= to.Z; p.Z++)
+	for (p.Y = from.Y; p.Y <= to.Y; p.Y++)
+	for (p.X = from.X; p.X <= to.X; p.X++) {
+		const MapNode &n = data[p.Z * MapBlock::zstride +
+			p.Y * MapBlock::ystride + p.X];
+		if (nodemgr->get(n).drawtype != NDT_NORMAL)
+			return false;
+	}
+	return true;
+}
+
+void MapBlock::actuallyUpdateOpaqueFaces()
+{
+	m_opaque_faces = 0;
+	m_opaque_faces_expired = false;
+
+	if (data == NULL)
+		return;
+
+	INodeDefManager *nodemgr = m_gamedef->ndef();
+
+	// Most blocks are either solid ground or contain no opaque nodes,
+	// which is known from the content histogram alone
+	bool any_opaque = false;
+	bool all_opaque = true;
+	for (std::vector<content_t>::const_iterator i = m_contents.begin();
+			i != m_contents.end(); ++i) {
+		if (nodemgr->get(*i).drawtype == NDT_NORMAL)
+			any_opaque = true;
+		else
+			all_opaque = false;
+	}
+	if (all_opaque) {
+		m_opaque_faces = 0x3f;
+		return;
+	}
+	if (!any_opaque)
+		return;
+
+	const s16 last = MAP_BLOCKSIZE - 1;
+	for (u8 i = 0; i < 6; i++) {
+		const v3s16 &dir = g_6dirs[i];
+		v3s16 from(dir.X > 0 ? last : 0, dir.Y > 0 ? last : 0,
+			dir.Z > 0 ? last : 0);
+		v3s16 to(dir.X < 0 ? 0 : last, dir.Y < 0 ? 0 : last,
+			dir.Z < 0 ? 0 : last);
+		if (is_area_opaque(data, nodemgr, from, to))
+			m_opaque_faces |= 1 << i;
+	}
+}
+
 s16 MapBlock::getGroundLevel(v2s16 p2d)
 {
 	if(isDummy())
@@ -554,8 +692,32 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	}
 }
 
+u8 MapBlock::getSerializationFlags()
+{
+	u8 flags = 0;
+	if(is_underground)
+		flags |= 0x01;
+	if(getDayNightDiff())
+		flags |= 0x02;
+	if(m_lighting_expired)
+		flags |= 0x04;
+	if(m_generated == false)
+		flags |= 0x08;
+	if(m_liquids_pending)
+		flags |= 0x10;
+	return flags;
+}
+
 void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 {
+	if(disk)
+	{
+		MapBlockSnapshot snap;
+		snapshot(&snap, version);
+		snap.serialize(os);
+		return;
+	}
+
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
@@ -567,77 +729,102 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
 
 	// First byte
-	u8 flags = 0;
-	if(is_underground)
-		flags |= 0x01;
-	if(getDayNightDiff())
-		flags |= 0x02;
-	if(m_lighting_expired)
-		flags |= 0x04;
-	if(m_generated == false)
-		flags |= 0x08;
-	writeU8(os, flags);
+	writeU8(os, getSerializationFlags());
 
 	/*
 		Bulk node data
 	*/
-	NameIdMapping nimap;
-	if(disk)
-	{
-		MapNode *tmp_nodes = new MapNode[nodecount];
-		for(u32 i=0; i<nodecount; i++)
-			tmp_nodes[i] = data[i];
-		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
-
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, tmp_nodes, nodecount,
-				content_width, params_width, true);
-		delete[] tmp_nodes;
-	}
-	else
-	{
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, data, nodecount,
-				content_width, params_width, true);
-	}
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	MapNode::serializeBulk(os, version, data, nodecount,
+			content_width, params_width, true);
 
 	/*
 		Node metadata
 	*/
 	std::ostringstream oss(std::ios_base::binary);
 	m_node_metadata.serialize(oss);
-	compressZlib(oss.str(), os);
+	compress(oss.str(), os, version);
+}
+
+void MapBlock::snapshot(MapBlockSnapshot *snapshot, u8 version)
+{
+	if(!ser_ver_supported(version))
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+
+	if(data == NULL)
+	{
+		throw SerializationError("ERROR: Not writing dummy block.");
+	}
+
+	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
+
+	snapshot->pos = getPos();
+	snapshot->version = version;
+	snapshot->flags = getSerializationFlags();
+
+	/*
+		Bulk node data
+	*/
+	NameIdMapping nimap;
+	MapNode *tmp_nodes = new MapNode[nodecount];
+	for(u32 i=0; i<nodecount; i++)
+		tmp_nodes[i] = data[i];
+	getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
+
+	std::ostringstream os_nodes(std::ios_base::binary);
+	MapNode::serializeBulk(os_nodes, version, tmp_nodes, nodecount,
+			2, 2, false);
+	snapshot->nodes = os_nodes.str();
+	delete[] tmp_nodes;
+
+	/*
+		Node metadata
+	*/
+	std::ostringstream os_metadata(std::ios_base::binary);
+	m_node_metadata.serialize(os_metadata);
+	snapshot->metadata = os_metadata.str();
 
 	/*
 		Data that goes to disk, but not the network
 	*/
-	if(disk)
-	{
-		if(version <= 24){
-			// Node timers
-			m_node_timers.serialize(os, version);
-		}
+	std::ostringstream os(std::ios_base::binary);
+	if(version <= 24){
+		// Node timers
+		m_node_timers.serialize(os, version);
+	}
 
-		// Static objects
-		m_static_objects.serialize(os);
+	// Static objects
+	m_static_objects.serialize(os);
 
-		// Timestamp
-		writeU32(os, getTimestamp());
+	// Timestamp
+	writeU32(os, getTimestamp());
 
-		// Write block-specific node definition id mapping
-		nimap.serialize(os);
+	// Write block-specific node definition id mapping
+	nimap.serialize(os);
 
-		if(version >= 25){
-			// Node timers
-			m_node_timers.serialize(os, version);
-		}
+	if(version >= 25){
+		// Node timers
+		m_node_timers.serialize(os, version);
 	}
+	snapshot->tail = os.str();
+}
+
+void MapBlockSnapshot::serialize(std::ostream &os) const
+{
+	writeU8(os, flags);
+
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	compress(nodes, os, version);
+
+	compress(metadata, os, version);
+
+	os.write(tail.c_str(), tail.size());
 }
 
 void MapBlock::serializeNetworkSpecific(std::ostream &os, u16 net_proto_version)
@@ -655,6 +842,31 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os, u16 net_proto_version)
 	}
 }
 
+const std::string &MapBlock::getNetworkBlob(u8 version, u16 net_proto_version)
+{
+	m_network_blob_timer = 0;
+
+	for (std::vector<NetworkBlob>::iterator i = m_network_blobs.begin();
+			i != m_network_blobs.end(); ++i) {
+		if (i->version == version && i->net_proto_version == net_proto_version)
+			return i->data;
+	}
+
+	std::ostringstream os(std::ios_base::binary);
+	serialize(os, version, false);
+	serializeNetworkSpecific(os, net_proto_version);
+
+	if (m_network_blobs.size() >= MAPBLOCK_NETWORK_BLOBS_MAX)
+		m_network_blobs.erase(m_network_blobs.begin());
+
+	NetworkBlob blob;
+	blob.version = version;
+	blob.net_proto_version = net_proto_version;
+	m_network_blobs.push_back(blob);
+	m_network_blobs.back().data = os.str();
+	return m_network_blobs.back().data;
+}
+
 void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 {
 	if(!ser_ver_supported(version))
@@ -663,6 +875,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
 	m_day_night_differs_expired = false;
+	expireNetworkBlob();
 
 	if(version <= 21)
 	{
@@ -675,6 +888,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	m_day_night_differs = (flags & 0x02) ? true : false;
 	m_lighting_expired = (flags & 0x04) ? true : false;
 	m_generated = (flags & 0x08) ? false : true;
+	m_liquids_pending = (flags & 0x10) ? true : false;
 
 	/*
 		Bulk node data
@@ -698,7 +912,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	// Ignore errors
 	try {
 		std::ostringstream oss(std::ios_base::binary);
-		decompressZlib(is, oss);
+		decompress(is, oss, version);
 		std::istringstream iss(oss.str(), std::ios_base::binary);
 		if (version >= 23)
 			m_node_metadata.deSerialize(iss, m_gamedef->idef());
@@ -753,6 +967,11 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 		}
 	}
 
+	updateContents();
+	// Blocks loaded from disk are about to be sent to clients
+	if(disk)
+		actuallyUpdateOpaqueFaces();
+
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())
 			<<": Done."<<std::endl);
 }
@@ -986,6 +1205,9 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 		}
 	}
 
+	updateContents();
+	if(disk)
+		actuallyUpdateOpaqueFaces();
 }
 
 /*
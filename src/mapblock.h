@@ -21,6 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define MAPBLOCK_HEADER
 
 #include <set>
+#include <string>
+#include <vector>
 #include "debug.h"
 #include "irr_v3d.h"
 #include "mapnode.h"
@@ -41,6 +43,12 @@ class VoxelManipulator;
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
+// Cached network blobs kept per block at most
+#define MAPBLOCK_NETWORK_BLOBS_MAX 2
+// Seconds after which the cached network blobs of a block that has not
+// been sent are dropped
+#define MAPBLOCK_NETWORK_BLOB_KEEP 10.0
+
 /*// Named by looking towards z+
 enum{
 	FACE_BACK=0,
@@ -121,7 +129,33 @@ class NodeContainer
 #define MOD_REASON_STATIC_DATA_REMOVED       (1 << 16)
 #define MOD_REASON_STATIC_DATA_CHANGED       (1 << 17)
 #define MOD_REASON_EXPIRE_DAYNIGHTDIFF       (1 << 18)
-#define MOD_REASON_UNKNOWN                   (1 << 19)
+#define MOD_REASON_SET_LIQUIDS_PENDING       (1 << 19)
+#define MOD_REASON_OLD_SER_VER               (1 << 20)
+#define MOD_REASON_UNKNOWN                   (1 << 21)
+
+////
+//// Copy of a MapBlock for saving it without holding the map
+////
+
+/*
+	The on-disk serialization of a block with the compression left out.
+	Made by MapBlock::snapshot(); serialize() does the expensive part and
+	can run on any thread.
+*/
+struct MapBlockSnapshot
+{
+	v3s16 pos;
+	u8 version;
+	u8 flags;
+	// Bulk node data and node metadata, both uncompressed
+	std::string nodes;
+	std::string metadata;
+	// Node timers, static objects, timestamp and id mapping
+	std::string tail;
+
+	// Writes the same as MapBlock::serialize(os, version, true) did
+	void serialize(std::ostream &os) const;
+};
 
 ////
 //// MapBlock itself
@@ -150,6 +184,7 @@ class MapBlock /*: public NodeContainer*/
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
 
+		updateContents();
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
 
@@ -158,6 +193,7 @@ class MapBlock /*: public NodeContainer*/
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		m_network_blobs.clear();
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -239,6 +275,21 @@ class MapBlock /*: public NodeContainer*/
 		}
 	}
 
+	// Whether liquid nodes of the block still wait to be transformed
+	// while the block is not in the liquid queue
+	inline bool getLiquidsPending()
+	{
+		return m_liquids_pending;
+	}
+
+	inline void setLiquidsPending(bool pending)
+	{
+		if (pending != m_liquids_pending) {
+			raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_LIQUIDS_PENDING);
+			m_liquids_pending = pending;
+		}
+	}
+
 	inline bool isValid()
 	{
 		if (m_lighting_expired)
@@ -314,7 +365,12 @@ class MapBlock /*: public NodeContainer*/
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
+		MapNode &old = data[z * zstride + y * ystride + x];
+		if (old.getContent() != n.getContent()) {
+			updateContentCount(old.getContent(), n.getContent());
+			m_opaque_faces_expired = true;
+		}
+		old = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -346,7 +402,12 @@ class MapBlock /*: public NodeContainer*/
 		if (data == NULL)
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
+		MapNode &old = data[z * zstride + y * ystride + x];
+		if (old.getContent() != n.getContent()) {
+			updateContentCount(old.getContent(), n.getContent());
+			m_opaque_faces_expired = true;
+		}
+		old = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -395,6 +456,53 @@ class MapBlock /*: public NodeContainer*/
 		return m_day_night_differs;
 	}
 
+	// Like getDayNightDiff(), but returns true instead of updating an
+	// expired flag, so it doesn't write to the block
+	inline bool getDayNightDiffNoUpdate() const
+	{
+		return m_day_night_differs_expired || m_day_night_differs;
+	}
+
+	// Update the flags of the faces that consist of opaque nodes only.
+	// Bit i is set if the face towards g_6dirs[i] is opaque.
+	void actuallyUpdateOpaqueFaces();
+
+	inline u8 getOpaqueFaces()
+	{
+		if (m_opaque_faces_expired)
+			actuallyUpdateOpaqueFaces();
+		return m_opaque_faces;
+	}
+
+	// Like getOpaqueFaces(), but returns 0 instead of updating expired
+	// flags, so it doesn't write to the block
+	inline u8 getOpaqueFacesNoUpdate() const
+	{
+		return m_opaque_faces_expired ? 0 : m_opaque_faces;
+	}
+
+	////
+	//// Content histogram
+	////
+
+	// Distinct content ids found in the block, in no particular order.
+	// Dummy blocks contain only CONTENT_IGNORE.
+	inline const std::vector<content_t> &getContents()
+	{
+		return m_contents;
+	}
+
+	// Number of nodes of the given content in the block
+	u16 getContentCount(content_t c);
+
+	inline bool containsContent(content_t c)
+	{
+		return getContentCount(c) != 0;
+	}
+
+	// Whether any of the given contents is in the block
+	bool containsAnyContent(const std::set<content_t> &contents);
+
 	////
 	//// Miscellaneous stuff
 	////
@@ -448,6 +556,9 @@ class MapBlock /*: public NodeContainer*/
 	inline void incrementUsageTimer(float dtime)
 	{
 		m_usage_timer += dtime;
+		m_network_blob_timer += dtime;
+		if (m_network_blob_timer > MAPBLOCK_NETWORK_BLOB_KEEP)
+			m_network_blobs.clear();
 	}
 
 	inline float getUsageTimer()
@@ -506,6 +617,8 @@ class MapBlock /*: public NodeContainer*/
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
 	void serialize(std::ostream &os, u8 version, bool disk);
+	// Copies the on-disk format into snapshot, to be compressed later
+	void snapshot(MapBlockSnapshot *snapshot, u8 version);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
 	void deSerialize(std::istream &is, u8 version, bool disk);
@@ -513,6 +626,18 @@ class MapBlock /*: public NodeContainer*/
 	void serializeNetworkSpecific(std::ostream &os, u16 net_proto_version);
 	void deSerializeNetworkSpecific(std::istream &is);
 
+	/*
+		Returns the block in the over-the-network format, followed by the
+		network specific data. The result is kept until the block is
+		modified or has not been sent for a while, so a block sent to many
+		clients is only compressed once.
+	*/
+	const std::string &getNetworkBlob(u8 version, u16 net_proto_version);
+	inline void expireNetworkBlob()
+	{
+		m_network_blobs.clear();
+	}
+
 private:
 	/*
 		Private methods
@@ -520,6 +645,14 @@ class MapBlock /*: public NodeContainer*/
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
 
+	// First byte of the serialized block
+	u8 getSerializationFlags();
+
+	// Rebuilds the content histogram from the node data
+	void updateContents();
+	// Moves one node from c_old to c_new in the content histogram
+	void updateContentCount(content_t c_old, content_t c_new);
+
 	/*
 		Used only internally, because changes can't be tracked
 	*/
@@ -589,6 +722,21 @@ class MapBlock /*: public NodeContainer*/
 	u32 m_modified;
 	u32 m_modified_reason;
 
+	/*
+		Cached results of getNetworkBlob(), one per serialization and
+		protocol version pair in use up to MAPBLOCK_NETWORK_BLOBS_MAX,
+		oldest first. Cleared whenever the block changes.
+	*/
+	struct NetworkBlob
+	{
+		u8 version;
+		u16 net_proto_version;
+		std::string data;
+	};
+	std::vector<NetworkBlob> m_network_blobs;
+	// Time since getNetworkBlob() was called
+	float m_network_blob_timer;
+
 	/*
 		When propagating sunlight and the above block doesn't exist,
 		sunlight is assumed if this is false.
@@ -612,7 +760,20 @@ class MapBlock /*: public NodeContainer*/
 	bool m_day_night_differs;
 	bool m_day_night_differs_expired;
 
+	// Faces that consist of opaque nodes only, see getOpaqueFaces()
+	u8 m_opaque_faces;
+	bool m_opaque_faces_expired;
+
+	/*
+		Node count of every content id in the block, kept up to date
+		by setNode() and rebuilt when the whole node data changes.
+		m_content_counts[i] is the count of m_contents[i].
+	*/
+	std::vector<content_t> m_contents;
+	std::vector<u16> m_content_counts;
+
 	bool m_generated;
+	bool m_liquids_pending;
 
 	/*
 		When block is removed from active blocks, this is set to gametime.
@@ -31,7 +31,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shader.h"
 #include "settings.h"
 #include "util/directiontables.h"
+#include "porting.h"
+#include "threading/atomic.h"
 #include <IMeshManipulator.h>
+#include <algorithm>
 
 static void applyFacesShading(video::SColor& color, float factor)
 {
@@ -39,6 +42,83 @@ static void applyFacesShading(video::SColor& color, float factor)
 	color.setGreen(core::clamp(core::round32(color.getGreen()*factor), 0, 255));
 }
 
+/*
+	MeshBufferPool
+*/
+
+// Buffers kept for reuse at most
+#define MESH_BUFFER_POOL_SIZE 1024
+// Time after which unused buffers are dropped
+#define MESH_BUFFER_POOL_KEEP_MS 10000
+
+MeshBufferPool::MeshBufferPool(video::IVideoDriver *driver):
+	m_refcount(1),
+	m_driver(driver)
+{
+}
+
+MeshBufferPool::~MeshBufferPool()
+{
+	for (u32 i = 0; i < m_free.size(); i++)
+		m_free[i].buf->drop();
+}
+
+scene::SMeshBufferTangents *MeshBufferPool::get()
+{
+	{
+		MutexAutoLock lock(m_mutex);
+		if (!m_free.empty()) {
+			scene::SMeshBufferTangents *buf = m_free.back().buf;
+			m_free.pop_back();
+			return buf;
+		}
+	}
+
+	scene::SMeshBufferTangents *buf = new scene::SMeshBufferTangents();
+	buf->setHardwareMappingHint(scene::EHM_STATIC);
+	return buf;
+}
+
+void MeshBufferPool::put(scene::SMeshBufferTangents *buf)
+{
+	// The hardware buffer holds a reference to the buffer that the driver
+	// may drop at any time, so it must be gone before a mesh making thread
+	// takes the buffer
+	if (m_driver)
+		m_driver->removeHardwareBuffer(buf);
+
+	// Keep the memory, but not what is in it
+	buf->Vertices.set_used(0);
+	buf->Indices.set_used(0);
+	buf->Material = video::SMaterial();
+
+	MutexAutoLock lock(m_mutex);
+	if (m_free.size() < MESH_BUFFER_POOL_SIZE) {
+		buf->grab();
+		FreeBuffer f;
+		f.buf = buf;
+		f.time_ms = porting::getTimeMs();
+		m_free.push_back(f);
+	}
+}
+
+void MeshBufferPool::trim()
+{
+	u32 now = porting::getTimeMs();
+	for (;;) {
+		scene::SMeshBufferTangents *buf;
+		{
+			MutexAutoLock lock(m_mutex);
+			if (m_free.empty() ||
+					now - m_free.front().time_ms < MESH_BUFFER_POOL_KEEP_MS)
+				return;
+			buf = m_free.front().buf;
+			m_free.pop_front();
+		}
+		buf->drop();
+	}
+}
+
 /*
 	MeshMakeData
 */
@@ -52,7 +132,8 @@ MeshMakeData::MeshMakeData(IGameDef *gamedef, bool use_shaders):
 	m_show_hud(false),
 	m_highlight_mesh_color(255, 255, 255, 255),
 	m_gamedef(gamedef),
-	m_use_shaders(use_shaders)
+	m_use_shaders(use_shaders),
+	m_buffer_pool(NULL)
 {}
 
 void MeshMakeData::fill(MapBlock *block)
@@ -149,6 +230,11 @@ void MeshMakeData::setSmoothLighting(bool smooth_lighting)
 	m_smooth_lighting = smooth_lighting;
 }
 
+void MeshMakeData::setBufferPool(MeshBufferPool *pool)
+{
+	m_buffer_pool = pool;
+}
+
 /*
 	Light and vertex color functions
 */
@@ -580,10 +666,15 @@ static void makeFastFace(TileSpec tile, u16 li0, u16 li1, u16 li2, u16 li3,
 		vertex_pos[i] += pos;
 	}
 
-	f32 abs_scale = 1.0;
-	if     (scale.X < 0.999 || scale.X > 1.001) abs_scale = scale.X;
-	else if(scale.Y < 0.999 || scale.Y > 1.001) abs_scale = scale.Y;
-	else if(scale.Z < 0.999 || scale.Z > 1.001) abs_scale = scale.Z;
+	/*
+		A face may stand for several nodes in both directions of its
+		plane; the texture is repeated once per node. The texture u axis
+		runs from corner 1 to corner 0, the v axis from corner 2 to 1.
+	*/
+	v3s16 u_dir = vertex_dirs[0] - vertex_dirs[1];
+	v3s16 v_dir = vertex_dirs[1] - vertex_dirs[2];
+	f32 u_scale = u_dir.X != 0 ? scale.X : u_dir.Y != 0 ? scale.Y : scale.Z;
+	f32 v_scale = v_dir.X != 0 ? scale.X : v_dir.Y != 0 ? scale.Y : scale.Z;
 
 	v3f normal(dir.X, dir.Y, dir.Z);
 
@@ -595,16 +686,16 @@ static void makeFastFace(TileSpec tile, u16 li0, u16 li1, u16 li2, u16 li3,
 
 	face.vertices[0] = video::S3DVertex(vertex_pos[0], normal,
 			MapBlock_LightColor(alpha, li0, light_source),
-			core::vector2d<f32>(x0+w*abs_scale, y0+h));
+			core::vector2d<f32>(x0+w*u_scale, y0+h*v_scale));
 	face.vertices[1] = video::S3DVertex(vertex_pos[1], normal,
 			MapBlock_LightColor(alpha, li1, light_source),
-			core::vector2d<f32>(x0, y0+h));
+			core::vector2d<f32>(x0, y0+h*v_scale));
 	face.vertices[2] = video::S3DVertex(vertex_pos[2], normal,
 			MapBlock_LightColor(alpha, li2, light_source),
 			core::vector2d<f32>(x0, y0));
 	face.vertices[3] = video::S3DVertex(vertex_pos[3], normal,
 			MapBlock_LightColor(alpha, li3, light_source),
-			core::vector2d<f32>(x0+w*abs_scale, y0));
+			core::vector2d<f32>(x0+w*u_scale, y0));
 
 	face.tile = tile;
 }
@@ -830,6 +921,94 @@ static void getTileInfo(
 }
 
 /*
+	A run of equal faces along a row, possibly extended over the
+	following rows of the same slice
+*/
+struct FastFaceRun
+{
+	u16 start; // Index of the first face in the row
+	u16 count; // Number of faces in the row
+	u16 rows;  // Number of rows
+	v3s16 p_corrected; // Of the first face
+	v3s16 face_dir_corrected;
+	u16 lights[4];
+	TileSpec tile;
+	u8 light_source;
+
+	FastFaceRun():
+		start(0),
+		count(0),
+		rows(1),
+		light_source(0)
+	{
+		lights[0] = lights[1] = lights[2] = lights[3] = 0;
+	}
+
+	// Whether the run of the next row continues this one
+	bool continuedBy(const FastFaceRun &next, v3s16 row_dir) const
+	{
+		return next.start == start
+				&& next.count == count
+				&& next.p_corrected == p_corrected + row_dir * rows
+				&& next.face_dir_corrected == face_dir_corrected
+				&& next.lights[0] == lights[0]
+				&& next.lights[1] == lights[1]
+				&& next.lights[2] == lights[2]
+				&& next.lights[3] == lights[3]
+				&& next.tile == tile
+				&& next.light_source == light_source;
+	}
+};
+
+/*
+	Whether a face of the tile may stand for several nodes along dir, a
+	direction in the plane of the face. Textures that are not tileable
+	along the texture axis of dir are clamped to the edge instead of
+	being repeated.
+*/
+static bool isTileableAlong(const TileSpec &tile, v3s16 face_dir, v3s16 dir)
+{
+	// See makeFastFace for the texture axes of an unrotated face
+	v3s16 vertex_dirs[4];
+	getNodeVertexDirs(face_dir, vertex_dirs);
+	v3s16 u_dir = vertex_dirs[0] - vertex_dirs[1];
+	bool along_u = (u_dir.X != 0 && dir.X != 0)
+			|| (u_dir.Y != 0 && dir.Y != 0)
+			|| (u_dir.Z != 0 && dir.Z != 0);
+	return (tile.material_flags & (along_u ?
+			MATERIAL_FLAG_TILEABLE_HORIZONTAL :
+			MATERIAL_FLAG_TILEABLE_VERTICAL)) != 0;
+}
+
+static void makeFastFaceRun(const FastFaceRun &run,
+		v3s16 translate_dir, v3s16 row_dir, std::vector<FastFace> &dest)
+{
+	// Center point of the face
+	v3f pf(run.p_corrected.X, run.p_corrected.Y, run.p_corrected.Z);
+	v3f sp = pf
+			+ intToFloat(translate_dir, 1) * ((run.count - 1) / 2.0)
+			+ intToFloat(row_dir, 1) * ((run.rows - 1) / 2.0);
+
+	v3f scale(1,1,1);
+	v3s16 extent = translate_dir * run.count + row_dir * run.rows;
+	if (translate_dir.X != 0 || row_dir.X != 0)
+		scale.X = extent.X;
+	if (translate_dir.Y != 0 || row_dir.Y != 0)
+		scale.Y = extent.Y;
+	if (translate_dir.Z != 0 || row_dir.Z != 0)
+		scale.Z = extent.Z;
+
+	makeFastFace(run.tile,
+			run.lights[0], run.lights[1], run.lights[2], run.lights[3],
+			sp, run.face_dir_corrected, scale, run.light_source, dest);
+
+	g_profiler->avg("Meshgen: faces drawn by tiling", 0);
+	for (u32 i = 1; i < (u32)run.count * run.rows; i++)
+		g_profiler->avg("Meshgen: faces drawn by tiling", 1);
+}
+
+/*
+	Finds the runs of equal faces in a row.
 	startpos:
 	translate_dir: unit vector with only one of x, y or z
 	face_dir: unit vector with only one of x, y or z
@@ -838,158 +1017,131 @@ static void updateFastFaceRow(
 		MeshMakeData *data,
 		v3s16 startpos,
 		v3s16 translate_dir,
-		v3f translate_dir_f,
 		v3s16 face_dir,
-		v3f face_dir_f,
-		std::vector<FastFace> &dest)
+		std::vector<FastFaceRun> &runs)
 {
 	v3s16 p = startpos;
 
-	u16 continuous_tiles_count = 0;
-
+	FastFaceRun run;
 	bool makes_face = false;
-	v3s16 p_corrected;
-	v3s16 face_dir_corrected;
-	u16 lights[4] = {0,0,0,0};
-	TileSpec tile;
-	u8 light_source = 0;
 	getTileInfo(data, p, face_dir,
-			makes_face, p_corrected, face_dir_corrected,
-			lights, tile, light_source);
+			makes_face, run.p_corrected, run.face_dir_corrected,
+			run.lights, run.tile, run.light_source);
 
 	for(u16 j=0; j<MAP_BLOCKSIZE; j++)
 	{
 		// If tiling can be done, this is set to false in the next step
 		bool next_is_different = true;
 
-		v3s16 p_next;
-
 		bool next_makes_face = false;
-		v3s16 next_p_corrected;
-		v3s16 next_face_dir_corrected;
-		u16 next_lights[4] = {0,0,0,0};
-		TileSpec next_tile;
-		u8 next_light_source = 0;
+		FastFaceRun next;
+		next.start = j + 1;
+
+		run.count++;
 
 		// If at last position, there is nothing to compare to and
 		// the face must be drawn anyway
 		if(j != MAP_BLOCKSIZE - 1)
 		{
-			p_next = p + translate_dir;
+			p += translate_dir;
 
-			getTileInfo(data, p_next, face_dir,
-					next_makes_face, next_p_corrected,
-					next_face_dir_corrected, next_lights,
-					next_tile, next_light_source);
+			getTileInfo(data, p, face_dir,
+					next_makes_face, next.p_corrected,
+					next.face_dir_corrected, next.lights,
+					next.tile, next.light_source);
 
+			// Rotated textures can't be repeated over several nodes,
+			// nor ones that are not tileable in this direction
 			if(next_makes_face == makes_face
-					&& next_p_corrected == p_corrected + translate_dir
-					&& next_face_dir_corrected == face_dir_corrected
-					&& next_lights[0] == lights[0]
-					&& next_lights[1] == lights[1]
-					&& next_lights[2] == lights[2]
-					&& next_lights[3] == lights[3]
-					&& next_tile == tile
-					&& tile.rotation == 0
-					&& next_light_source == light_source)
+					&& next.p_corrected == run.p_corrected
+						+ translate_dir * run.count
+					&& next.face_dir_corrected == run.face_dir_corrected
+					&& next.lights[0] == run.lights[0]
+					&& next.lights[1] == run.lights[1]
+					&& next.lights[2] == run.lights[2]
+					&& next.lights[3] == run.lights[3]
+					&& next.tile == run.tile
+					&& run.tile.rotation == 0
+					&& isTileableAlong(run.tile,
+						run.face_dir_corrected, translate_dir)
+					&& next.light_source == run.light_source)
 			{
 				next_is_different = false;
 			}
-			else{
-				/*if(makes_face){
-					g_profiler->add("Meshgen: diff: next_makes_face != makes_face",
-							next_makes_face != makes_face ? 1 : 0);
-					g_profiler->add("Meshgen: diff: n_p_corr != p_corr + t_dir",
-							(next_p_corrected != p_corrected + translate_dir) ? 1 : 0);
-					g_profiler->add("Meshgen: diff: next_f_dir_corr != f_dir_corr",
-							next_face_dir_corrected != face_dir_corrected ? 1 : 0);
-					g_profiler->add("Meshgen: diff: next_lights[] != lights[]",
-							(next_lights[0] != lights[0] ||
-							next_lights[0] != lights[0] ||
-							next_lights[0] != lights[0] ||
-							next_lights[0] != lights[0]) ? 1 : 0);
-					g_profiler->add("Meshgen: diff: !(next_tile == tile)",
-							!(next_tile == tile) ? 1 : 0);
-				}*/
-			}
-			/*g_profiler->add("Meshgen: Total faces checked", 1);
-			if(makes_face)
-				g_profiler->add("Meshgen: Total makes_face checked", 1);*/
-		} else {
-			/*if(makes_face)
-				g_profiler->add("Meshgen: diff: last position", 1);*/
 		}
 
-		continuous_tiles_count++;
-
 		if(next_is_different)
 		{
-			/*
-				Create a face if there should be one
-			*/
 			if(makes_face)
-			{
-				// Floating point conversion of the position vector
-				v3f pf(p_corrected.X, p_corrected.Y, p_corrected.Z);
-				// Center point of face (kind of)
-				v3f sp = pf - ((f32)continuous_tiles_count / 2.0 - 0.5) * translate_dir_f;
-				if(continuous_tiles_count != 1)
-					sp += translate_dir_f;
-				v3f scale(1,1,1);
-
-				if(translate_dir.X != 0) {
-					scale.X = continuous_tiles_count;
-				}
-				if(translate_dir.Y != 0) {
-					scale.Y = continuous_tiles_count;
-				}
-				if(translate_dir.Z != 0) {
-					scale.Z = continuous_tiles_count;
-				}
+				runs.push_back(run);
+			run = next;
+			makes_face = next_makes_face;
+		}
+	}
+}
 
-				makeFastFace(tile, lights[0], lights[1], lights[2], lights[3],
-						sp, face_dir_corrected, scale, light_source,
-						dest);
+/*
+	Makes the faces of a slice of the block from the runs of its rows,
+	given in order of row_dir. With greedy meshing, runs that cover the
+	same span of consecutive rows are joined into one face.
+*/
+static void makeFastFaceSlice(
+		const std::vector<std::vector<FastFaceRun> > &rows,
+		v3s16 translate_dir, v3s16 row_dir, bool greedy,
+		std::vector<FastFace> &dest)
+{
+	// Runs that may still be continued by the next row
+	std::vector<FastFaceRun> open;
+	std::vector<FastFaceRun> still_open;
 
-				g_profiler->avg("Meshgen: faces drawn by tiling", 0);
-				for(int i = 1; i < continuous_tiles_count; i++){
-					g_profiler->avg("Meshgen: faces drawn by tiling", 1);
-				}
+	for(u32 r = 0; r < rows.size(); r++)
+	{
+		const std::vector<FastFaceRun> &row = rows[r];
+		still_open.clear();
+		u32 k = 0;
+		for(u32 i = 0; i < row.size(); i++)
+		{
+			const FastFaceRun &run = row[i];
+			// Both lists are sorted by start
+			while(k < open.size() && open[k].start < run.start)
+				makeFastFaceRun(open[k++], translate_dir, row_dir, dest);
+			if(greedy && k < open.size() && run.tile.rotation == 0
+					&& open[k].continuedBy(run, row_dir)
+					&& isTileableAlong(run.tile,
+						run.face_dir_corrected, row_dir)) {
+				still_open.push_back(open[k++]);
+				still_open.back().rows++;
+			} else {
+				still_open.push_back(run);
 			}
-
-			continuous_tiles_count = 0;
-
-			makes_face = next_makes_face;
-			p_corrected = next_p_corrected;
-			face_dir_corrected = next_face_dir_corrected;
-			lights[0] = next_lights[0];
-			lights[1] = next_lights[1];
-			lights[2] = next_lights[2];
-			lights[3] = next_lights[3];
-			tile = next_tile;
-			light_source = next_light_source;
 		}
-
-		p = p_next;
+		while(k < open.size())
+			makeFastFaceRun(open[k++], translate_dir, row_dir, dest);
+		open.swap(still_open);
 	}
+
+	for(u32 k = 0; k < open.size(); k++)
+		makeFastFaceRun(open[k], translate_dir, row_dir, dest);
 }
 
-static void updateAllFastFaceRows(MeshMakeData *data,
+static void updateAllFastFaceRows(MeshMakeData *data, bool greedy,
 		std::vector<FastFace> &dest)
 {
+	std::vector<std::vector<FastFaceRun> > rows(MAP_BLOCKSIZE);
+
 	/*
 		Go through every y,z and get top(y+) faces in rows of x+
 	*/
 	for(s16 y = 0; y < MAP_BLOCKSIZE; y++) {
 		for(s16 z = 0; z < MAP_BLOCKSIZE; z++) {
+			rows[z].clear();
 			updateFastFaceRow(data,
 					v3s16(0,y,z),
 					v3s16(1,0,0), //dir
-					v3f  (1,0,0),
 					v3s16(0,1,0), //face dir
-					v3f  (0,1,0),
-					dest);
+					rows[z]);
 		}
+		makeFastFaceSlice(rows, v3s16(1,0,0), v3s16(0,0,1), greedy, dest);
 	}
 
 	/*
@@ -997,14 +1149,14 @@ static void updateAllFastFaceRows(MeshMakeData *data,
 	*/
 	for(s16 x = 0; x < MAP_BLOCKSIZE; x++) {
 		for(s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+			rows[y].clear();
 			updateFastFaceRow(data,
 					v3s16(x,y,0),
 					v3s16(0,0,1), //dir
-					v3f  (0,0,1),
 					v3s16(1,0,0), //face dir
-					v3f  (1,0,0),
-					dest);
+					rows[y]);
 		}
+		makeFastFaceSlice(rows, v3s16(0,0,1), v3s16(0,1,0), greedy, dest);
 	}
 
 	/*
@@ -1012,14 +1164,14 @@ static void updateAllFastFaceRows(MeshMakeData *data,
 	*/
 	for(s16 z = 0; z < MAP_BLOCKSIZE; z++) {
 		for(s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+			rows[y].clear();
 			updateFastFaceRow(data,
 					v3s16(0,y,z),
 					v3s16(1,0,0), //dir
-					v3f  (1,0,0),
 					v3s16(0,0,1), //face dir
-					v3f  (0,0,1),
-					dest);
+					rows[y]);
 		}
+		makeFastFaceSlice(rows, v3s16(1,0,0), v3s16(0,1,0), greedy, dest);
 	}
 }
 
@@ -1027,12 +1179,17 @@ static void updateAllFastFaceRows(MeshMakeData *data,
 	MapBlockMesh
 */
 
+// Last version given to a MapBlockMesh
+static Atomic<u32> g_last_mesh_version(0);
+
 MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
+	m_version(++g_last_mesh_version),
 	m_mesh(new scene::SMesh()),
 	m_minimap_mapblock(NULL),
 	m_gamedef(data->m_gamedef),
 	m_tsrc(m_gamedef->getTextureSource()),
 	m_shdrsrc(m_gamedef->getShaderSource()),
+	m_buffer_pool(data->m_buffer_pool),
 	m_animation_force_timer(0), // force initial animation
 	m_last_crack(-1),
 	m_crack_materials(),
@@ -1040,6 +1197,10 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 	m_last_daynight_ratio((u32) -1),
 	m_daynight_diffs()
 {
+	// The buffers go back to the pool when the mesh is deleted
+	if (m_buffer_pool)
+		m_buffer_pool->grab();
+
 	m_enable_shaders = data->m_use_shaders;
 	m_enable_highlighting = g_settings->getBool("enable_node_highlighting");
 
@@ -1066,7 +1227,9 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 	{
 		// 4-23ms for MAP_BLOCKSIZE=16  (NOTE: probably outdated)
 		//TimeTaker timer2("updateAllFastFaceRows()");
-		updateAllFastFaceRows(data, fastfaces_new);
+		updateAllFastFaceRows(data,
+				g_settings->getBool("enable_greedy_meshing"),
+				fastfaces_new);
 	}
 	// End of slow part
 
@@ -1221,15 +1384,29 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 		}
 
 	// Create meshbuffer
-	scene::SMeshBufferTangents *buf = new scene::SMeshBufferTangents();
+	scene::SMeshBufferTangents *buf;
+	if (m_buffer_pool) {
+		buf = m_buffer_pool->get();
+		// Copy without shrinking the memory of a reused buffer
+		buf->Vertices.set_used(p.vertices.size());
+		for (u32 j = 0; j < p.vertices.size(); j++)
+			buf->Vertices[j] = p.vertices[j];
+		buf->Indices.set_used(p.indices.size());
+		for (u32 j = 0; j < p.indices.size(); j++)
+			buf->Indices[j] = p.indices[j];
+		buf->recalculateBoundingBox();
+		buf->setDirty();
+	} else {
+		buf = new scene::SMeshBufferTangents();
+		buf->append(&p.vertices[0], p.vertices.size(),
+			&p.indices[0], p.indices.size());
+	}
 	// Set material
 	buf->Material = material;
 	// Add to mesh
 	m_mesh->addMeshBuffer(buf);
 	// Mesh grabbed it
 	buf->drop();
-	buf->append(&p.vertices[0], p.vertices.size(),
-		&p.indices[0], p.indices.size());
 }
 	m_camera_offset = camera_offset;
 
@@ -1253,15 +1430,10 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 				<<" materials (meshbuffers)"<<std::endl;
 #endif
 
-		// Use VBO for mesh (this just would set this for ever buffer)
-		// This will lead to infinite memory usage because or irrlicht.
-		//m_mesh->setHardwareMappingHint(scene::EHM_STATIC);
-
-		/*
-			NOTE: If that is enabled, some kind of a queue to the main
-			thread should be made which would call irrlicht to delete
-			the hardware buffer and then delete the mesh
-		*/
+		// Buffers from the pool are stored in hardware buffers, which
+		// the pool removes on the main thread when they are returned.
+		// Others are not, as irrlicht would keep their hardware buffers
+		// for ever.
 	}
 
 	//std::cout<<"added "<<fastfaces.getSize()<<" faces."<<std::endl;
@@ -1276,11 +1448,36 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 
 MapBlockMesh::~MapBlockMesh()
 {
+	if (m_buffer_pool) {
+		for (u32 i = 0; i < m_mesh->getMeshBufferCount(); i++)
+			m_buffer_pool->put((scene::SMeshBufferTangents *)
+					m_mesh->getMeshBuffer(i));
+		m_buffer_pool->drop();
+	}
 	m_mesh->drop();
 	m_mesh = NULL;
 	delete m_minimap_mapblock;
 }
 
+bool MapBlockMesh::isStaticBuffer(u32 i) const
+{
+	if (m_crack_materials.find(i) != m_crack_materials.end() ||
+			m_animation_tiles.find(i) != m_animation_tiles.end())
+		return false;
+	return std::find(m_highlighted_materials.begin(),
+			m_highlighted_materials.end(), i) == m_highlighted_materials.end();
+}
+
+const std::map<u32, std::pair<u8, u8> > *MapBlockMesh::getDayNightDiffs(
+		u32 i) const
+{
+	std::map<u32, std::map<u32, std::pair<u8, u8> > >::const_iterator
+			it = m_daynight_diffs.find(i);
+	if (it == m_daynight_diffs.end())
+		return NULL;
+	return &it->second;
+}
+
 bool MapBlockMesh::animate(bool faraway, float time, int crack, u32 daynight_ratio)
 {
 	if(!m_has_animation)
@@ -1370,6 +1567,7 @@ bool MapBlockMesh::animate(bool faraway, float time, int crack, u32 daynight_rat
 				u8 night = j->second.second;
 				finalColorBlend(vertices[j->first].Color, day, night, daynight_ratio);
 			}
+			buf->setDirty(scene::EBT_VERTEX);
 		}
 		m_last_daynight_ratio = daynight_ratio;
 	}
@@ -1395,6 +1593,7 @@ bool MapBlockMesh::animate(bool faraway, float time, int crack, u32 daynight_rat
 			video::S3DVertexTangents *vertices = (video::S3DVertexTangents*)buf->getVertices();
 			for (u32 j = 0; j < buf->getVertexCount() ;j++)
 				vertices[j].Color = hc;
+			buf->setDirty(scene::EBT_VERTEX);
 		}
 	}
 
@@ -1405,7 +1604,9 @@ void MapBlockMesh::updateCameraOffset(v3s16 camera_offset)
 {
 	if (camera_offset != m_camera_offset) {
 		translateMesh(m_mesh, intToFloat(m_camera_offset-camera_offset, BS));
+		m_mesh->setDirty(scene::EBT_VERTEX);
 		m_camera_offset = camera_offset;
+		m_version = ++g_last_mesh_version;
 	}
 }
 
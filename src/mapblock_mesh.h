@@ -23,7 +23,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes_extrabloated.h"
 #include "client/tile.h"
 #include "voxel.h"
+#include "threading/atomic.h"
+#include "threading/mutex.h"
 #include <map>
+#include <deque>
 
 class IGameDef;
 class IShaderSource;
@@ -36,6 +39,58 @@ class IShaderSource;
 class MapBlock;
 struct MinimapMapblock;
 
+/*
+	Keeps the mesh buffers of deleted map block meshes for reuse by new
+	ones, so that their memory does not have to be allocated again on every
+	update of a block.
+
+	Buffers are taken by the mesh making threads and returned by the main
+	thread. Their hardware buffers are removed when they are returned, as
+	irrlicht may drop those on the main thread at any time, which must not
+	happen while a mesh making thread uses the buffer.
+
+	The pool is reference counted, as the meshes return their buffers when
+	they are deleted and the scene may keep them after the client is gone.
+	The last reference must be dropped by the main thread.
+*/
+class MeshBufferPool
+{
+public:
+	// The creator gets one reference
+	MeshBufferPool(video::IVideoDriver *driver);
+
+	void grab() { ++m_refcount; }
+	void drop()
+	{
+		if (--m_refcount == 0)
+			delete this;
+	}
+
+	// Returns an empty buffer meant to be stored in a hardware buffer.
+	// The caller gets one reference.
+	scene::SMeshBufferTangents *get();
+	// Takes a reference of the buffer and removes its hardware buffer.
+	// Shall be called from the main thread.
+	void put(scene::SMeshBufferTangents *buf);
+	// Drops the buffers that have not been reused for a while
+	void trim();
+
+private:
+	struct FreeBuffer
+	{
+		scene::SMeshBufferTangents *buf;
+		u32 time_ms;
+	};
+
+	~MeshBufferPool();
+
+	Atomic<u32> m_refcount;
+	video::IVideoDriver *m_driver;
+	// Oldest first
+	std::deque<FreeBuffer> m_free;
+	Mutex m_mutex;
+};
+
 struct MeshMakeData
 {
 	VoxelManipulator m_vmanip;
@@ -48,6 +103,7 @@ struct MeshMakeData
 
 	IGameDef *m_gamedef;
 	bool m_use_shaders;
+	MeshBufferPool *m_buffer_pool;
 
 	MeshMakeData(IGameDef *gamedef, bool use_shaders);
 
@@ -76,6 +132,12 @@ struct MeshMakeData
 		Enable or disable smooth lighting
 	*/
 	void setSmoothLighting(bool smooth_lighting);
+
+	/*
+		Take the mesh buffers from a pool. Without one, the mesh is not
+		stored in hardware buffers.
+	*/
+	void setBufferPool(MeshBufferPool *pool);
 };
 
 /*
@@ -109,6 +171,22 @@ class MapBlockMesh
 		return m_mesh;
 	}
 
+	// Unique among all meshes ever made, and changed whenever the
+	// vertices are moved, for noticing changes of the static buffers
+	u32 getVersion() const
+	{
+		return m_version;
+	}
+
+	// Whether animate() changes nothing of the mesh buffer but maybe the
+	// vertex colours of getDayNightDiffs(), so that it can be copied
+	// elsewhere
+	bool isStaticBuffer(u32 i) const;
+
+	// The (day, night) light of the vertices of the mesh buffer whose
+	// colour depends on the day/night ratio, or NULL if there are none
+	const std::map<u32, std::pair<u8, u8> > *getDayNightDiffs(u32 i) const;
+
 	MinimapMapblock *moveMinimapMapblock()
 	{
 		MinimapMapblock *p = m_minimap_mapblock;
@@ -130,11 +208,14 @@ class MapBlockMesh
 	void updateCameraOffset(v3s16 camera_offset);
 
 private:
+	u32 m_version;
 	scene::SMesh *m_mesh;
 	MinimapMapblock *m_minimap_mapblock;
 	IGameDef *m_gamedef;
 	ITextureSource *m_tsrc;
 	IShaderSource *m_shdrsrc;
+	// Where the mesh buffers go back to, if anywhere
+	MeshBufferPool *m_buffer_pool;
 
 	bool m_enable_shaders;
 	bool m_enable_highlighting;
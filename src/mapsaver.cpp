@@ -0,0 +1,329 @@
+/*
+Minetest
+Copyright (C) 2026 agent <agent@local>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapsaver.h"
+#include <set>
+#include <sstream>
+#include "database.h"
+#include "mapblock.h"
+#include "log.h"
+#include "profiler.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/thread.h"
+
+class CompressJob : public WorkerPool::Job
+{
+public:
+	CompressJob(const MapBlockSnapshot *snapshot) :
+		m_snapshot(snapshot)
+	{}
+
+	void run()
+	{
+		std::ostringstream os(std::ios_base::binary);
+		os.write((const char *)&m_snapshot->version, 1);
+		m_snapshot->serialize(os);
+		data = os.str();
+	}
+
+	std::string data;
+
+private:
+	const MapBlockSnapshot *m_snapshot;
+};
+
+
+MapSaver::MapSaver(Database *db, u32 num_threads) :
+	Thread("MapSaver"),
+	m_db(db),
+	m_workers(new WorkerPool("MapSaver", num_threads)),
+	m_sync_waiters(0)
+{
+	start();
+}
+
+
+MapSaver::~MapSaver()
+{
+	// run() writes the rest before returning
+	stop();
+	m_flush_sem.post();
+	wait();
+
+	for (std::map<v3s16, MapBlockSnapshot *>::iterator
+			it = m_failed.begin(); it != m_failed.end(); ++it) {
+		errorstream << "MapSaver: Giving up on block "
+			<< PP(it->first) << std::endl;
+		delete it->second;
+	}
+
+	delete m_workers;
+}
+
+
+void MapSaver::saveBlock(MapBlockSnapshot *snapshot)
+{
+	MutexAutoLock lock(m_queue_mutex);
+
+	std::pair<std::map<v3s16, MapBlockSnapshot *>::iterator, bool> res =
+		m_queued.insert(std::make_pair(snapshot->pos, snapshot));
+	if (!res.second) {
+		delete res.first->second;
+		res.first->second = snapshot;
+	}
+}
+
+
+void MapSaver::deleteBlock(v3s16 pos)
+{
+	MutexAutoLock lock(m_queue_mutex);
+
+	std::map<v3s16, MapBlockSnapshot *>::iterator it = m_queued.find(pos);
+	if (it != m_queued.end()) {
+		delete it->second;
+		it->second = NULL;
+	} else {
+		m_queued[pos] = NULL;
+	}
+}
+
+
+void MapSaver::flush()
+{
+	m_flush_sem.post();
+}
+
+
+void MapSaver::sync()
+{
+	for (;;) {
+		{
+			MutexAutoLock lock(m_queue_mutex);
+			if (m_queued.empty() && m_writing.empty())
+				return;
+			m_sync_waiters++;
+		}
+		flush();
+		m_sync_sem.wait();
+	}
+}
+
+
+std::string MapSaver::loadBlock(v3s16 pos)
+{
+	MapBlockSnapshot snapshot;
+	bool queued = false;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+
+		MapBlockSnapshot *found;
+		if (findQueued(pos, &found)) {
+			if (found == NULL)
+				return "";
+			snapshot = *found;
+			queued = true;
+		}
+	}
+
+	if (queued) {
+		// Not in the database yet, serialize the copy here
+		CompressJob job(&snapshot);
+		job.run();
+		return job.data;
+	}
+
+	MutexAutoLock lock(m_db_mutex);
+	return m_db->loadBlock(pos);
+}
+
+
+void MapSaver::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> &blocks)
+{
+	blocks.clear();
+	blocks.resize(positions.size());
+
+	// Positions (and their indices) that have to come from the database
+	std::vector<v3s16> db_positions;
+	std::vector<size_t> db_indices;
+	std::vector<std::pair<size_t, MapBlockSnapshot> > snapshots;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+
+		for (size_t i = 0; i < positions.size(); i++) {
+			MapBlockSnapshot *found;
+			if (!findQueued(positions[i], &found)) {
+				db_positions.push_back(positions[i]);
+				db_indices.push_back(i);
+			} else if (found != NULL) {
+				snapshots.push_back(std::make_pair(i, *found));
+			}
+		}
+	}
+
+	for (size_t i = 0; i < snapshots.size(); i++) {
+		CompressJob job(&snapshots[i].second);
+		job.run();
+		blocks[snapshots[i].first] = job.data;
+	}
+
+	if (db_positions.empty())
+		return;
+
+	std::vector<std::string> db_blocks;
+	{
+		MutexAutoLock lock(m_db_mutex);
+		m_db->loadBlocks(db_positions, db_blocks);
+	}
+	for (size_t i = 0; i < db_indices.size(); i++)
+		blocks[db_indices[i]].swap(db_blocks[i]);
+}
+
+
+void MapSaver::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	sync();
+
+	MutexAutoLock lock(m_db_mutex);
+	m_db->listAllLoadableBlocks(dst);
+}
+
+
+bool MapSaver::findQueued(v3s16 pos, MapBlockSnapshot **snapshot)
+{
+	// From the newest to the oldest
+	std::map<v3s16, MapBlockSnapshot *> *maps[] =
+		{&m_queued, &m_writing, &m_failed};
+	for (size_t i = 0; i < 3; i++) {
+		std::map<v3s16, MapBlockSnapshot *>::iterator it =
+			maps[i]->find(pos);
+		if (it != maps[i]->end()) {
+			*snapshot = it->second;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void *MapSaver::run()
+{
+	DSTACK(FUNCTION_NAME);
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (!stopRequested()) {
+		m_flush_sem.wait();
+		// Several flushes are handled at once
+		while (m_flush_sem.wait(0));
+
+		writeQueued();
+	}
+
+	writeQueued();
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return NULL;
+}
+
+
+void MapSaver::writeQueued()
+{
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_writing.swap(m_queued);
+
+		// Try the blocks that failed before again, unless there is a
+		// newer version
+		for (std::map<v3s16, MapBlockSnapshot *>::iterator
+				it = m_failed.begin(); it != m_failed.end(); ++it) {
+			if (!m_writing.insert(*it).second)
+				delete it->second;
+		}
+		m_failed.clear();
+	}
+
+	if (!m_writing.empty()) {
+		ScopeProfiler sp(g_profiler, "MapSaver: write blocks", SPT_AVG);
+
+		std::vector<CompressJob *> jobs;
+		std::vector<WorkerPool::Job *> job_ptrs;
+		for (std::map<v3s16, MapBlockSnapshot *>::iterator
+				it = m_writing.begin(); it != m_writing.end(); ++it) {
+			if (it->second == NULL)
+				continue;
+			CompressJob *job = new CompressJob(it->second);
+			jobs.push_back(job);
+			job_ptrs.push_back(job);
+		}
+		m_workers->run(job_ptrs);
+
+		u32 saved = 0;
+		std::set<v3s16> failed;
+		{
+			MutexAutoLock lock(m_db_mutex);
+
+			m_db->beginSave();
+			size_t i = 0;
+			for (std::map<v3s16, MapBlockSnapshot *>::iterator
+					it = m_writing.begin(); it != m_writing.end(); ++it) {
+				if (it->second == NULL) {
+					if (!m_db->deleteBlock(it->first)) {
+						errorstream << "MapSaver: Failed to delete block "
+							<< PP(it->first) << std::endl;
+						failed.insert(it->first);
+					}
+					continue;
+				}
+				if (m_db->saveBlock(it->first, jobs[i++]->data)) {
+					saved++;
+				} else {
+					errorstream << "MapSaver: Failed to write block "
+						<< PP(it->first) << std::endl;
+					failed.insert(it->first);
+				}
+			}
+			m_db->endSave();
+		}
+
+		verbosestream << "MapSaver: Wrote " << saved << " blocks"
+			<< std::endl;
+
+		for (size_t i = 0; i < jobs.size(); i++)
+			delete jobs[i];
+
+		// The blocks have been reset to unmodified when they were queued,
+		// so keep the ones that failed for the next flush
+		MutexAutoLock lock(m_queue_mutex);
+		for (std::map<v3s16, MapBlockSnapshot *>::iterator
+				it = m_writing.begin(); it != m_writing.end(); ++it) {
+			if (failed.find(it->first) != failed.end())
+				m_failed.insert(*it);
+			else
+				delete it->second;
+		}
+		m_writing.clear();
+	}
+
+	MutexAutoLock lock(m_queue_mutex);
+	if (m_sync_waiters > 0) {
+		m_sync_sem.post(m_sync_waiters);
+		m_sync_waiters = 0;
+	}
+}
@@ -0,0 +1,94 @@
+/*
+Minetest
+Copyright (C) 2026 agent <agent@local>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAPSAVER_HEADER
+#define MAPSAVER_HEADER
+
+#include <map>
+#include <string>
+#include <vector>
+#include "irr_v3d.h"
+#include "threading/thread.h"
+#include "threading/mutex.h"
+#include "threading/semaphore.h"
+
+class Database;
+class WorkerPool;
+struct MapBlockSnapshot;
+
+/*
+	Writes map blocks to the database in the background.
+
+	Blocks are queued as snapshots made under the environment lock.
+	On flush() they are compressed by a pool of worker threads and then
+	written by the saver thread in a single transaction. Blocks that fail
+	to be written are kept and tried again with the next flush.
+
+	All other access to the database has to go through here as well, so
+	that it is serialized with the writes and sees the blocks that are
+	still queued.
+*/
+class MapSaver : public Thread
+{
+public:
+	MapSaver(Database *db, u32 num_threads);
+	// Writes out everything still queued
+	~MapSaver();
+
+	// Takes ownership of snapshot. Replaces an earlier queued version.
+	void saveBlock(MapBlockSnapshot *snapshot);
+	void deleteBlock(v3s16 pos);
+
+	// Starts writing the queued blocks
+	void flush();
+	// Returns when the blocks queued so far have been written, or failed
+	// to be written
+	void sync();
+
+	std::string loadBlock(v3s16 pos);
+	// Same as Database::loadBlocks
+	void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &blocks);
+	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+
+	void *run();
+
+private:
+	// Finds the newest version of a block that is not in the database
+	// yet, NULL for a deletion. Requires m_queue_mutex.
+	bool findQueued(v3s16 pos, MapBlockSnapshot **snapshot);
+	void writeQueued();
+
+	Database *m_db;
+	Mutex m_db_mutex;
+	WorkerPool *m_workers;
+
+	// NULL snapshots are deletions
+	Mutex m_queue_mutex;
+	std::map<v3s16, MapBlockSnapshot *> m_queued;
+	std::map<v3s16, MapBlockSnapshot *> m_writing;
+	// Blocks that could not be written, tried again with the next flush
+	std::map<v3s16, MapBlockSnapshot *> m_failed;
+
+	Semaphore m_flush_sem;
+	Semaphore m_sync_sem;
+	u32 m_sync_waiters;
+};
+
+#endif
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapsector.h"
 #include "exceptions.h"
+#include "map.h"
 #include "mapblock.h"
 #include "serialization.h"
 
@@ -45,6 +46,7 @@ void MapSector::deleteBlocks()
 	for(std::map<s16, MapBlock*>::iterator i = m_blocks.begin();
 		i != m_blocks.end(); ++i)
 	{
+		m_parent->removeBlockFromIndex(i->second->getPos());
 		delete i->second;
 	}
 
@@ -83,6 +85,14 @@ MapBlock * MapSector::getBlockNoCreateNoEx(s16 y)
 	return getBlockBuffered(y);
 }
 
+MapBlock * MapSector::getBlockNoCreateNoExNoCache(s16 y) const
+{
+	std::map<s16, MapBlock*>::const_iterator n = m_blocks.find(y);
+	if(n == m_blocks.end())
+		return NULL;
+	return n->second;
+}
+
 MapBlock * MapSector::createBlankBlockNoInsert(s16 y)
 {
 	assert(getBlockBuffered(y) == NULL);	// Pre-condition
@@ -99,6 +109,7 @@ MapBlock * MapSector::createBlankBlock(s16 y)
 	MapBlock *block = createBlankBlockNoInsert(y);
 
 	m_blocks[y] = block;
+	m_parent->addBlockToIndex(block);
 
 	return block;
 }
@@ -117,6 +128,7 @@ void MapSector::insertBlock(MapBlock *block)
 
 	// Insert into container
 	m_blocks[block_y] = block;
+	m_parent->addBlockToIndex(block);
 }
 
 void MapSector::deleteBlock(MapBlock *block)
@@ -128,6 +140,7 @@ void MapSector::deleteBlock(MapBlock *block)
 
 	// Remove from container
 	m_blocks.erase(block_y);
+	m_parent->removeBlockFromIndex(block->getPos());
 
 	// Delete
 	delete block;
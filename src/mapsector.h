@@ -54,6 +54,8 @@ class MapSector
 	}
 
 	MapBlock * getBlockNoCreateNoEx(s16 y);
+	// Doesn't update the block cache, see Map::getBlockNoCreateNoExNoCache()
+	MapBlock * getBlockNoCreateNoExNoCache(s16 y) const;
 	MapBlock * createBlankBlockNoInsert(s16 y);
 	MapBlock * createBlankBlock(s16 y);
 
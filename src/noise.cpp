@@ -26,6 +26,7 @@
 #include <math.h>
 #include "noise.h"
 #include <iostream>
+#include <algorithm> // std::swap
 #include <string.h> // memset
 #include "debug.h"
 #include "util/numeric.h"
@@ -37,14 +38,10 @@
 #define NOISE_MAGIC_Z    52591
 #define NOISE_MAGIC_SEED 1013
 
-typedef float (*Interp2dFxn)(
-		float v00, float v10, float v01, float v11,
-		float x, float y);
-
-typedef float (*Interp3dFxn)(
-		float v000, float v100, float v010, float v110,
-		float v001, float v101, float v011, float v111,
-		float x, float y, float z);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define NOISE_SIMD_X86
+	#include <immintrin.h>
+#endif
 
 float cos_lookup[16] = {
 	1.0,  0.9238,  0.7071,  0.3826, 0, -0.3826, -0.7071, -0.9238,
@@ -156,23 +153,26 @@ s32 PcgRandom::randNormalDist(s32 min, s32 max, int num_trials)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// The hash is done on unsigned ints, as the multiplications are meant to
+// wrap around; signed overflow let compilers produce values outside -1...1
 float noise2d(int x, int y, int seed)
 {
-	int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
+	u32 n = ((u32)NOISE_MAGIC_X * x + (u32)NOISE_MAGIC_Y * y
+			+ (u32)NOISE_MAGIC_SEED * seed) & 0x7fffffff;
 	n = (n >> 13) ^ n;
 	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
-	return 1.f - (float)n / 0x40000000;
+	return 1.f - (float)(s32)n / 0x40000000;
 }
 
 
 float noise3d(int x, int y, int z, int seed)
 {
-	int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
+	u32 n = ((u32)NOISE_MAGIC_X * x + (u32)NOISE_MAGIC_Y * y
+			+ (u32)NOISE_MAGIC_Z * z + (u32)NOISE_MAGIC_SEED * seed)
+			& 0x7fffffff;
 	n = (n >> 13) ^ n;
 	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
-	return 1.f - (float)n / 0x40000000;
+	return 1.f - (float)(s32)n / 0x40000000;
 }
 
 
@@ -416,6 +416,487 @@ float NoisePerlin3D(NoiseParams *np, float x, float y, float z, int seed)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+	Kernels of the noise map functions.
+
+	The vectorized variants do the same float operations in the same order
+	as the scalar ones, so the results don't depend on the variant used.
+*/
+
+struct NoiseKernels {
+	// out[i] = noise2d(x0 + i, y, seed)
+	void (*noise2dRow)(float *out, int x0, int y, int seed, size_t n);
+	// out[i] = noise3d(x0 + i, y, z, seed)
+	void (*noise3dRow)(float *out, int x0, int y, int z, int seed, size_t n);
+	// out[i] = linearInterpolation(a[i], b[i], t)
+	void (*lerp)(float *out, const float *a, const float *b,
+		float t, size_t n);
+	// out[i] = linearInterpolation(linearInterpolation(a[i], b[i], t1),
+	//	linearInterpolation(c[i], d[i], t1), t2)
+	void (*lerp2)(float *out, const float *a, const float *b,
+		const float *c, const float *d, float t1, float t2, size_t n);
+	// result[i] += g * gradient[i], or its absolute value
+	void (*addScaled)(float *result, const float *gradient,
+		float g, size_t n);
+	void (*addScaledAbs)(float *result, const float *gradient,
+		float g, size_t n);
+	// result[i] += gmap[i] * gradient[i], or its absolute value;
+	// gmap[i] *= persistence_map[i]
+	void (*addWeighted)(float *result, float *gmap, const float *gradient,
+		const float *persistence_map, size_t n);
+	void (*addWeightedAbs)(float *result, float *gmap, const float *gradient,
+		const float *persistence_map, size_t n);
+};
+
+
+static void noise2dRow_scalar(float *out, int x0, int y, int seed, size_t n)
+{
+	for (size_t i = 0; i != n; i++)
+		out[i] = noise2d(x0 + i, y, seed);
+}
+
+
+static void noise3dRow_scalar(float *out, int x0, int y, int z, int seed,
+	size_t n)
+{
+	for (size_t i = 0; i != n; i++)
+		out[i] = noise3d(x0 + i, y, z, seed);
+}
+
+
+static void lerp_scalar(float *out, const float *a, const float *b,
+	float t, size_t n)
+{
+	for (size_t i = 0; i != n; i++)
+		out[i] = linearInterpolation(a[i], b[i], t);
+}
+
+
+static void lerp2_scalar(float *out, const float *a, const float *b,
+	const float *c, const float *d, float t1, float t2, size_t n)
+{
+	for (size_t i = 0; i != n; i++) {
+		float u = linearInterpolation(a[i], b[i], t1);
+		float v = linearInterpolation(c[i], d[i], t1);
+		out[i] = linearInterpolation(u, v, t2);
+	}
+}
+
+
+template <bool ABS>
+static void addScaled_scalar(float *result, const float *gradient,
+	float g, size_t n)
+{
+	for (size_t i = 0; i != n; i++)
+		result[i] += g * (ABS ? fabs(gradient[i]) : gradient[i]);
+}
+
+
+template <bool ABS>
+static void addWeighted_scalar(float *result, float *gmap,
+	const float *gradient, const float *persistence_map, size_t n)
+{
+	for (size_t i = 0; i != n; i++) {
+		result[i] += gmap[i] * (ABS ? fabs(gradient[i]) : gradient[i]);
+		gmap[i] *= persistence_map[i];
+	}
+}
+
+
+static const NoiseKernels noise_kernels_scalar = {
+	noise2dRow_scalar,
+	noise3dRow_scalar,
+	lerp_scalar,
+	lerp2_scalar,
+	addScaled_scalar<false>,
+	addScaled_scalar<true>,
+	addWeighted_scalar<false>,
+	addWeighted_scalar<true>,
+};
+
+
+#ifdef NOISE_SIMD_X86
+
+#define NOISE_TARGET_SSE2 __attribute__((target("sse2")))
+#define NOISE_TARGET_AVX2 __attribute__((target("avx2")))
+
+/*
+	SSE2
+*/
+
+// SSE2 has no 32 bit multiplication keeping the low halves
+NOISE_TARGET_SSE2
+static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+// The hash of noise2d() and noise3d(), n being the sum of the magic products
+NOISE_TARGET_SSE2
+static inline __m128 noiseHash_sse2(__m128i n)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	n = _mm_and_si128(n, mask);
+	n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+	__m128i t = mullo_epi32_sse2(n, n);
+	t = mullo_epi32_sse2(t, _mm_set1_epi32(60493));
+	t = _mm_add_epi32(t, _mm_set1_epi32(19990303));
+	t = mullo_epi32_sse2(n, t);
+	t = _mm_add_epi32(t, _mm_set1_epi32(1376312589));
+	n = _mm_and_si128(t, mask);
+	return _mm_sub_ps(_mm_set1_ps(1.f),
+		_mm_div_ps(_mm_cvtepi32_ps(n), _mm_set1_ps((float)0x40000000)));
+}
+
+
+NOISE_TARGET_SSE2
+static void noiseRow_sse2(float *out, int x0, u32 base, size_t n)
+{
+	__m128i x = _mm_add_epi32(_mm_set1_epi32(x0), _mm_set_epi32(3, 2, 1, 0));
+	const __m128i magic_x = _mm_set1_epi32(NOISE_MAGIC_X);
+	const __m128i vbase = _mm_set1_epi32(base);
+	const __m128i four = _mm_set1_epi32(4);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i h = _mm_add_epi32(mullo_epi32_sse2(x, magic_x), vbase);
+		_mm_storeu_ps(out + i, noiseHash_sse2(h));
+		x = _mm_add_epi32(x, four);
+	}
+}
+
+
+NOISE_TARGET_SSE2
+static void noise2dRow_sse2(float *out, int x0, int y, int seed, size_t n)
+{
+	u32 base = (u32)NOISE_MAGIC_Y * y + (u32)NOISE_MAGIC_SEED * seed;
+	noiseRow_sse2(out, x0, base, n);
+	for (size_t i = n & ~(size_t)3; i != n; i++)
+		out[i] = noise2d(x0 + i, y, seed);
+}
+
+
+NOISE_TARGET_SSE2
+static void noise3dRow_sse2(float *out, int x0, int y, int z, int seed,
+	size_t n)
+{
+	u32 base = (u32)NOISE_MAGIC_Y * y + (u32)NOISE_MAGIC_Z * z +
+		(u32)NOISE_MAGIC_SEED * seed;
+	noiseRow_sse2(out, x0, base, n);
+	for (size_t i = n & ~(size_t)3; i != n; i++)
+		out[i] = noise3d(x0 + i, y, z, seed);
+}
+
+
+NOISE_TARGET_SSE2
+static inline __m128 lerp_ps_sse2(__m128 v0, __m128 v1, __m128 t)
+{
+	return _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t));
+}
+
+
+NOISE_TARGET_SSE2
+static void lerp_sse2(float *out, const float *a, const float *b,
+	float t, size_t n)
+{
+	__m128 vt = _mm_set1_ps(t);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(out + i, lerp_ps_sse2(
+			_mm_loadu_ps(a + i), _mm_loadu_ps(b + i), vt));
+	}
+	lerp_scalar(out + i, a + i, b + i, t, n - i);
+}
+
+
+NOISE_TARGET_SSE2
+static void lerp2_sse2(float *out, const float *a, const float *b,
+	const float *c, const float *d, float t1, float t2, size_t n)
+{
+	__m128 vt1 = _mm_set1_ps(t1);
+	__m128 vt2 = _mm_set1_ps(t2);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 u = lerp_ps_sse2(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i), vt1);
+		__m128 v = lerp_ps_sse2(_mm_loadu_ps(c + i), _mm_loadu_ps(d + i), vt1);
+		_mm_storeu_ps(out + i, lerp_ps_sse2(u, v, vt2));
+	}
+	lerp2_scalar(out + i, a + i, b + i, c + i, d + i, t1, t2, n - i);
+}
+
+
+template <bool ABS>
+NOISE_TARGET_SSE2
+static inline __m128 loadGradient_sse2(const float *p)
+{
+	__m128 v = _mm_loadu_ps(p);
+	return ABS ? _mm_andnot_ps(_mm_set1_ps(-0.f), v) : v;
+}
+
+
+template <bool ABS>
+NOISE_TARGET_SSE2
+static void addScaled_sse2(float *result, const float *gradient,
+	float g, size_t n)
+{
+	__m128 vg = _mm_set1_ps(g);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i),
+			_mm_mul_ps(vg, loadGradient_sse2<ABS>(gradient + i)));
+		_mm_storeu_ps(result + i, r);
+	}
+	addScaled_scalar<ABS>(result + i, gradient + i, g, n - i);
+}
+
+
+template <bool ABS>
+NOISE_TARGET_SSE2
+static void addWeighted_sse2(float *result, float *gmap,
+	const float *gradient, const float *persistence_map, size_t n)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 gm = _mm_loadu_ps(gmap + i);
+		__m128 r = _mm_add_ps(_mm_loadu_ps(result + i),
+			_mm_mul_ps(gm, loadGradient_sse2<ABS>(gradient + i)));
+		_mm_storeu_ps(result + i, r);
+		_mm_storeu_ps(gmap + i,
+			_mm_mul_ps(gm, _mm_loadu_ps(persistence_map + i)));
+	}
+	addWeighted_scalar<ABS>(result + i, gmap + i, gradient + i,
+		persistence_map + i, n - i);
+}
+
+
+static const NoiseKernels noise_kernels_sse2 = {
+	noise2dRow_sse2,
+	noise3dRow_sse2,
+	lerp_sse2,
+	lerp2_sse2,
+	addScaled_sse2<false>,
+	addScaled_sse2<true>,
+	addWeighted_sse2<false>,
+	addWeighted_sse2<true>,
+};
+
+/*
+	AVX2
+*/
+
+NOISE_TARGET_AVX2
+static inline __m256 noiseHash_avx2(__m256i n)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	n = _mm256_and_si256(n, mask);
+	n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+	__m256i t = _mm256_mullo_epi32(n, n);
+	t = _mm256_mullo_epi32(t, _mm256_set1_epi32(60493));
+	t = _mm256_add_epi32(t, _mm256_set1_epi32(19990303));
+	t = _mm256_mullo_epi32(n, t);
+	t = _mm256_add_epi32(t, _mm256_set1_epi32(1376312589));
+	n = _mm256_and_si256(t, mask);
+	return _mm256_sub_ps(_mm256_set1_ps(1.f),
+		_mm256_div_ps(_mm256_cvtepi32_ps(n),
+			_mm256_set1_ps((float)0x40000000)));
+}
+
+
+NOISE_TARGET_AVX2
+static void noiseRow_avx2(float *out, int x0, u32 base, size_t n)
+{
+	__m256i x = _mm256_add_epi32(_mm256_set1_epi32(x0),
+		_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+	const __m256i magic_x = _mm256_set1_epi32(NOISE_MAGIC_X);
+	const __m256i vbase = _mm256_set1_epi32(base);
+	const __m256i eight = _mm256_set1_epi32(8);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i h = _mm256_add_epi32(_mm256_mullo_epi32(x, magic_x), vbase);
+		_mm256_storeu_ps(out + i, noiseHash_avx2(h));
+		x = _mm256_add_epi32(x, eight);
+	}
+}
+
+
+NOISE_TARGET_AVX2
+static void noise2dRow_avx2(float *out, int x0, int y, int seed, size_t n)
+{
+	u32 base = (u32)NOISE_MAGIC_Y * y + (u32)NOISE_MAGIC_SEED * seed;
+	noiseRow_avx2(out, x0, base, n);
+	for (size_t i = n & ~(size_t)7; i != n; i++)
+		out[i] = noise2d(x0 + i, y, seed);
+}
+
+
+NOISE_TARGET_AVX2
+static void noise3dRow_avx2(float *out, int x0, int y, int z, int seed,
+	size_t n)
+{
+	u32 base = (u32)NOISE_MAGIC_Y * y + (u32)NOISE_MAGIC_Z * z +
+		(u32)NOISE_MAGIC_SEED * seed;
+	noiseRow_avx2(out, x0, base, n);
+	for (size_t i = n & ~(size_t)7; i != n; i++)
+		out[i] = noise3d(x0 + i, y, z, seed);
+}
+
+
+NOISE_TARGET_AVX2
+static inline __m256 lerp_ps_avx2(__m256 v0, __m256 v1, __m256 t)
+{
+	return _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), t));
+}
+
+
+NOISE_TARGET_AVX2
+static void lerp_avx2(float *out, const float *a, const float *b,
+	float t, size_t n)
+{
+	__m256 vt = _mm256_set1_ps(t);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(out + i, lerp_ps_avx2(
+			_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), vt));
+	}
+	lerp_scalar(out + i, a + i, b + i, t, n - i);
+}
+
+
+NOISE_TARGET_AVX2
+static void lerp2_avx2(float *out, const float *a, const float *b,
+	const float *c, const float *d, float t1, float t2, size_t n)
+{
+	__m256 vt1 = _mm256_set1_ps(t1);
+	__m256 vt2 = _mm256_set1_ps(t2);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 u = lerp_ps_avx2(
+			_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), vt1);
+		__m256 v = lerp_ps_avx2(
+			_mm256_loadu_ps(c + i), _mm256_loadu_ps(d + i), vt1);
+		_mm256_storeu_ps(out + i, lerp_ps_avx2(u, v, vt2));
+	}
+	lerp2_scalar(out + i, a + i, b + i, c + i, d + i, t1, t2, n - i);
+}
+
+
+template <bool ABS>
+NOISE_TARGET_AVX2
+static inline __m256 loadGradient_avx2(const float *p)
+{
+	__m256 v = _mm256_loadu_ps(p);
+	return ABS ? _mm256_andnot_ps(_mm256_set1_ps(-0.f), v) : v;
+}
+
+
+template <bool ABS>
+NOISE_TARGET_AVX2
+static void addScaled_avx2(float *result, const float *gradient,
+	float g, size_t n)
+{
+	__m256 vg = _mm256_set1_ps(g);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i),
+			_mm256_mul_ps(vg, loadGradient_avx2<ABS>(gradient + i)));
+		_mm256_storeu_ps(result + i, r);
+	}
+	addScaled_scalar<ABS>(result + i, gradient + i, g, n - i);
+}
+
+
+template <bool ABS>
+NOISE_TARGET_AVX2
+static void addWeighted_avx2(float *result, float *gmap,
+	const float *gradient, const float *persistence_map, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 gm = _mm256_loadu_ps(gmap + i);
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(result + i),
+			_mm256_mul_ps(gm, loadGradient_avx2<ABS>(gradient + i)));
+		_mm256_storeu_ps(result + i, r);
+		_mm256_storeu_ps(gmap + i,
+			_mm256_mul_ps(gm, _mm256_loadu_ps(persistence_map + i)));
+	}
+	addWeighted_scalar<ABS>(result + i, gmap + i, gradient + i,
+		persistence_map + i, n - i);
+}
+
+
+static const NoiseKernels noise_kernels_avx2 = {
+	noise2dRow_avx2,
+	noise3dRow_avx2,
+	lerp_avx2,
+	lerp2_avx2,
+	addScaled_avx2<false>,
+	addScaled_avx2<true>,
+	addWeighted_avx2<false>,
+	addWeighted_avx2<true>,
+};
+
+#endif // NOISE_SIMD_X86
+
+
+static NoiseSimdLevel detect_simd_level()
+{
+#ifdef NOISE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NOISE_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return NOISE_SIMD_SSE2;
+#endif
+	return NOISE_SIMD_NONE;
+}
+
+
+static const NoiseKernels *get_kernels(NoiseSimdLevel level)
+{
+	switch (level) {
+#ifdef NOISE_SIMD_X86
+	case NOISE_SIMD_AVX2:
+		return &noise_kernels_avx2;
+	case NOISE_SIMD_SSE2:
+		return &noise_kernels_sse2;
+#endif
+	default:
+		return &noise_kernels_scalar;
+	}
+}
+
+
+// Selected during static initialization, before any mapgen thread starts
+static const NoiseSimdLevel noise_max_simd_level = detect_simd_level();
+static NoiseSimdLevel noise_simd_level = noise_max_simd_level;
+static const NoiseKernels *noise_kernels = get_kernels(noise_max_simd_level);
+
+
+NoiseSimdLevel noise_get_max_simd_level()
+{
+	return noise_max_simd_level;
+}
+
+
+NoiseSimdLevel noise_get_simd_level()
+{
+	return noise_simd_level;
+}
+
+
+void noise_set_simd_level(NoiseSimdLevel level)
+{
+	noise_simd_level = MYMIN(level, noise_max_simd_level);
+	noise_kernels = get_kernels(noise_simd_level);
+}
+
+
 Noise::Noise(NoiseParams *np_, int seed, u32 sx, u32 sy, u32 sz)
 {
 	memcpy(&np, np_, sizeof(np));
@@ -427,6 +908,8 @@ Noise::Noise(NoiseParams *np_, int seed, u32 sx, u32 sy, u32 sz)
 	this->persist_buf  = NULL;
 	this->gradient_buf = NULL;
 	this->result       = NULL;
+	this->column_buf   = NULL;
+	this->interp_buf   = NULL;
 
 	allocBuffers();
 }
@@ -438,6 +921,8 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] column_buf;
+	delete[] interp_buf;
 }
 
 
@@ -456,12 +941,16 @@ void Noise::allocBuffers()
 	delete[] gradient_buf;
 	delete[] persist_buf;
 	delete[] result;
+	delete[] column_buf;
+	delete[] interp_buf;
 
 	try {
 		size_t bufsize = sx * sy * sz;
 		this->persist_buf  = NULL;
 		this->gradient_buf = new float[bufsize];
 		this->result       = new float[bufsize];
+		this->column_buf   = new u32[sx];
+		this->interp_buf   = new float[sx * 5];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -538,61 +1027,94 @@ void Noise::resizeNoiseBuf(bool is3d)
  * Another optimization that could save half as many noise calls is to carry over
  * values from the previous noise lattice as midpoints in the new lattice for the
  * next octave.
+ *
+ * Every row of the map crosses the lattice at the same columns, so the
+ * interpolation along x is done once per lattice row and shared by all the
+ * map rows between two lattice rows.  What remains per map row is a plain
+ * interpolation between such rows, which the SIMD kernels handle.
  */
+
+void Noise::prepareColumns(float u, float step_x, bool eased)
+{
+	u32 noisex = 0;
+	float *column_t = interp_buf;
+
+	for (u32 i = 0; i != sx; i++) {
+		column_buf[i] = noisex;
+		column_t[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+}
+
+
+void Noise::interpolateRowX(float *out, const float *lattice_row)
+{
+	const float *column_t = interp_buf;
+
+	for (u32 i = 0; i != sx; i++) {
+		u32 noisex = column_buf[i];
+		out[i] = linearInterpolation(lattice_row[noisex],
+			lattice_row[noisex + 1], column_t[i]);
+	}
+}
+
+
 #define idx(x, y) ((y) * nlx + (x))
 void Noise::gradientMap2D(
 		float x, float y,
 		float step_x, float step_y,
 		int seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
+	float u, v;
+	u32 index, j, noisey, rows_noisey;
 	u32 nlx, nly;
 	s32 x0, y0;
 
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
-	Interp2dFxn interpolate = eased ?
-		biLinearInterpolation : biLinearInterpolationNoEase;
 
 	x0 = floor(x);
 	y0 = floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		noise_kernels->noise2dRow(&noise_buf[idx(0, j)], x0, y0 + j, seed, nlx);
 
 	//calculate interpolations
+	prepareColumns(u, step_x, eased);
+
+	// Lattice rows noisey and noisey + 1 interpolated along x
+	float *row0 = interp_buf + sx;
+	float *row1 = interp_buf + sx * 2;
+	interpolateRowX(row0, &noise_buf[idx(0, 0)]);
+	interpolateRowX(row1, &noise_buf[idx(0, 1)]);
+	rows_noisey = 0;
+
 	index  = 0;
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] = interpolate(v00, v10, v01, v11, u, v);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
+		if (noisey != rows_noisey) {
+			if (noisey == rows_noisey + 1) {
+				std::swap(row0, row1);
+			} else {
+				interpolateRowX(row0, &noise_buf[idx(0, noisey)]);
 			}
+			interpolateRowX(row1, &noise_buf[idx(0, noisey + 1)]);
+			rows_noisey = noisey;
 		}
 
+		noise_kernels->lerp(&gradient_buf[index], row0, row1,
+			eased ? easeCurve(v) : v, sx);
+		index += sx;
+
 		v += step_y;
 		if (v >= 1.0) {
 			v -= 1.0;
@@ -609,15 +1131,12 @@ void Noise::gradientMap3D(
 		float step_x, float step_y, float step_z,
 		int seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
+	float u, v, w, orig_v;
+	u32 index, j, k, noisey, noisez, rows_noisey;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
-	Interp3dFxn interpolate = (np.flags & NOISE_FLAG_EASED) ?
-		triLinearInterpolation : triLinearInterpolationNoEase;
+	bool eased = np.flags & NOISE_FLAG_EASED;
 
 	x0 = floor(x);
 	y0 = floor(y);
@@ -625,59 +1144,58 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
 	orig_v = v;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
 	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
 	for (k = 0; k != nlz; k++)
 		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
+			noise_kernels->noise3dRow(&noise_buf[idx(0, j, k)],
+				x0, y0 + j, z0 + k, seed, nlx);
 
 	//calculate interpolations
+	prepareColumns(u, step_x, eased);
+
+	// Lattice rows (noisey, noisez), (noisey + 1, noisez),
+	// (noisey, noisez + 1) and (noisey + 1, noisez + 1) interpolated along x
+	float *row00 = interp_buf + sx;
+	float *row10 = interp_buf + sx * 2;
+	float *row01 = interp_buf + sx * 3;
+	float *row11 = interp_buf + sx * 4;
+
 	index  = 0;
-	noisey = 0;
 	noisez = 0;
 	for (k = 0; k != sz; k++) {
+		interpolateRowX(row00, &noise_buf[idx(0, 0, noisez)]);
+		interpolateRowX(row10, &noise_buf[idx(0, 1, noisez)]);
+		interpolateRowX(row01, &noise_buf[idx(0, 0, noisez + 1)]);
+		interpolateRowX(row11, &noise_buf[idx(0, 1, noisez + 1)]);
+		rows_noisey = 0;
+
+		float tz = eased ? easeCurve(w) : w;
 		v = orig_v;
 		noisey = 0;
 		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = interpolate(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
+			if (noisey != rows_noisey) {
+				if (noisey == rows_noisey + 1) {
+					std::swap(row00, row10);
+					std::swap(row01, row11);
+				} else {
+					interpolateRowX(row00, &noise_buf[idx(0, noisey, noisez)]);
+					interpolateRowX(row01, &noise_buf[idx(0, noisey, noisez + 1)]);
 				}
+				interpolateRowX(row10, &noise_buf[idx(0, noisey + 1, noisez)]);
+				interpolateRowX(row11, &noise_buf[idx(0, noisey + 1, noisez + 1)]);
+				rows_noisey = noisey;
 			}
 
+			noise_kernels->lerp2(&gradient_buf[index],
+				row00, row10, row01, row11,
+				eased ? easeCurve(v) : v, tz, sx);
+			index += sx;
+
 			v += step_y;
 			if (v >= 1.0) {
 				v -= 1.0;
@@ -773,27 +1291,19 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 void Noise::updateResults(float g, float *gmap,
 	float *persistence_map, size_t bufsize)
 {
-	// This looks very ugly, but it is 50-70% faster than having
-	// conditional statements inside the loop
 	if (np.flags & NOISE_FLAG_ABSVALUE) {
 		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * fabs(gradient_buf[i]);
-				gmap[i] *= persistence_map[i];
-			}
+			noise_kernels->addWeightedAbs(result, gmap, gradient_buf,
+				persistence_map, bufsize);
 		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * fabs(gradient_buf[i]);
+			noise_kernels->addScaledAbs(result, gradient_buf, g, bufsize);
 		}
 	} else {
 		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * gradient_buf[i];
-				gmap[i] *= persistence_map[i];
-			}
+			noise_kernels->addWeighted(result, gmap, gradient_buf,
+				persistence_map, bufsize);
 		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * gradient_buf[i];
+			noise_kernels->addScaled(result, gradient_buf, g, bufsize);
 		}
 	}
 }
@@ -156,6 +156,10 @@ class Noise {
 	float *gradient_buf;
 	float *persist_buf;
 	float *result;
+	// Per column lattice indices, interpolation factors and rows of noise
+	// interpolated along x, used by the gradient map functions
+	u32 *column_buf;
+	float *interp_buf;
 
 	Noise(NoiseParams *np, int seed, u32 sx, u32 sy, u32 sz=1);
 	~Noise();
@@ -198,6 +202,8 @@ class Noise {
 private:
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
+	void prepareColumns(float u, float step_x, bool eased);
+	void interpolateRowX(float *out, const float *lattice_row);
 	void updateResults(float g, float *gmap, float *persistence_map, size_t bufsize);
 
 };
@@ -243,6 +249,21 @@ float noise3d_perlin(float x, float y, float z, int seed,
 float noise3d_perlin_abs(float x, float y, float z, int seed,
 		int octaves, float persistence, bool eased=false);
 
+/*
+	Instruction sets the noise map functions can use. The best one the CPU
+	supports is selected at startup; all of them give the same results.
+*/
+enum NoiseSimdLevel {
+	NOISE_SIMD_NONE,
+	NOISE_SIMD_SSE2,
+	NOISE_SIMD_AVX2,
+};
+
+NoiseSimdLevel noise_get_max_simd_level();
+NoiseSimdLevel noise_get_simd_level();
+// Levels above noise_get_max_simd_level() are clamped to it
+void noise_set_simd_level(NoiseSimdLevel level);
+
 inline float easeCurve(float t)
 {
 	return t * t * t * (t * (6.f * t - 15.f) + 10.f);
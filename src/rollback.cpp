@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <list>
 #include <sstream>
 #include "log.h"
+#include "debug.h"
 #include "mapnode.h"
 #include "gamedef.h"
 #include "nodedef.h"
@@ -31,9 +32,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "inventorymanager.h" // deserializing InventoryLocations
 #include "sqlite3.h"
 #include "filesys.h"
+#include "threading/mutex_auto_lock.h"
 
 #define POINTS_PER_NODE (16.0)
 
+// Queued actions that make the thread start writing
+#define FLUSH_ACTIONS 500
+// Queued actions at which reporting waits for them to be written
+#define MAX_QUEUED_ACTIONS 100000
+// Longest time actions stay queued
+#define FLUSH_INTERVAL_MS 10000
+
 #define SQLRES(f, good) \
 	if ((f) != (good)) {\
 		throw FileNotGoodException(std::string("RollbackManager: " \
@@ -83,8 +92,10 @@ struct Entity {
 
 RollbackManager::RollbackManager(const std::string & world_path,
 		IGameDef * gamedef_) :
+	Thread("Rollback"),
 	gamedef(gamedef_),
-	current_actor_is_guess(false)
+	current_actor_is_guess(false),
+	sync_waiters(0)
 {
 	verbosestream << "RollbackManager::RollbackManager(" << world_path
 		<< ")" << std::endl;
@@ -102,12 +113,17 @@ RollbackManager::RollbackManager(const std::string & world_path,
 		migrate(txt_filename);
 		fs::DeleteSingleFileOrEmptyDirectory(migrating_flag);
 	}
+
+	start();
 }
 
 
 RollbackManager::~RollbackManager()
 {
-	flush();
+	// run() writes the rest before returning
+	stop();
+	flush_sem.post();
+	wait();
 
 	SQLOK(sqlite3_finalize(stmt_insert));
 	SQLOK(sqlite3_finalize(stmt_replace));
@@ -892,49 +908,121 @@ std::string RollbackManager::getSuspect(v3s16 p, float nearness_shortcut,
 
 void RollbackManager::flush()
 {
-	sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+	flush_sem.post();
+}
 
-	std::list<RollbackAction>::const_iterator iter;
 
-	for (iter  = action_todisk_buffer.begin();
-			iter != action_todisk_buffer.end();
-			++iter) {
-		if (iter->actor == "") {
-			continue;
+void RollbackManager::sync()
+{
+	for (;;) {
+		{
+			MutexAutoLock lock(queue_mutex);
+			if (action_todisk_buffer.empty() && action_writing_buffer.empty())
+				return;
+			sync_waiters++;
+		}
+		flush();
+		sync_sem.wait();
+	}
+}
+
+
+void *RollbackManager::run()
+{
+	DSTACK(FUNCTION_NAME);
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (!stopRequested()) {
+		flush_sem.wait(FLUSH_INTERVAL_MS);
+		// Several flushes are handled at once
+		while (flush_sem.wait(0));
+
+		writeQueued();
+	}
+
+	writeQueued();
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return NULL;
+}
+
+
+void RollbackManager::writeQueued()
+{
+	{
+		MutexAutoLock lock(queue_mutex);
+		action_writing_buffer.swap(action_todisk_buffer);
+	}
+
+	if (!action_writing_buffer.empty()) {
+		MutexAutoLock lock(db_mutex);
+
+		sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+
+		std::vector<RollbackAction>::const_iterator iter;
+
+		for (iter  = action_writing_buffer.begin();
+				iter != action_writing_buffer.end();
+				++iter) {
+			if (iter->actor == "") {
+				continue;
+			}
+
+			registerRow(actionRowFromRollbackAction(*iter));
 		}
 
-		registerRow(actionRowFromRollbackAction(*iter));
+		sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
 	}
 
-	sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
-	action_todisk_buffer.clear();
+	MutexAutoLock lock(queue_mutex);
+	action_writing_buffer.clear();
+	if (sync_waiters > 0) {
+		sync_sem.post(sync_waiters);
+		sync_waiters = 0;
+	}
 }
 
 
 void RollbackManager::addAction(const RollbackAction & action)
 {
-	action_todisk_buffer.push_back(action);
 	action_latest_buffer.push_back(action);
 
-	// Flush to disk sometimes
-	if (action_todisk_buffer.size() >= 500) {
+	// getSuspect() does not look further back than 100 seconds
+	while (action_latest_buffer.front().unix_time < action.unix_time - 100) {
+		action_latest_buffer.pop_front();
+	}
+
+	size_t queued;
+	{
+		MutexAutoLock lock(queue_mutex);
+		action_todisk_buffer.push_back(action);
+		queued = action_todisk_buffer.size();
+	}
+
+	// Flush to disk sometimes, wait for the disk if it does not keep up
+	if (queued >= MAX_QUEUED_ACTIONS) {
+		sync();
+	} else if (queued % FLUSH_ACTIONS == 0) {
 		flush();
 	}
 }
 
 std::list<RollbackAction> RollbackManager::getEntriesSince(time_t first_time)
 {
-	flush();
+	sync();
+	MutexAutoLock lock(db_mutex);
 	return getActionsSince(first_time);
 }
 
 std::list<RollbackAction> RollbackManager::getNodeActors(v3s16 pos, int range,
 		time_t seconds, int limit)
 {
-	flush();
+	sync();
 	time_t cur_time = time(0);
 	time_t first_time = cur_time - seconds;
 
+	MutexAutoLock lock(db_mutex);
 	return getActionsSince_range(first_time, pos, range, limit);
 }
 
@@ -945,8 +1033,8 @@ std::list<RollbackAction> RollbackManager::getRevertActions(
 	time_t cur_time = time(0);
 	time_t first_time = cur_time - seconds;
 
-	flush();
+	sync();
 
+	MutexAutoLock lock(db_mutex);
 	return getActionsSince(first_time, actor_filter);
 }
-
@@ -26,16 +26,25 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <list>
 #include <vector>
 #include "sqlite3.h"
+#include "threading/thread.h"
+#include "threading/mutex.h"
+#include "threading/semaphore.h"
 
 class IGameDef;
 
 struct ActionRow;
 struct Entity;
 
-class RollbackManager: public IRollbackManager
+/*
+	Actions are queued and written to the database by a thread of the
+	manager, many at a time in one transaction. The queue has a size limit;
+	reporting an action waits for the thread when it is full.
+*/
+class RollbackManager: public IRollbackManager, public Thread
 {
 public:
 	RollbackManager(const std::string & world_path, IGameDef * gamedef);
+	// Writes out everything still queued
 	~RollbackManager();
 
 	void reportAction(const RollbackAction & action_);
@@ -44,6 +53,7 @@ class RollbackManager: public IRollbackManager
 	void setActor(const std::string & actor, bool is_guess);
 	std::string getSuspect(v3s16 p, float nearness_shortcut,
 			float min_nearness);
+	// Starts writing the queued actions
 	void flush();
 
 	void addAction(const RollbackAction & action);
@@ -53,7 +63,14 @@ class RollbackManager: public IRollbackManager
 	std::list<RollbackAction> getRevertActions(
 			const std::string & actor_filter, time_t seconds);
 
+protected:
+	void *run();
+
 private:
+	// Returns when the actions queued so far have been written
+	void sync();
+	void writeQueued();
+
 	void registerNewActor(const int id, const std::string & name);
 	void registerNewNode(const int id, const std::string & name);
 	int getActorId(const std::string & name);
@@ -85,10 +102,20 @@ class RollbackManager: public IRollbackManager
 	std::string current_actor;
 	bool current_actor_is_guess;
 
-	std::list<RollbackAction> action_todisk_buffer;
+	// Actions not written yet; only the thread touches the writing ones
+	Mutex queue_mutex;
+	std::vector<RollbackAction> action_todisk_buffer;
+	std::vector<RollbackAction> action_writing_buffer;
+	Semaphore flush_sem;
+	Semaphore sync_sem;
+	u32 sync_waiters;
+
+	// Actions of the last seconds, to guess actors from
 	std::list<RollbackAction> action_latest_buffer;
 
 	std::string database_path;
+	// Held while using the database and the known actors and nodes
+	Mutex db_mutex;
 	sqlite3 * db;
 	sqlite3_stmt * stmt_insert;
 	sqlite3_stmt * stmt_replace;
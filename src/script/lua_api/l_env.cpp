@@ -35,6 +35,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "treegen.h"
 #include "emerge.h"
 #include "pathfinder.h"
+#include "voxel.h"
+#include <algorithm>
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -510,6 +512,30 @@ int ModApiEnvMod::l_get_gametime(lua_State *L)
 }
 
 
+/*
+	Finds out which blocks of the area (in block coordinates) may contain
+	any of the contents in filter, indexed by area.index(blockpos).
+	Blocks that are not loaded read as CONTENT_IGNORE.
+*/
+static void find_candidate_blocks(Map *map, const VoxelArea &area,
+		const std::set<content_t> &filter, std::vector<bool> &candidates)
+{
+	v3s16 extent = area.getExtent();
+	if (extent.X <= 0 || extent.Y <= 0 || extent.Z <= 0)
+		return;
+
+	bool ignore_wanted = filter.count(CONTENT_IGNORE) != 0;
+	candidates.resize(area.getVolume());
+	v3s16 bp;
+	for (bp.Z = area.MinEdge.Z; bp.Z <= area.MaxEdge.Z; bp.Z++)
+	for (bp.Y = area.MinEdge.Y; bp.Y <= area.MaxEdge.Y; bp.Y++)
+	for (bp.X = area.MinEdge.X; bp.X <= area.MaxEdge.X; bp.X++) {
+		MapBlock *block = map->getBlockNoCreateNoEx(bp);
+		candidates[area.index(bp)] = block ?
+			block->containsAnyContent(filter) : ignore_wanted;
+	}
+}
+
 // find_node_near(pos, radius, nodenames) -> pos or nil
 // nodenames: eg. {"ignore", "group:tree"} or "default:dirt"
 int ModApiEnvMod::l_find_node_near(lua_State *L)
@@ -534,12 +560,27 @@ int ModApiEnvMod::l_find_node_near(lua_State *L)
 		ndef->getIds(lua_tostring(L, 3), filter);
 	}
 
+	if(radius < 1)
+		return 0;
+
+	// Only look at the nodes of blocks that have any of the contents
+	Map &map = env->getMap();
+	v3s16 r(radius, radius, radius);
+	VoxelArea block_area(getNodeBlockPos(pos - r), getNodeBlockPos(pos + r));
+	std::vector<bool> candidates;
+	find_candidate_blocks(&map, block_area, filter, candidates);
+	if(std::find(candidates.begin(), candidates.end(), true) ==
+			candidates.end())
+		return 0;
+
 	for(int d=1; d<=radius; d++){
 		std::vector<v3s16> list = FacePositionCache::getFacePositions(d);
 		for(std::vector<v3s16>::iterator i = list.begin();
 				i != list.end(); ++i){
 			v3s16 p = pos + (*i);
-			content_t c = env->getMap().getNodeNoEx(p).getContent();
+			if(!candidates[block_area.index(getNodeBlockPos(p))])
+				continue;
+			content_t c = map.getNodeNoEx(p).getContent();
 			if(filter.count(c) != 0){
 				push_v3s16(L, p);
 				return 1;
@@ -575,13 +616,25 @@ int ModApiEnvMod::l_find_nodes_in_area(lua_State *L)
 
 	std::map<content_t, u16> individual_count;
 
+	// Only look at the nodes of blocks that have any of the contents
+	Map &map = env->getMap();
+	VoxelArea block_area(getNodeBlockPos(minp), getNodeBlockPos(maxp));
+	std::vector<bool> candidates;
+	find_candidate_blocks(&map, block_area, filter, candidates);
+
 	lua_newtable(L);
 	u64 i = 0;
 	for (s16 x = minp.X; x <= maxp.X; x++)
 		for (s16 y = minp.Y; y <= maxp.Y; y++)
-			for (s16 z = minp.Z; z <= maxp.Z; z++) {
+			for (s32 z = minp.Z; z <= maxp.Z; z++) {
 				v3s16 p(x, y, z);
-				content_t c = env->getMap().getNodeNoEx(p).getContent();
+				v3s16 blockpos = getNodeBlockPos(p);
+				if (!candidates[block_area.index(blockpos)]) {
+					// Skip to the last node of the block
+					z = blockpos.Z * MAP_BLOCKSIZE + MAP_BLOCKSIZE - 1;
+					continue;
+				}
+				content_t c = map.getNodeNoEx(p).getContent();
 				if (filter.count(c) != 0) {
 					push_v3s16(L, p);
 					lua_rawseti(L, -2, ++i);
@@ -145,7 +145,7 @@ int ObjectRef::l_remove(lua_State *L)
 	}
 
 	verbosestream<<"ObjectRef::l_remove(): id="<<co->getId()<<std::endl;
-	co->m_removed = true;
+	co->markForRemoval();
 	return 0;
 }
 
@@ -158,8 +158,12 @@ int LuaVoxelManip::l_update_liquids(lua_State *L)
 	mg.vm   = vm;
 	mg.ndef = ndef;
 
-	mg.updateLiquid(&map->m_transforming_liquid,
-			vm->m_area.MinEdge, vm->m_area.MaxEdge);
+	UniqueQueue<v3s16> liquid_queue;
+	mg.updateLiquid(&liquid_queue, vm->m_area.MinEdge, vm->m_area.MaxEdge);
+	while (liquid_queue.size()) {
+		map->transforming_liquid_add(liquid_queue.front());
+		liquid_queue.pop_front();
+	}
 
 	return 0;
 }
@@ -24,6 +24,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	#define ZLIB_WINAPI
 #endif
 #include "zlib.h"
+#if USE_ZSTD
+	#include <zstd.h>
+#endif
 
 /* report a zlib or i/o error */
 void zerr(int ret)
@@ -184,8 +187,71 @@ void decompressZlib(std::istream &is, std::ostream &os)
 	inflateEnd(&z);
 }
 
+#if USE_ZSTD
+void compressZstd(SharedBuffer<u8> data, std::ostream &os, int level)
+{
+	size_t bound = ZSTD_compressBound(data.getSize());
+	SharedBuffer<u8> output(bound);
+	size_t size = ZSTD_compress(*output, bound,
+			*data, data.getSize(), level);
+	if (ZSTD_isError(size)) {
+		dstream << "zstd: " << ZSTD_getErrorName(size) << std::endl;
+		throw SerializationError("compressZstd: compress failed");
+	}
+	writeU32(os, size);
+	os.write((const char*)*output, size);
+}
+
+void compressZstd(const std::string &data, std::ostream &os, int level)
+{
+	SharedBuffer<u8> databuf((u8*)data.c_str(), data.size());
+	compressZstd(databuf, os, level);
+}
+
+// Nothing in a map block comes anywhere near this, compressed or not
+#define ZSTD_MAX_SIZE 0x1000000
+
+void decompressZstd(std::istream &is, std::ostream &os)
+{
+	u32 size = readU32(is);
+	// The size is not trusted, check it before allocating
+	if (size > ZSTD_MAX_SIZE)
+		throw SerializationError("decompressZstd: frame too large");
+	std::string input(size, '\0');
+	if (size > 0)
+		is.read(&input[0], size);
+	if (is.eof() || is.fail())
+		throw SerializationError("decompressZstd: stream ended halfway");
+
+	unsigned long long content_size =
+			ZSTD_getFrameContentSize(input.c_str(), size);
+	if (content_size == ZSTD_CONTENTSIZE_ERROR ||
+			content_size == ZSTD_CONTENTSIZE_UNKNOWN)
+		throw SerializationError("decompressZstd: invalid frame");
+	if (content_size > ZSTD_MAX_SIZE)
+		throw SerializationError("decompressZstd: frame too large");
+
+	std::string output(content_size, '\0');
+	size_t ret = ZSTD_decompress(content_size > 0 ? &output[0] : NULL,
+			content_size, input.c_str(), size);
+	if (ZSTD_isError(ret)) {
+		dstream << "zstd: " << ZSTD_getErrorName(ret) << std::endl;
+		throw SerializationError("decompressZstd: decompress failed");
+	}
+	os.write(output.c_str(), ret);
+}
+#endif
+
 void compress(SharedBuffer<u8> data, std::ostream &os, u8 version)
 {
+#if USE_ZSTD
+	if(version >= SER_FMT_VER_ZSTD)
+	{
+		compressZstd(data, os);
+		return;
+	}
+#endif
+
 	if(version >= 11)
 	{
 		compressZlib(data, os);
@@ -227,8 +293,22 @@ void compress(SharedBuffer<u8> data, std::ostream &os, u8 version)
 	os.write((char*)&current_byte, 1);
 }
 
+void compress(const std::string &data, std::ostream &os, u8 version)
+{
+	SharedBuffer<u8> databuf((u8*)data.c_str(), data.size());
+	compress(databuf, os, version);
+}
+
 void decompress(std::istream &is, std::ostream &os, u8 version)
 {
+#if USE_ZSTD
+	if(version >= SER_FMT_VER_ZSTD)
+	{
+		decompressZstd(is, os);
+		return;
+	}
+#endif
+
 	if(version >= 11)
 	{
 		decompressZlib(is, os);
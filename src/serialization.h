@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "irrlichttypes.h"
 #include "exceptions.h"
+#include "config.h"
 #include <iostream>
 #include "util/pointer.h"
 
@@ -62,11 +63,19 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	24: 16-bit node ids and node timers (never released as stable)
 	25: Improved node timer format
 	26: Never written; read the same as 25
+	27: Zstandard compression instead of zlib (only with USE_ZSTD; saved only
+	    in worlds with map_compression = zstd in world.mt)
 */
 // This represents an uninitialized or invalid format
 #define SER_FMT_VER_INVALID 255
+// First version compressed with Zstandard
+#define SER_FMT_VER_ZSTD 27
 // Highest supported serialization version
+#if USE_ZSTD
+#define SER_FMT_VER_HIGHEST_READ 27
+#else
 #define SER_FMT_VER_HIGHEST_READ 26
+#endif
 // Saved on disk version
 #define SER_FMT_VER_HIGHEST_WRITE 25
 // Lowest supported serialization version
@@ -88,9 +97,16 @@ void compressZlib(SharedBuffer<u8> data, std::ostream &os, int level = -1);
 void compressZlib(const std::string &data, std::ostream &os, int level = -1);
 void decompressZlib(std::istream &is, std::ostream &os);
 
-// These choose between zlib and a self-made one according to version
+#if USE_ZSTD
+// Writes the size of the compressed data (u32) followed by a zstd frame
+void compressZstd(SharedBuffer<u8> data, std::ostream &os, int level = 0);
+void compressZstd(const std::string &data, std::ostream &os, int level = 0);
+void decompressZstd(std::istream &is, std::ostream &os);
+#endif
+
+// These choose between zstd, zlib and a self-made one according to version
 void compress(SharedBuffer<u8> data, std::ostream &os, u8 version);
-//void compress(const std::string &data, std::ostream &os, u8 version);
+void compress(const std::string &data, std::ostream &os, u8 version);
 void decompress(std::istream &is, std::ostream &os, u8 version);
 
 #endif
@@ -55,6 +55,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serverlist.h"
 #include "util/string.h"
 #include "util/mathconstants.h"
+#include "util/directiontables.h"
 #include "rollback.h"
 #include "util/serialize.h"
 #include "util/thread.h"
@@ -171,6 +172,7 @@ Server::Server(
 	m_rollback(NULL),
 	m_enable_rollback_recording(false),
 	m_emerge(NULL),
+	m_block_send_workers(NULL),
 	m_script(NULL),
 	m_itemdef(createItemDefManager()),
 	m_nodedef(createNodeDefManager()),
@@ -222,6 +224,10 @@ Server::Server(
 	// Create emerge manager
 	m_emerge = new EmergeManager(this);
 
+	u16 num_block_send_threads = g_settings->getU16("num_block_send_threads");
+	if (num_block_send_threads > 0)
+		m_block_send_workers = new WorkerPool("BlockSend", num_block_send_threads);
+
 	// Create ban manager
 	std::string ban_path = m_path_world + DIR_DELIM "ipban.txt";
 	m_banmanager = new BanManager(ban_path);
@@ -397,11 +403,18 @@ Server::~Server()
 	// Stop threads
 	stop();
 	delete m_thread;
+	delete m_block_send_workers;
 
 	// stop all emerge threads before deleting players that may have
 	// requested blocks to be emerged
 	m_emerge->stopThreads();
 
+	// Don't leave generated chunks without their on_generated run
+	{
+		MutexAutoLock envlock(m_env_mutex);
+		m_emerge->finishGeneratedChunks(this);
+	}
+
 	// Delete things in the reverse order of creation
 	delete m_env;
 
@@ -497,6 +510,33 @@ void Server::step(float dtime)
 	}
 }
 
+// An active object message serialized into a shared buffer
+struct BufferedObjectMessage
+{
+	u16 id;
+	bool reliable;
+	// Range of the message in the buffer
+	u32 start;
+	u32 size;
+	// Range of the compact form, the same as above if there is none
+	u32 compact_start;
+	u32 compact_size;
+};
+
+// Appends a message in the format of TOCLIENT_ACTIVE_OBJECT_MESSAGES
+static void append_object_message(std::string &buffer, u16 id,
+	const std::string &data)
+{
+	if (data.size() > STRING_MAX_LEN)
+		throw SerializationError("String too long for serializeString");
+
+	char buf[4];
+	writeU16((u8 *)&buf[0], id);
+	writeU16((u8 *)&buf[2], data.size());
+	buffer.append(buf, 4);
+	buffer.append(data);
+}
+
 void Server::AsyncRunStep(bool initial_step)
 {
 	DSTACK(FUNCTION_NAME);
@@ -553,6 +593,13 @@ void Server::AsyncRunStep(bool initial_step)
 		SendTimeOfDay(PEER_ID_INEXISTENT, time, time_speed);
 	}
 
+	{
+		MutexAutoLock lock(m_env_mutex);
+		// Run Lua callbacks of the chunks generated since the last step
+		ScopeProfiler sp(g_profiler, "Server: finish generated chunks");
+		m_emerge->finishGeneratedChunks(this);
+	}
+
 	{
 		MutexAutoLock lock(m_env_mutex);
 		// Figure out and report maximum lag to environment
@@ -596,8 +643,16 @@ void Server::AsyncRunStep(bool initial_step)
 
 		ScopeProfiler sp(g_profiler, "Server: liquid transform");
 
+		// Transform the liquids near the players first
+		std::vector<v3s16> player_blocks;
+		std::vector<Player*> players = m_env->getPlayers(true);
+		for(std::vector<Player*>::iterator
+				i = players.begin(); i != players.end(); ++i)
+			player_blocks.push_back(getNodeBlockPos(
+					floatToInt((*i)->getPosition(), BS)));
+
 		std::map<v3s16, MapBlock*> modified_blocks;
-		m_env->getMap().transformLiquids(modified_blocks);
+		m_env->getMap().transformLiquids(modified_blocks, player_blocks);
 #if 0
 		/*
 			Update lighting
@@ -667,9 +722,6 @@ void Server::AsyncRunStep(bool initial_step)
 				!g_settings->getBool("unlimited_player_transfer_distance"))
 			player_radius = radius;
 
-		radius *= MAP_BLOCKSIZE;
-		player_radius *= MAP_BLOCKSIZE;
-
 		for (std::map<u16, RemoteClient*>::iterator
 			i = clients.begin();
 			i != clients.end(); ++i) {
@@ -677,8 +729,10 @@ void Server::AsyncRunStep(bool initial_step)
 
 			// If definitions and textures have not been sent, don't
 			// send objects either
-			if (client->getState() < CS_DefinitionsSent)
+			if (client->getState() < CS_DefinitionsSent) {
+				client->m_known_objects_radius = -1;
 				continue;
+			}
 
 			Player *player = m_env->getPlayer(client->peer_id);
 			if(player == NULL) {
@@ -686,15 +740,34 @@ void Server::AsyncRunStep(bool initial_step)
 				/*warningstream<<FUNCTION_NAME<<": Client "
 						<<client->peer_id
 						<<" has no associated player"<<std::endl;*/
+				client->m_known_objects_radius = -1;
 				continue;
 			}
 
+			/*
+				Unless the player moved to another block or the ranges
+				changed, only the objects that changed since the last
+				step have to be looked at.
+			*/
 			std::queue<u16> removed_objects;
 			std::queue<u16> added_objects;
-			m_env->getRemovedActiveObjects(player, radius, player_radius,
-					client->m_known_objects, removed_objects);
-			m_env->getAddedActiveObjects(player, radius, player_radius,
-					client->m_known_objects, added_objects);
+			v3s16 player_block = ActiveObjectGrid::getCell(player->getPosition());
+			if (client->m_known_objects_radius >= 0 &&
+					client->m_known_objects_radius == radius &&
+					client->m_known_objects_player_radius == player_radius &&
+					client->m_known_objects_block == player_block) {
+				m_env->getChangedActiveObjects(player, radius, player_radius,
+						client->m_known_objects, added_objects,
+						removed_objects);
+			} else {
+				m_env->getRemovedActiveObjects(player, radius, player_radius,
+						client->m_known_objects, removed_objects);
+				m_env->getAddedActiveObjects(player, radius, player_radius,
+						client->m_known_objects, added_objects);
+				client->m_known_objects_block = player_block;
+				client->m_known_objects_radius = radius;
+				client->m_known_objects_player_radius = player_radius;
+			}
 
 			// Ignore if nothing happened
 			if (removed_objects.empty() && added_objects.empty()) {
@@ -768,6 +841,7 @@ void Server::AsyncRunStep(bool initial_step)
 					<< added_objects.size() << " added, "
 					<< "packet size is " << pktSize << std::endl;
 		}
+		m_env->clearActiveObjectEvents();
 		m_clients.unlock();
 	}
 
@@ -778,9 +852,13 @@ void Server::AsyncRunStep(bool initial_step)
 		MutexAutoLock envlock(m_env_mutex);
 		ScopeProfiler sp(g_profiler, "Server: sending object messages");
 
-		// Key = object id
-		// Value = data sent by object
-		std::map<u16, std::vector<ActiveObjectMessage>* > buffered_messages;
+		/*
+			Every message is serialized once into a buffer shared by
+			all clients, the packets of the clients are built from
+			ranges of it.
+		*/
+		std::string buffer;
+		std::vector<BufferedObjectMessage> messages;
 
 		// Get active object messages from environment
 		for(;;) {
@@ -788,17 +866,21 @@ void Server::AsyncRunStep(bool initial_step)
 			if (aom.id == 0)
 				break;
 
-			std::vector<ActiveObjectMessage>* message_list = NULL;
-			std::map<u16, std::vector<ActiveObjectMessage>* >::iterator n;
-			n = buffered_messages.find(aom.id);
-			if (n == buffered_messages.end()) {
-				message_list = new std::vector<ActiveObjectMessage>;
-				buffered_messages[aom.id] = message_list;
+			BufferedObjectMessage msg;
+			msg.id = aom.id;
+			msg.reliable = aom.reliable;
+			msg.start = buffer.size();
+			append_object_message(buffer, aom.id, aom.datastring);
+			msg.size = buffer.size() - msg.start;
+			if (aom.compact_datastring.empty()) {
+				msg.compact_start = msg.start;
+				msg.compact_size = msg.size;
+			} else {
+				msg.compact_start = buffer.size();
+				append_object_message(buffer, aom.id, aom.compact_datastring);
+				msg.compact_size = buffer.size() - msg.compact_start;
 			}
-			else {
-				message_list = n->second;
-			}
-			message_list->push_back(aom);
+			messages.push_back(msg);
 		}
 
 		m_clients.lock();
@@ -808,37 +890,21 @@ void Server::AsyncRunStep(bool initial_step)
 			i = clients.begin();
 			i != clients.end(); ++i) {
 			RemoteClient *client = i->second;
+			bool compact = client->net_proto_version >= 27;
 			std::string reliable_data;
 			std::string unreliable_data;
-			// Go through all objects in message buffer
-			for (std::map<u16, std::vector<ActiveObjectMessage>* >::iterator
-					j = buffered_messages.begin();
-					j != buffered_messages.end(); ++j) {
+			// Go through all messages in the buffer
+			for (std::vector<BufferedObjectMessage>::iterator
+					j = messages.begin(); j != messages.end(); ++j) {
 				// If object is not known by client, skip it
-				u16 id = j->first;
-				if (client->m_known_objects.find(id) == client->m_known_objects.end())
+				if (client->m_known_objects.find(j->id) == client->m_known_objects.end())
 					continue;
 
-				// Get message list of object
-				std::vector<ActiveObjectMessage>* list = j->second;
-				// Go through every message
-				for (std::vector<ActiveObjectMessage>::iterator
-						k = list->begin(); k != list->end(); ++k) {
-					// Compose the full new data with header
-					ActiveObjectMessage aom = *k;
-					std::string new_data;
-					// Add object id
-					char buf[2];
-					writeU16((u8*)&buf[0], aom.id);
-					new_data.append(buf, 2);
-					// Add data
-					new_data += serializeString(aom.datastring);
-					// Add data to buffer
-					if(aom.reliable)
-						reliable_data += new_data;
-					else
-						unreliable_data += new_data;
-				}
+				std::string &data = j->reliable ? reliable_data : unreliable_data;
+				if (compact)
+					data.append(buffer, j->compact_start, j->compact_size);
+				else
+					data.append(buffer, j->start, j->size);
 			}
 			/*
 				reliable_data and unreliable_data are now ready.
@@ -853,13 +919,6 @@ void Server::AsyncRunStep(bool initial_step)
 			}
 		}
 		m_clients.unlock();
-
-		// Clear buffered_messages
-		for(std::map<u16, std::vector<ActiveObjectMessage>* >::iterator
-				i = buffered_messages.begin();
-				i != buffered_messages.end(); ++i) {
-			delete i->second;
-		}
 	}
 
 	/*
@@ -899,11 +958,13 @@ void Server::AsyncRunStep(bool initial_step)
 				sendAddNode(event->p, event->n, event->already_known_by_peer,
 						&far_players, disable_single_change_sending ? 5 : 30,
 						event->type == MEET_ADDNODE);
+				rescanBlocksAroundNode(event->p);
 				break;
 			case MEET_REMOVENODE:
 				prof.add("MEET_REMOVENODE", 1);
 				sendRemoveNode(event->p, event->already_known_by_peer,
 						&far_players, disable_single_change_sending ? 5 : 30);
+				rescanBlocksAroundNode(event->p);
 				break;
 			case MEET_BLOCK_NODE_METADATA_CHANGED:
 				infostream << "Server: MEET_BLOCK_NODE_METADATA_CHANGED" << std::endl;
@@ -2101,6 +2162,34 @@ void Server::sendAddNode(v3s16 p, MapNode n, u16 ignore_id,
 	}
 }
 
+void Server::rescanBlocksAroundNode(v3s16 p)
+{
+	if (!g_settings->getBool("server_side_occlusion_culling"))
+		return;
+
+	v3s16 blockpos = getNodeBlockPos(p);
+	v3s16 p_rel = p - blockpos * MAP_BLOCKSIZE;
+	std::vector<u16> clients = m_clients.getClientIDs();
+
+	m_clients.lock();
+	for (u8 i = 0; i < 6; i++) {
+		// Only nodes on the face towards the neighbour can uncover it
+		v3s16 p_next = p_rel + g_6dirs[i];
+		if (p_next.X >= 0 && p_next.X < MAP_BLOCKSIZE &&
+				p_next.Y >= 0 && p_next.Y < MAP_BLOCKSIZE &&
+				p_next.Z >= 0 && p_next.Z < MAP_BLOCKSIZE)
+			continue;
+
+		for (std::vector<u16>::iterator j = clients.begin();
+				j != clients.end(); ++j) {
+			RemoteClient *client = m_clients.lockedGetClientNoEx(*j);
+			if (client)
+				client->RescanBlock(blockpos + g_6dirs[i]);
+		}
+	}
+	m_clients.unlock();
+}
+
 void Server::setBlockNotSent(v3s16 p)
 {
 	std::vector<u16> clients = m_clients.getClientIDs();
@@ -2120,13 +2209,12 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto
 	v3s16 p = block->getPos();
 
 	/*
-		Create a packet with the block in the right format
+		Create a packet with the block in the right format.
+		The serialized block is cached in the block, so sending the same
+		block to several clients only compresses it once.
 	*/
 
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver, false);
-	block->serializeNetworkSpecific(os, net_proto_version);
-	std::string s = os.str();
+	const std::string &s = block->getNetworkBlob(ver, net_proto_version);
 
 	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + 2 + s.size(), peer_id);
 
@@ -2135,6 +2223,36 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto
 	Send(&pkt);
 }
 
+/*
+	Selects the blocks to send to one client. The jobs of all clients
+	run at once while the server thread holds the environment lock.
+*/
+class BlockSelectJob : public WorkerPool::Job
+{
+public:
+	BlockSelectJob(RemoteClient *client, ServerEnvironment *env,
+			EmergeManager *emerge, float dtime):
+		m_client(client),
+		m_env(env),
+		m_emerge(emerge),
+		m_dtime(dtime)
+	{}
+
+	void run()
+	{
+		m_client->GetNextBlocks(m_env, m_emerge, m_dtime, blocks, used_blocks);
+	}
+
+	std::vector<PrioritySortedBlockTransfer> blocks;
+	std::vector<MapBlock *> used_blocks;
+
+private:
+	RemoteClient *m_client;
+	ServerEnvironment *m_env;
+	EmergeManager *m_emerge;
+	float m_dtime;
+};
+
 void Server::SendBlocks(float dtime)
 {
 	DSTACK(FUNCTION_NAME);
@@ -2153,6 +2271,9 @@ void Server::SendBlocks(float dtime)
 
 		std::vector<u16> clients = m_clients.getClientIDs();
 
+		std::vector<BlockSelectJob> jobs;
+		jobs.reserve(clients.size());
+
 		m_clients.lock();
 		for(std::vector<u16>::iterator i = clients.begin();
 			i != clients.end(); ++i) {
@@ -2162,9 +2283,33 @@ void Server::SendBlocks(float dtime)
 				continue;
 
 			total_sending += client->SendingCount();
-			client->GetNextBlocks(m_env,m_emerge, dtime, queue);
+			jobs.push_back(BlockSelectJob(client, m_env, m_emerge, dtime));
+		}
+
+		if (m_block_send_workers) {
+			std::vector<WorkerPool::Job *> job_ptrs;
+			job_ptrs.reserve(jobs.size());
+			for(size_t i = 0; i < jobs.size(); i++)
+				job_ptrs.push_back(&jobs[i]);
+			m_block_send_workers->run(job_ptrs);
+		} else {
+			for(size_t i = 0; i < jobs.size(); i++)
+				jobs[i].run();
 		}
 		m_clients.unlock();
+
+		for(std::vector<BlockSelectJob>::iterator
+				job = jobs.begin(); job != jobs.end(); ++job) {
+			queue.insert(queue.end(), job->blocks.begin(), job->blocks.end());
+			// These blocks will be of use in the future. Their opaque
+			// faces are updated for the occlusion check of the next time.
+			for(std::vector<MapBlock *>::iterator
+					i = job->used_blocks.begin();
+					i != job->used_blocks.end(); ++i) {
+				(*i)->resetUsageTimer();
+				(*i)->getOpaqueFaces();
+			}
+		}
 	}
 
 	// Sort.
@@ -2192,6 +2337,11 @@ void Server::SendBlocks(float dtime)
 			continue;
 		}
 
+		// The selection doesn't update expired day-night differences.
+		// Far blocks are only sent if they are near ground level.
+		if(q.priority >= 4 && block->getDayNightDiff() == false)
+			continue;
+
 		RemoteClient *client = m_clients.lockedGetClientNoEx(q.peer_id, CS_Active);
 
 		if(!client)
@@ -3387,6 +3537,167 @@ PlayerSAO* Server::emergePlayer(const char *name, u16 peer_id, u16 proto_version
 	return playersao;
 }
 
+struct PregenerateProgress {
+	Mutex mutex;
+	u32 chunks_done;
+	u32 chunks_existing;
+	u32 chunks_failed;
+};
+
+static void pregenerate_callback(v3s16 blockpos, EmergeAction action,
+	void *param)
+{
+	PregenerateProgress *progress = (PregenerateProgress *)param;
+
+	MutexAutoLock lock(progress->mutex);
+	progress->chunks_done++;
+	if (action == EMERGE_FROM_MEMORY || action == EMERGE_FROM_DISK)
+		progress->chunks_existing++;
+	else if (action != EMERGE_GENERATED)
+		progress->chunks_failed++;
+}
+
+bool Server::pregenerateMap(v3s16 blockpos_min, v3s16 blockpos_max, bool &kill)
+{
+	DSTACK(FUNCTION_NAME);
+
+	// Blocks over the limit are dropped by the emerge threads without
+	// running their callbacks, so never ask for them
+	s16 limit = MYMIN(MAX_MAP_GENERATION_LIMIT,
+		g_settings->getU16("map_generation_limit")) / MAP_BLOCKSIZE;
+	sortBoxVerticies(blockpos_min, blockpos_max);
+	blockpos_min.X = MYMAX(blockpos_min.X, -limit);
+	blockpos_min.Y = MYMAX(blockpos_min.Y, -limit);
+	blockpos_min.Z = MYMAX(blockpos_min.Z, -limit);
+	blockpos_max.X = MYMIN(blockpos_max.X, limit);
+	blockpos_max.Y = MYMIN(blockpos_max.Y, limit);
+	blockpos_max.Z = MYMIN(blockpos_max.Z, limit);
+	if (blockpos_min.X > blockpos_max.X || blockpos_min.Y > blockpos_max.Y ||
+			blockpos_min.Z > blockpos_max.Z) {
+		errorstream << "Pregenerate: area is outside of the map generation limit"
+			<< std::endl;
+		return false;
+	}
+
+	// A whole mapchunk is made at once, so one block of each is queued
+	s16 csize = m_emerge->params.chunksize;
+	u32 blocks_per_chunk = csize * csize * csize;
+	v3s16 chunk_first = EmergeManager::getContainingChunk(blockpos_min, csize);
+	v3s16 chunk_count = (blockpos_max - chunk_first) / csize + v3s16(1, 1, 1);
+	u32 chunks_total = chunk_count.X * chunk_count.Y * chunk_count.Z;
+
+	actionstream << "Pregenerating " << chunks_total << " mapchunks in "
+		<< PP(blockpos_min * MAP_BLOCKSIZE) << " - "
+		<< PP((blockpos_max + v3s16(1, 1, 1)) * MAP_BLOCKSIZE - v3s16(1, 1, 1))
+		<< std::endl;
+
+	PregenerateProgress progress;
+	progress.chunks_done = 0;
+	progress.chunks_existing = 0;
+	progress.chunks_failed = 0;
+
+	v3s16 chunk = chunk_first;
+	u32 chunks_queued = 0;
+	u32 chunks_done = 0;
+	u32 start_time = porting::getTimeMs();
+	u32 last_time = start_time;
+	static const float map_timer_and_unload_dtime = 2.92;
+	IntervalLimiter unload_interval;
+	IntervalLimiter report_interval;
+
+	m_emerge->startThreads();
+
+	while (!kill) {
+		// Keep the emerge queue full; it refuses blocks once it is at
+		// its limit
+		while (chunks_queued < chunks_total) {
+			v3s16 blockpos(
+				MYMAX(chunk.X, blockpos_min.X),
+				MYMAX(chunk.Y, blockpos_min.Y),
+				MYMAX(chunk.Z, blockpos_min.Z));
+			if (!m_emerge->enqueueBlockEmergeEx(blockpos, PEER_ID_INEXISTENT,
+					BLOCK_EMERGE_ALLOW_GEN, pregenerate_callback, &progress))
+				break;
+			chunks_queued++;
+
+			// Go through columns so that neighbouring chunks are made
+			// close in time and can be unloaded together
+			chunk.Y += csize;
+			if (chunk.Y > blockpos_max.Y) {
+				chunk.Y = chunk_first.Y;
+				chunk.X += csize;
+				if (chunk.X > blockpos_max.X) {
+					chunk.X = chunk_first.X;
+					chunk.Z += csize;
+				}
+			}
+		}
+
+		sleep_ms(50);
+
+		u32 time_now = porting::getTimeMs();
+		float dtime = (time_now - last_time) / 1000.0;
+		last_time = time_now;
+
+		{
+			MutexAutoLock lock(progress.mutex);
+			chunks_done = progress.chunks_done;
+		}
+		bool finished = chunks_done == chunks_total;
+
+		{
+			MutexAutoLock envlock(m_env_mutex);
+
+			m_emerge->finishGeneratedChunks(this);
+
+			// Unloading saves the modified blocks in one transaction
+			if (unload_interval.step(dtime, map_timer_and_unload_dtime) ||
+					finished) {
+				m_env->getMap().timerUpdate(map_timer_and_unload_dtime,
+					g_settings->getFloat("server_unload_unused_data_timeout"),
+					U32_MAX);
+			}
+		}
+
+		std::string async_err = m_async_fatal_error.get();
+		if (!async_err.empty())
+			throw ServerError(async_err);
+
+		if (report_interval.step(dtime, 5.0) || finished) {
+			float elapsed = MYMAX(time_now - start_time, 1) / 1000.0;
+			u32 chunks_generated, chunks_failed;
+			{
+				MutexAutoLock lock(progress.mutex);
+				chunks_generated = progress.chunks_done -
+					progress.chunks_existing - progress.chunks_failed;
+				chunks_failed = progress.chunks_failed;
+			}
+			actionstream << "Pregenerate: " << chunks_done << "/"
+				<< chunks_total << " mapchunks ("
+				<< (100.0 * chunks_done / chunks_total) << "%), "
+				<< chunks_generated * blocks_per_chunk << " blocks generated, "
+				<< (u32)(chunks_generated * blocks_per_chunk / elapsed)
+				<< " blocks/s";
+			if (chunks_failed != 0)
+				actionstream << ", " << chunks_failed << " failed";
+			actionstream << std::endl;
+		}
+
+		if (finished)
+			break;
+	}
+
+	// Stop the threads while the counters their callbacks use still exist
+	m_emerge->stopThreads();
+
+	MutexAutoLock envlock(m_env_mutex);
+	m_emerge->finishGeneratedChunks(this);
+	m_env->getMap().save(MOD_STATE_WRITE_NEEDED);
+	m_env->saveMeta();
+
+	return !kill;
+}
+
 void dedicated_server_loop(Server &server, bool &kill)
 {
 	DSTACK(FUNCTION_NAME);
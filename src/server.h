@@ -56,6 +56,7 @@ class GameScripting;
 class ServerEnvironment;
 struct SimpleSoundSpec;
 class ServerThread;
+class WorkerPool;
 
 enum ClientDeletionReason {
 	CDR_LEAVE,
@@ -181,6 +182,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void step(float dtime);
 	// This is run by ServerThread and does the actual processing
 	void AsyncRunStep(bool initial_step=false);
+	// Generates every mapchunk touching the given block area without
+	// serving clients. Returns false if interrupted through kill.
+	bool pregenerateMap(v3s16 blockpos_min, v3s16 blockpos_max, bool &kill);
 	void Receive();
 	PlayerSAO* StageTwoClientInit(u16 peer_id);
 
@@ -382,6 +386,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 private:
 
+	friend class EmergeManager;
 	friend class EmergeThread;
 	friend class RemoteClient;
 
@@ -429,6 +434,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 			std::vector<u16> *far_players=NULL, float far_d_nodes=100,
 			bool remove_metadata=true);
 	void setBlockNotSent(v3s16 p);
+	// Lets clients look at the blocks next to a changed node again,
+	// they might not be hidden anymore
+	void rescanBlocksAroundNode(v3s16 p);
 
 	// Environment and Connection must be locked when called
 	void SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto_version);
@@ -535,6 +543,10 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Emerge manager
 	EmergeManager *m_emerge;
 
+	// Threads selecting the blocks sent to clients,
+	// NULL if the server thread does it alone
+	WorkerPool *m_block_send_workers;
+
 	// Scripting
 	// Envlock and conlock should be locked when using Lua
 	GameScripting *m_script;
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serverobject.h"
 #include <fstream>
 #include "inventory.h"
+#include "environment.h"
 #include "constants.h" // BS
 
 ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
@@ -71,6 +72,29 @@ void ServerActiveObject::registerType(u16 type, Factory f)
 	m_types[type] = f;
 }
 
+void ServerActiveObject::setBasePosition(v3f pos)
+{
+	if (pos == m_base_position)
+		return;
+	m_base_position = pos;
+	if (m_env && m_id != 0)
+		m_env->updateActiveObjectPosition(this);
+}
+
+void ServerActiveObject::markForRemoval()
+{
+	m_removed = true;
+	if (m_env && m_id != 0)
+		m_env->addActiveObjectEvent(m_id);
+}
+
+void ServerActiveObject::markForDeactivation()
+{
+	m_pending_deactivation = true;
+	if (m_env && m_id != 0)
+		m_env->addActiveObjectEvent(m_id);
+}
+
 float ServerActiveObject::getMinimumSavedMovement()
 {
 	return 2.0*BS;
@@ -79,7 +79,8 @@ class ServerActiveObject : public ActiveObject
 		Some simple getters/setters
 	*/
 	v3f getBasePosition(){ return m_base_position; }
-	void setBasePosition(v3f pos){ m_base_position = pos; }
+	// Keeps the environment's object index up to date
+	void setBasePosition(v3f pos);
 	ServerEnvironment* getEnv(){ return m_env; }
 	
 	/*
@@ -218,6 +219,13 @@ class ServerActiveObject : public ActiveObject
 		list.
 	*/
 	bool m_pending_deactivation;
+
+	/*
+		Set m_removed or m_pending_deactivation and let the environment
+		know, so that clients knowing the object are told in the next step.
+	*/
+	void markForRemoval();
+	void markForDeactivation();
 	
 	/*
 		Whether the object's static data has been stored to a block
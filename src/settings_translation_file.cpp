@@ -234,6 +234,12 @@ fake_function() {
 	gettext("Enable selection highlighting for nodes (disables selectionbox).");
 	gettext("Mesh cache");
 	gettext("Enables caching of facedir rotated meshes.");
+	gettext("Mesh generation threads");
+	gettext("Number of threads that generate the meshes of map blocks.\n0 = number of processors minus two, but at least one.");
+	gettext("Greedy meshing");
+	gettext("Joins equal faces of neighbouring nodes into larger faces in both\ndirections of their plane, reducing the number of vertices to draw.");
+	gettext("Batched drawing");
+	gettext("Draws the unchanging geometry of nearby map blocks together, with one\ndraw call per material for every 4x4x4 blocks instead of one per block\nand material.\nUses more video memory.");
 	gettext("Minimap");
 	gettext("Enables minimap.");
 	gettext("Round minimap");
@@ -361,8 +367,14 @@ fake_function() {
 	gettext("From how far clients know about objects, stated in mapblocks (16 nodes).");
 	gettext("Active block range");
 	gettext("How large area of blocks are subject to the active block stuff, stated in mapblocks (16 nodes).\nIn active blocks objects are loaded and ABMs run.");
+	gettext("Number of ABM threads");
+	gettext("Number of extra threads used to find the nodes active block modifiers run on.\n0 scans the active blocks on the server thread only.\nThe ABM actions themselves always run on the server thread.");
 	gettext("Max block send distance");
 	gettext("From how far blocks are sent to clients, stated in mapblocks (16 nodes).");
+	gettext("Number of block send threads");
+	gettext("Number of extra threads used to select the blocks sent to the clients.\n0 selects them on the server thread only.");
+	gettext("Server side occlusion culling");
+	gettext("Don't send blocks to clients that are enclosed by opaque nodes of the\nblocks around them, as they can't be seen.");
 	gettext("Maximum forceloaded blocks");
 	gettext("Maximum number of forceloaded mapblocks.");
 	gettext("Time send interval");
@@ -371,6 +383,8 @@ fake_function() {
 	gettext("Controls length of day/night cycle.\nExamples: 72 = 20min, 360 = 4min, 1 = 24hour, 0 = day/night/whatever stays unchanged.");
 	gettext("Map save interval");
 	gettext("Interval of saving important changes in the world, stated in seconds.");
+	gettext("Number of map save threads");
+	gettext("Number of extra threads used to compress map blocks before they are saved.\nThe blocks are written to the database by a separate thread in any case.");
 	gettext("Physics");
 	gettext("Default acceleration");
 	gettext("Acceleration in air");
@@ -409,9 +423,11 @@ fake_function() {
 	gettext("Liquid loop max");
 	gettext("Max liquids processed per step.");
 	gettext("Liquid queue purge time");
-	gettext("The time (in seconds) that the liquids queue may grow beyond processing\ncapacity until an attempt is made to decrease its size by dumping old queue\nitems.  A value of 0 disables the functionality.");
+	gettext("The time (in seconds) that the liquids queue may grow beyond processing\ncapacity until an attempt is made to decrease its size by setting aside the\nupdates of the blocks farthest from the players until there is time for\nthem.  A value of 0 disables the functionality.");
 	gettext("Liquid update tick");
 	gettext("Liquid update interval in seconds.");
+	gettext("Number of liquid threads");
+	gettext("Number of extra threads used to transform liquids. The queued liquid\nnodes are split by mapblock and blocks that do not touch each other\nare transformed at the same time.\n0 transforms all liquids on the server thread, in queue order.");
 	gettext("Mapgen");
 	gettext("Mapgen name");
 	gettext("Name of map generator to be used when creating a new world.\nCreating a world in the main menu will override this.");
@@ -30,6 +30,7 @@ content_t t_CONTENT_TORCH;
 content_t t_CONTENT_WATER;
 content_t t_CONTENT_LAVA;
 content_t t_CONTENT_BRICK;
+content_t t_CONTENT_WATER_FLOWING;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -73,7 +74,15 @@ class TestGameDef : public IGameDef {
 };
 
 
-TestGameDef::TestGameDef()
+TestGameDef::TestGameDef() :
+	m_craftdef(NULL),
+	m_texturesrc(NULL),
+	m_shadersrc(NULL),
+	m_soundmgr(NULL),
+	m_eventmgr(NULL),
+	m_scenemgr(NULL),
+	m_rollbackmgr(NULL),
+	m_emergemgr(NULL)
 {
 	m_itemdef = createItemDefManager();
 	m_nodedef = createNodeDefManager();
@@ -162,6 +171,8 @@ void TestGameDef::defineSomeNodes()
 	f.alpha = 128;
 	f.liquid_type = LIQUID_SOURCE;
 	f.liquid_viscosity = 4;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
 	f.is_ground_content = true;
 	f.groups["liquids"] = 3;
 	for(int i = 0; i < 6; i++)
@@ -209,6 +220,24 @@ void TestGameDef::defineSomeNodes()
 	f.is_ground_content = true;
 	idef->registerItem(itemdef);
 	t_CONTENT_BRICK = ndef->set(f.name, f);
+
+	//// Flowing water
+	itemdef = ItemDefinition();
+	itemdef.type = ITEM_NODE;
+	itemdef.name = "default:water_flowing";
+	itemdef.description = "Flowing water";
+	f = ContentFeatures();
+	f.name = itemdef.name;
+	f.alpha = 128;
+	f.liquid_type = LIQUID_FLOWING;
+	f.liquid_viscosity = 4;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	for(int i = 0; i < 6; i++)
+		f.tiledef[i].name = "default_water.png";
+	idef->registerItem(itemdef);
+	t_CONTENT_WATER_FLOWING = ndef->set(f.name, f);
 }
 
 ////
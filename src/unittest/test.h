@@ -141,6 +141,7 @@ extern content_t t_CONTENT_TORCH;
 extern content_t t_CONTENT_WATER;
 extern content_t t_CONTENT_LAVA;
 extern content_t t_CONTENT_BRICK;
+extern content_t t_CONTENT_WATER_FLOWING;
 
 bool run_tests();
 
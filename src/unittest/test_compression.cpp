@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serialization.h"
 #include "nodedef.h"
 #include "noise.h"
+#include "util/serialize.h"
 
 class TestCompression : public TestBase {
 public:
@@ -37,6 +38,9 @@ class TestCompression : public TestBase {
 	void testRLECompression();
 	void testZlibCompression();
 	void testZlibLargeData();
+#if USE_ZSTD
+	void testZstdCompression();
+#endif
 };
 
 static TestCompression g_test_instance;
@@ -46,6 +50,9 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testRLECompression);
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
+#if USE_ZSTD
+	TEST(testZstdCompression);
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -108,7 +115,7 @@ void TestCompression::testZlibCompression()
 	fromdata[3]=1;
 
 	std::ostringstream os(std::ios_base::binary);
-	compress(fromdata, os, SER_FMT_VER_HIGHEST_READ);
+	compress(fromdata, os, SER_FMT_VER_ZSTD - 1);
 
 	std::string str_out = os.str();
 
@@ -121,7 +128,7 @@ void TestCompression::testZlibCompression()
 	std::istringstream is(str_out, std::ios_base::binary);
 	std::ostringstream os2(std::ios_base::binary);
 
-	decompress(is, os2, SER_FMT_VER_HIGHEST_READ);
+	decompress(is, os2, SER_FMT_VER_ZSTD - 1);
 	std::string str_out2 = os2.str();
 
 	infostream << "decompress: ";
@@ -170,3 +177,31 @@ void TestCompression::testZlibLargeData()
 				i, str_decompressed[i], i, data_in[i]);
 	}
 }
+
+#if USE_ZSTD
+void TestCompression::testZstdCompression()
+{
+	std::string data_in;
+	data_in.resize(16384);
+	PseudoRandom pseudorandom(9420);
+	for (u32 i = 0; i < data_in.size(); i++)
+		data_in[i] = pseudorandom.range(0, 3);
+
+	// Two streams back to back, each must stop at its own end
+	std::ostringstream os(std::ios_base::binary);
+	compress(data_in, os, SER_FMT_VER_ZSTD);
+	compress(std::string(), os, SER_FMT_VER_ZSTD);
+	writeU8(os, 42);
+	UASSERT(os.str().size() < data_in.size());
+
+	std::istringstream is(os.str(), std::ios_base::binary);
+	std::ostringstream os1(std::ios_base::binary);
+	decompress(is, os1, SER_FMT_VER_ZSTD);
+	UASSERT(os1.str() == data_in);
+
+	std::ostringstream os2(std::ios_base::binary);
+	decompress(is, os2, SER_FMT_VER_ZSTD);
+	UASSERT(os2.str().empty());
+	UASSERTEQ(int, readU8(is), 42);
+}
+#endif
@@ -0,0 +1,630 @@
+/*
+Minetest
+Copyright (C) 2026 agent <agent@local>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "gamedef.h"
+#include "liquidqueue.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapsector.h"
+#include "nodedef.h"
+#include "noise.h"
+#include "porting.h"
+#include "serialization.h"
+#include "util/directiontables.h"
+#include "util/thread.h"
+
+class TestMap : public TestBase {
+public:
+	TestMap() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMap"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSpreadLight(IGameDef *gamedef);
+	void testUnspreadLight(IGameDef *gamedef);
+	void testUpdateNodeLighting(IGameDef *gamedef);
+	void testSunlightColumn(IGameDef *gamedef);
+	void benchmarkLighting(IGameDef *gamedef);
+	void testTransformLiquids(IGameDef *gamedef);
+	void testLiquidsSetAside(IGameDef *gamedef);
+	void testLiquidQueue();
+};
+
+static TestMap g_test_instance;
+
+void TestMap::runTests(IGameDef *gamedef)
+{
+	TEST(testSpreadLight, gamedef);
+	TEST(testUnspreadLight, gamedef);
+	TEST(testUpdateNodeLighting, gamedef);
+	TEST(testSunlightColumn, gamedef);
+	TEST(benchmarkLighting, gamedef);
+	TEST(testTransformLiquids, gamedef);
+	TEST(testLiquidsSetAside, gamedef);
+	TEST(testLiquidQueue);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+	The recursive implementation that was used before the queued one,
+	kept as a reference for the results and the speed.
+*/
+
+static void unspreadLightRecursive(Map *map, INodeDefManager *ndef,
+		enum LightBank bank, std::map<v3s16, u8> &from_nodes,
+		std::set<v3s16> &light_sources)
+{
+	if (from_nodes.empty())
+		return;
+
+	std::map<v3s16, u8> unlighted_nodes;
+
+	for (std::map<v3s16, u8>::iterator j = from_nodes.begin();
+			j != from_nodes.end(); ++j) {
+		MapBlock *block = map->getBlockNoCreateNoEx(getNodeBlockPos(j->first));
+		if (block == NULL || block->isDummy())
+			continue;
+
+		for (u16 i = 0; i < 6; i++) {
+			v3s16 n2pos = j->first + g_6dirs[i];
+			v3s16 blockpos, relpos;
+			getNodeBlockPosWithOffset(n2pos, blockpos, relpos);
+			MapBlock *block2 = map->getBlockNoCreateNoEx(blockpos);
+			if (block2 == NULL)
+				continue;
+
+			bool is_valid_position;
+			MapNode n2 = block2->getNode(relpos, &is_valid_position);
+			if (!is_valid_position)
+				continue;
+
+			u8 light2 = n2.getLight(bank, ndef);
+			if (light2 >= j->second) {
+				light_sources.insert(n2pos);
+			} else if (ndef->get(n2).light_propagates && light2 != 0) {
+				n2.setLight(bank, 0, ndef);
+				block2->setNode(relpos, n2);
+				unlighted_nodes[n2pos] = light2;
+			}
+		}
+	}
+
+	unspreadLightRecursive(map, ndef, bank, unlighted_nodes, light_sources);
+}
+
+static void spreadLightRecursive(Map *map, INodeDefManager *ndef,
+		enum LightBank bank, std::set<v3s16> &from_nodes)
+{
+	if (from_nodes.empty())
+		return;
+
+	std::set<v3s16> lighted_nodes;
+
+	for (std::set<v3s16>::iterator j = from_nodes.begin();
+			j != from_nodes.end(); ++j) {
+		MapBlock *block = map->getBlockNoCreateNoEx(getNodeBlockPos(*j));
+		if (block == NULL || block->isDummy())
+			continue;
+
+		bool is_valid_position;
+		MapNode n = map->getNodeNoEx(*j, &is_valid_position);
+		u8 oldlight = is_valid_position ? n.getLight(bank, ndef) : 0;
+		u8 newlight = diminish_light(oldlight);
+
+		for (u16 i = 0; i < 6; i++) {
+			v3s16 n2pos = *j + g_6dirs[i];
+			v3s16 blockpos, relpos;
+			getNodeBlockPosWithOffset(n2pos, blockpos, relpos);
+			MapBlock *block2 = map->getBlockNoCreateNoEx(blockpos);
+			if (block2 == NULL)
+				continue;
+
+			MapNode n2 = block2->getNode(relpos, &is_valid_position);
+			if (!is_valid_position)
+				continue;
+
+			u8 light2 = n2.getLight(bank, ndef);
+			if (light2 > undiminish_light(oldlight)) {
+				lighted_nodes.insert(n2pos);
+			} else if (light2 < newlight && ndef->get(n2).light_propagates) {
+				n2.setLight(bank, newlight, ndef);
+				block2->setNode(relpos, n2);
+				lighted_nodes.insert(n2pos);
+			}
+		}
+	}
+
+	spreadLightRecursive(map, ndef, bank, lighted_nodes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+	Makes a map of size * size * size blocks of air with scattered stone
+	and torches, without any light. The positions of the torches are
+	returned.
+*/
+static std::vector<v3s16> makeLightingMap(Map &map, IGameDef *gamedef,
+		s16 size, u32 seed)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	std::vector<v3s16> torches;
+	PseudoRandom pr(seed);
+
+	for (s16 z = 0; z < size; z++)
+	for (s16 x = 0; x < size; x++) {
+		v2s16 p2d(x, z);
+		MapSector *sector = new ServerMapSector(&map, p2d, gamedef);
+		(*map.getSectorsPtr())[p2d] = sector;
+
+		for (s16 y = 0; y < size; y++) {
+			MapBlock *block = sector->createBlankBlock(y);
+			for (s16 rz = 0; rz < MAP_BLOCKSIZE; rz++)
+			for (s16 ry = 0; ry < MAP_BLOCKSIZE; ry++)
+			for (s16 rx = 0; rx < MAP_BLOCKSIZE; rx++) {
+				v3s16 relpos(rx, ry, rz);
+				int r = pr.range(0, 299);
+				MapNode n(CONTENT_AIR);
+				if (r < 75) {
+					n.setContent(t_CONTENT_STONE);
+				} else if (r == 75) {
+					n.setContent(t_CONTENT_TORCH);
+					torches.push_back(block->getPosRelative() + relpos);
+				}
+				n.setLight(LIGHTBANK_DAY, 0, ndef);
+				n.setLight(LIGHTBANK_NIGHT, 0, ndef);
+				block->setNode(relpos, n);
+			}
+		}
+	}
+
+	return torches;
+}
+
+/*
+	Checks that every node has the light its surroundings give it: a node
+	that lets light through has the light of its own source or one less than
+	its brightest neighbour, any other node only that of its own source.
+	Only the correctly spread light satisfies this for all nodes.
+*/
+static bool lightIsSpread(Map &map, s16 size, enum LightBank bank,
+		INodeDefManager *ndef)
+{
+	v3s16 pmax = v3s16(1, 1, 1) * (size * MAP_BLOCKSIZE - 1);
+	for (s16 z = 0; z <= pmax.Z; z++)
+	for (s16 y = 0; y <= pmax.Y; y++)
+	for (s16 x = 0; x <= pmax.X; x++) {
+		v3s16 p(x, y, z);
+		MapNode n = map.getNodeNoEx(p);
+		const ContentFeatures &f = ndef->get(n);
+		u8 expected = f.light_source;
+		if (f.light_propagates) {
+			for (u16 i = 0; i < 6; i++) {
+				bool is_valid_position;
+				MapNode n2 = map.getNodeNoEx(p + g_6dirs[i],
+						&is_valid_position);
+				if (!is_valid_position)
+					continue;
+				expected = MYMAX(expected,
+						diminish_light(n2.getLight(bank, ndef)));
+			}
+		}
+		if (n.getLight(bank, ndef) != expected)
+			return false;
+	}
+	return true;
+}
+
+void TestMap::testSpreadLight(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	Map map(dstream, gamedef);
+	std::vector<v3s16> torches = makeLightingMap(map, gamedef, 2, 42);
+	UASSERT(!torches.empty());
+	UASSERT(!lightIsSpread(map, 2, LIGHTBANK_NIGHT, ndef));
+
+	std::set<v3s16> from(torches.begin(), torches.end());
+	std::map<v3s16, MapBlock*> modified_blocks;
+	map.spreadLight(LIGHTBANK_NIGHT, from, modified_blocks);
+
+	UASSERT(lightIsSpread(map, 2, LIGHTBANK_NIGHT, ndef));
+	UASSERTEQ(size_t, modified_blocks.size(), 8);
+
+	// Spreading again does not change anything
+	modified_blocks.clear();
+	map.spreadLight(LIGHTBANK_NIGHT, from, modified_blocks);
+	UASSERT(modified_blocks.empty());
+}
+
+void TestMap::testUnspreadLight(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	Map map(dstream, gamedef);
+	std::vector<v3s16> torches = makeLightingMap(map, gamedef, 2, 1337);
+
+	std::set<v3s16> from(torches.begin(), torches.end());
+	std::map<v3s16, MapBlock*> modified_blocks;
+	map.spreadLight(LIGHTBANK_NIGHT, from, modified_blocks);
+
+	// Remove every other torch
+	std::map<v3s16, u8> unlight;
+	for (size_t i = 0; i < torches.size(); i += 2) {
+		MapNode n(CONTENT_AIR);
+		n.setLight(LIGHTBANK_NIGHT, 0, ndef);
+		map.setNode(torches[i], n);
+		unlight[torches[i]] = LIGHT_MAX - 1;
+	}
+
+	std::set<v3s16> sources;
+	map.unspreadLight(LIGHTBANK_NIGHT, unlight, sources, modified_blocks);
+	map.spreadLight(LIGHTBANK_NIGHT, sources, modified_blocks);
+
+	UASSERT(lightIsSpread(map, 2, LIGHTBANK_NIGHT, ndef));
+
+	// Removing the rest of the torches leaves no light anywhere
+	unlight.clear();
+	for (size_t i = 1; i < torches.size(); i += 2) {
+		MapNode n(CONTENT_AIR);
+		n.setLight(LIGHTBANK_NIGHT, 0, ndef);
+		map.setNode(torches[i], n);
+		unlight[torches[i]] = LIGHT_MAX - 1;
+	}
+	sources.clear();
+	map.unspreadLight(LIGHTBANK_NIGHT, unlight, sources, modified_blocks);
+	map.spreadLight(LIGHTBANK_NIGHT, sources, modified_blocks);
+
+	for (s16 z = 0; z < 2 * MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < 2 * MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < 2 * MAP_BLOCKSIZE; x++)
+		UASSERT(map.getNodeNoEx(v3s16(x, y, z)).getLight(
+				LIGHTBANK_NIGHT, ndef) == 0);
+}
+
+void TestMap::testUpdateNodeLighting(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	Map map(dstream, gamedef);
+	std::vector<v3s16> torches = makeLightingMap(map, gamedef, 2, 7);
+
+	std::set<v3s16> from(torches.begin(), torches.end());
+	std::map<v3s16, MapBlock*> modified_blocks;
+	map.spreadLight(LIGHTBANK_NIGHT, from, modified_blocks);
+
+	/*
+		Replace some torches with lava, some with stone and some air with
+		lava, keeping the light values as a liquid update does
+	*/
+	std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	PseudoRandom pr(8);
+	for (size_t i = 0; i < torches.size(); i++) {
+		v3s16 p = torches[i];
+		if (i % 3 == 2)
+			p += v3s16(pr.range(-1, 1), pr.range(-1, 1), pr.range(-1, 1));
+		bool is_valid_position;
+		MapNode n = map.getNodeNoEx(p, &is_valid_position);
+		if (!is_valid_position)
+			continue;
+		oldnodes.push_back(std::make_pair(p, n));
+		if (i % 3 == 1)
+			n.setContent(t_CONTENT_STONE);
+		else
+			n.setContent(t_CONTENT_LAVA);
+		map.setNode(p, n);
+	}
+
+	modified_blocks.clear();
+	map.updateNodeLighting(oldnodes, modified_blocks);
+	UASSERT(!modified_blocks.empty());
+
+	// The result is the same as lighting everything from the start
+	UASSERT(lightIsSpread(map, 2, LIGHTBANK_NIGHT, ndef));
+}
+
+void TestMap::testSunlightColumn(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	Map map(dstream, gamedef);
+	makeLightingMap(map, gamedef, 1, 3);
+
+	// A sunlit shaft of air through the block, nothing lit around it
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+		MapNode n(t_CONTENT_STONE);
+		if (x == 8 && z == 8) {
+			n.setContent(CONTENT_AIR);
+			n.setLight(LIGHTBANK_DAY, LIGHT_SUN, ndef);
+			n.setLight(LIGHTBANK_NIGHT, 0, ndef);
+		}
+		map.setNode(v3s16(x, y, z), n);
+	}
+
+	// Block the shaft in the middle
+	v3s16 p(8, 10, 8);
+	std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	oldnodes.push_back(std::make_pair(p, map.getNodeNoEx(p)));
+	MapNode n = map.getNodeNoEx(p);
+	n.setContent(t_CONTENT_STONE);
+	map.setNode(p, n);
+
+	std::map<v3s16, MapBlock*> modified_blocks;
+	map.updateNodeLighting(oldnodes, modified_blocks);
+	UASSERT(map.getNodeNoEx(v3s16(8, 11, 8)).getLight(LIGHTBANK_DAY, ndef)
+			== LIGHT_SUN);
+	for (s16 y = 0; y < 10; y++)
+		UASSERT(map.getNodeNoEx(v3s16(8, y, 8)).getLight(LIGHTBANK_DAY, ndef)
+				== 0);
+
+	// Open it again
+	oldnodes.clear();
+	oldnodes.push_back(std::make_pair(p, map.getNodeNoEx(p)));
+	n = map.getNodeNoEx(p);
+	n.setContent(CONTENT_AIR);
+	map.setNode(p, n);
+
+	map.updateNodeLighting(oldnodes, modified_blocks);
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+		UASSERT(map.getNodeNoEx(v3s16(8, y, 8)).getLight(LIGHTBANK_DAY, ndef)
+				== LIGHT_SUN);
+}
+
+/*
+	Compares the speed of the queued lighting with the recursive one on the
+	same map. Nothing is asserted about the times, they are only logged.
+*/
+void TestMap::benchmarkLighting(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	Map map(dstream, gamedef);
+	std::vector<v3s16> torches = makeLightingMap(map, gamedef, 3, 99);
+
+	MapNode torch(t_CONTENT_TORCH);
+	torch.setLight(LIGHTBANK_NIGHT, 0, ndef);
+	MapNode air(CONTENT_AIR);
+	air.setLight(LIGHTBANK_NIGHT, 0, ndef);
+	std::map<v3s16, u8> unlight;
+	for (size_t i = 0; i < torches.size(); i++)
+		unlight[torches[i]] = LIGHT_MAX - 1;
+
+	u64 t0 = porting::getTimeUs();
+	std::set<v3s16> from_ref(torches.begin(), torches.end());
+	spreadLightRecursive(&map, ndef, LIGHTBANK_NIGHT, from_ref);
+	u64 t1 = porting::getTimeUs();
+	UASSERT(lightIsSpread(map, 3, LIGHTBANK_NIGHT, ndef));
+
+	for (size_t i = 0; i < torches.size(); i++)
+		map.setNode(torches[i], air);
+	u64 t2 = porting::getTimeUs();
+	std::set<v3s16> sources_ref;
+	std::map<v3s16, u8> unlight_ref(unlight);
+	unspreadLightRecursive(&map, ndef, LIGHTBANK_NIGHT, unlight_ref,
+			sources_ref);
+	u64 t3 = porting::getTimeUs();
+	UASSERT(sources_ref.empty());
+	UASSERT(lightIsSpread(map, 3, LIGHTBANK_NIGHT, ndef));
+
+	// The map is dark again, do the same with the queues
+	for (size_t i = 0; i < torches.size(); i++)
+		map.setNode(torches[i], torch);
+	std::map<v3s16, MapBlock*> modified_blocks;
+	u64 t4 = porting::getTimeUs();
+	std::set<v3s16> from(torches.begin(), torches.end());
+	map.spreadLight(LIGHTBANK_NIGHT, from, modified_blocks);
+	u64 t5 = porting::getTimeUs();
+	UASSERT(lightIsSpread(map, 3, LIGHTBANK_NIGHT, ndef));
+
+	for (size_t i = 0; i < torches.size(); i++)
+		map.setNode(torches[i], air);
+	u64 t6 = porting::getTimeUs();
+	std::set<v3s16> sources;
+	map.unspreadLight(LIGHTBANK_NIGHT, unlight, sources, modified_blocks);
+	u64 t7 = porting::getTimeUs();
+	UASSERT(sources.empty());
+	UASSERT(lightIsSpread(map, 3, LIGHTBANK_NIGHT, ndef));
+
+	infostream << "TestMap: lighting " << torches.size() << " torches in "
+		<< 27 << " blocks: spread " << (t1 - t0) << "us recursive, "
+		<< (t5 - t4) << "us queued; unspread " << (t3 - t2)
+		<< "us recursive, " << (t7 - t6) << "us queued" << std::endl;
+}
+
+/*
+	A map that transforms liquids on a worker pool of its own
+*/
+class TestLiquidMap : public Map
+{
+public:
+	TestLiquidMap(IGameDef *gamedef, u32 num_threads):
+		Map(dstream, gamedef)
+	{
+		m_liquid_workers = new WorkerPool("TestLiquid", num_threads);
+	}
+
+	using Map::setLiquidsAside;
+	using Map::requeueLiquids;
+};
+
+static void makeLiquidMap(Map &map, IGameDef *gamedef, u32 seed)
+{
+	makeLightingMap(map, gamedef, 2, seed);
+
+	// Water sources at the top, everything else but stone is air
+	PseudoRandom pr(seed);
+	for (s16 z = 0; z < 2 * MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < 2 * MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < 2 * MAP_BLOCKSIZE; x++) {
+		v3s16 p(x, y, z);
+		MapNode n = map.getNodeNoEx(p);
+		if (n.getContent() == t_CONTENT_TORCH)
+			n.setContent(CONTENT_AIR);
+		if (y == 2 * MAP_BLOCKSIZE - 1 && pr.range(0, 19) == 0) {
+			n.setContent(t_CONTENT_WATER);
+			map.transforming_liquid_add(p);
+		}
+		map.setNode(p, n);
+	}
+}
+
+void TestMap::testTransformLiquids(IGameDef *gamedef)
+{
+	// Without extra threads the same jobs are run on this thread
+	TestLiquidMap map_serial(gamedef, 0);
+	TestLiquidMap map(gamedef, 3);
+	makeLiquidMap(map_serial, gamedef, 5);
+	makeLiquidMap(map, gamedef, 5);
+
+	for (u32 i = 0; i < 20; i++) {
+		std::map<v3s16, MapBlock*> modified_blocks;
+		map_serial.transformLiquids(modified_blocks, std::vector<v3s16>());
+		map.transformLiquids(modified_blocks, std::vector<v3s16>());
+	}
+
+	UASSERTEQ(s32, map_serial.transforming_liquid_size(),
+			map.transforming_liquid_size());
+
+	// The result does not depend on the number of threads
+	u32 num_flowing = 0;
+	for (s16 z = 0; z < 2 * MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < 2 * MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < 2 * MAP_BLOCKSIZE; x++) {
+		v3s16 p(x, y, z);
+		MapNode n1 = map_serial.getNodeNoEx(p);
+		MapNode n2 = map.getNodeNoEx(p);
+		UASSERT(n1.getContent() == n2.getContent());
+		UASSERT(n1.param2 == n2.param2);
+		if (n1.getContent() == t_CONTENT_WATER_FLOWING)
+			num_flowing++;
+	}
+	UASSERT(num_flowing > 0);
+}
+
+void TestMap::testLiquidsSetAside(IGameDef *gamedef)
+{
+	TestLiquidMap map(gamedef, 0);
+	makeLightingMap(map, gamedef, 2, 3);
+	MapNode stone(t_CONTENT_STONE);
+	for (s16 z = 0; z < 2 * MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < 2 * MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < 2 * MAP_BLOCKSIZE; x++)
+		map.setNode(v3s16(x, y, z), stone);
+
+	// A node dug beside a water source in the next block is queued
+	v3s16 p_source(MAP_BLOCKSIZE - 1, 1, 1);
+	v3s16 p_dug(MAP_BLOCKSIZE, 1, 1);
+	MapNode water(t_CONTENT_WATER);
+	MapNode air(CONTENT_AIR);
+	map.setNode(p_source, water);
+	map.setNode(p_dug, air);
+	map.transforming_liquid_add(p_dug);
+
+	// Unload the block of the dug node before the liquids are transformed
+	v3s16 blockpos = getNodeBlockPos(p_dug);
+	MapSector *sector = map.getSectorNoGenerateNoEx(
+			v2s16(blockpos.X, blockpos.Z));
+	MapBlock *block = sector->getBlockNoCreateNoEx(blockpos.Y);
+	map.setLiquidsAside(block);
+	UASSERT(block->getLiquidsPending());
+	UASSERTEQ(s32, map.transforming_liquid_size(), 0);
+	std::ostringstream os(std::ios_base::binary);
+	block->serialize(os, SER_FMT_VER_HIGHEST_WRITE, true);
+	sector->deleteBlock(block);
+
+	// Load it again
+	block = sector->createBlankBlockNoInsert(blockpos.Y);
+	std::istringstream is(os.str(), std::ios_base::binary);
+	block->deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true);
+	sector->insertBlock(block);
+	UASSERT(block->getLiquidsPending());
+	map.requeueLiquids(block);
+	UASSERT(!block->getLiquidsPending());
+
+	// The water flows into the dug node
+	std::map<v3s16, MapBlock*> modified_blocks;
+	map.transformLiquids(modified_blocks, std::vector<v3s16>());
+	UASSERT(map.getNodeNoEx(p_dug).getContent() == t_CONTENT_WATER_FLOWING);
+}
+
+void TestMap::testLiquidQueue()
+{
+	LiquidQueue queue;
+	std::vector<v3s16> nodes;
+
+	// Nodes are queued only once
+	UASSERT(queue.push(v3s16(1, 2, 3)) == true);
+	UASSERT(queue.push(v3s16(1, 2, 3)) == false);
+	UASSERTEQ(u32, queue.size(), 1);
+	queue.pop(10, nodes);
+	UASSERTEQ(size_t, nodes.size(), 1);
+	UASSERT(nodes[0] == v3s16(1, 2, 3));
+	UASSERT(queue.empty());
+
+	// A node can be queued again once it is taken
+	UASSERT(queue.push(v3s16(1, 2, 3)) == true);
+	queue.clear();
+	UASSERT(queue.empty());
+
+	// Without focus, blocks are taken in the order they were queued
+	queue.push(v3s16(-40, 0, 0));
+	queue.push(v3s16(80, 0, 0));
+	queue.push(v3s16(-41, 0, 0));
+	queue.push(v3s16(0, 0, 0));
+	nodes.clear();
+	queue.pop(3, nodes);
+	UASSERTEQ(size_t, nodes.size(), 3);
+	UASSERT(nodes[0] == v3s16(-40, 0, 0));
+	UASSERT(nodes[1] == v3s16(-41, 0, 0));
+	UASSERT(nodes[2] == v3s16(80, 0, 0));
+	UASSERTEQ(u32, queue.size(), 1);
+	queue.clear();
+
+	// Blocks nearest to the focus are taken first
+	queue.push(v3s16(-40, 0, 0));
+	queue.push(v3s16(80, 0, 0));
+	queue.push(v3s16(81, 0, 0));
+	queue.push(v3s16(0, 0, 0));
+	std::vector<v3s16> focus;
+	focus.push_back(v3s16(4, 0, 0));
+	focus.push_back(v3s16(-100, 0, 0));
+	queue.setFocus(focus);
+	nodes.clear();
+	queue.pop(2, nodes);
+	UASSERTEQ(size_t, nodes.size(), 2);
+	UASSERT(nodes[0] == v3s16(80, 0, 0));
+	UASSERT(nodes[1] == v3s16(81, 0, 0));
+
+	// The farthest blocks holding enough nodes
+	std::vector<v3s16> blocks;
+	queue.getFarthestBlocks(1, blocks);
+	UASSERTEQ(size_t, blocks.size(), 1);
+	UASSERT(blocks[0] == v3s16(-3, 0, 0));
+	blocks.clear();
+	queue.getFarthestBlocks(2, blocks);
+	UASSERTEQ(size_t, blocks.size(), 2);
+	UASSERT(blocks[1] == v3s16(0, 0, 0));
+
+	UASSERTEQ(u32, queue.removeBlock(v3s16(0, 0, 0)), 1);
+	UASSERTEQ(u32, queue.removeBlock(v3s16(0, 0, 0)), 0);
+	UASSERTEQ(u32, queue.size(), 1);
+
+	UASSERTEQ(u32, queue.getFocusDistance(v3s16(5, 1, 0)), 2);
+	UASSERTEQ(u32, queue.getFocusDistance(v3s16(-98, 0, 0)), 4);
+}
@@ -0,0 +1,353 @@
+/*
+Minetest
+Copyright (C) 2026 agent <agent@local>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <sstream>
+#include "gamedef.h"
+#include "database-dummy.h"
+#include "database-sqlite3.h"
+#include "filesys.h"
+#include "mapblock.h"
+#include "mapsaver.h"
+#include "serialization.h"
+#include "voxel.h"
+
+class TestMapBlock : public TestBase {
+public:
+	TestMapBlock() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapBlock"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testContentHistogram(IGameDef *gamedef);
+	void testContentHistogramDeSerialize(IGameDef *gamedef);
+	void testLiquidsPending(IGameDef *gamedef);
+	void testMapSaver(IGameDef *gamedef);
+	void testMapSaverFailure(IGameDef *gamedef);
+	void testNetworkBlob(IGameDef *gamedef);
+	void testOpaqueFaces(IGameDef *gamedef);
+	void testDatabaseLoadBlocks();
+	void checkLoadBlocks(Database *db);
+};
+
+static TestMapBlock g_test_instance;
+
+void TestMapBlock::runTests(IGameDef *gamedef)
+{
+	TEST(testContentHistogram, gamedef);
+	TEST(testContentHistogramDeSerialize, gamedef);
+	TEST(testLiquidsPending, gamedef);
+	TEST(testMapSaver, gamedef);
+	TEST(testMapSaverFailure, gamedef);
+	TEST(testNetworkBlob, gamedef);
+	TEST(testOpaqueFaces, gamedef);
+	TEST(testDatabaseLoadBlocks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapBlock::testContentHistogram(IGameDef *gamedef)
+{
+	MapBlock dummy(NULL, v3s16(0, 0, 0), gamedef, true);
+	UASSERTEQ(size_t, dummy.getContents().size(), 1);
+	UASSERTEQ(u16, dummy.getContentCount(CONTENT_IGNORE), MapBlock::nodecount);
+
+	MapBlock b(NULL, v3s16(0, 0, 0), gamedef);
+	UASSERTEQ(size_t, b.getContents().size(), 1);
+	UASSERTEQ(u16, b.getContentCount(CONTENT_IGNORE), MapBlock::nodecount);
+	UASSERT(!b.containsContent(CONTENT_AIR));
+
+	MapNode stone(t_CONTENT_STONE);
+	b.setNode(v3s16(1, 2, 3), stone);
+	b.setNode(v3s16(4, 5, 6), stone);
+	UASSERTEQ(size_t, b.getContents().size(), 2);
+	UASSERTEQ(u16, b.getContentCount(t_CONTENT_STONE), 2);
+	UASSERTEQ(u16, b.getContentCount(CONTENT_IGNORE), MapBlock::nodecount - 2);
+
+	// Setting the same content again does not change the counts
+	b.setNodeNoCheck(v3s16(1, 2, 3), stone);
+	UASSERTEQ(u16, b.getContentCount(t_CONTENT_STONE), 2);
+
+	std::set<content_t> wanted;
+	wanted.insert(t_CONTENT_WATER);
+	UASSERT(!b.containsAnyContent(wanted));
+	wanted.insert(t_CONTENT_STONE);
+	UASSERT(b.containsAnyContent(wanted));
+
+	MapNode air(CONTENT_AIR);
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+		b.setNode(v3s16(x, y, z), air);
+	UASSERTEQ(size_t, b.getContents().size(), 1);
+	UASSERTEQ(u16, b.getContentCount(CONTENT_AIR), MapBlock::nodecount);
+	UASSERT(!b.containsContent(t_CONTENT_STONE));
+	UASSERT(!b.containsContent(CONTENT_IGNORE));
+}
+
+void TestMapBlock::testContentHistogramDeSerialize(IGameDef *gamedef)
+{
+	MapBlock b(NULL, v3s16(0, 0, 0), gamedef);
+	MapNode n(t_CONTENT_BRICK);
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+		b.setNode(v3s16(x, 0, z), n);
+
+	std::ostringstream os(std::ios_base::binary);
+	b.serialize(os, SER_FMT_VER_HIGHEST_WRITE, true);
+
+	MapBlock b2(NULL, v3s16(0, 0, 0), gamedef);
+	std::istringstream is(os.str(), std::ios_base::binary);
+	b2.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true);
+
+	UASSERTEQ(size_t, b2.getContents().size(), 2);
+	UASSERTEQ(u16, b2.getContentCount(t_CONTENT_BRICK),
+		MAP_BLOCKSIZE * MAP_BLOCKSIZE);
+	UASSERTEQ(u16, b2.getContentCount(CONTENT_IGNORE),
+		MapBlock::nodecount - MAP_BLOCKSIZE * MAP_BLOCKSIZE);
+}
+
+void TestMapBlock::testLiquidsPending(IGameDef *gamedef)
+{
+	MapBlock b(NULL, v3s16(0, 0, 0), gamedef);
+	UASSERT(b.getLiquidsPending() == false);
+	b.resetModified();
+	b.setLiquidsPending(true);
+	UASSERT(b.getModified() == MOD_STATE_WRITE_NEEDED);
+
+	std::ostringstream os(std::ios_base::binary);
+	b.serialize(os, SER_FMT_VER_HIGHEST_WRITE, true);
+
+	MapBlock b2(NULL, v3s16(0, 0, 0), gamedef);
+	std::istringstream is(os.str(), std::ios_base::binary);
+	b2.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true);
+
+	UASSERT(b2.getLiquidsPending() == true);
+}
+
+void TestMapBlock::testMapSaver(IGameDef *gamedef)
+{
+	Database_Dummy db;
+	MapSaver saver(&db, 1);
+
+	v3s16 pos(1, 2, 3);
+	MapBlock b(NULL, pos, gamedef);
+	MapNode stone(t_CONTENT_STONE);
+	b.setNode(v3s16(4, 5, 6), stone);
+
+	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	std::ostringstream os(std::ios_base::binary);
+	os.write((char *)&version, 1);
+	b.serialize(os, version, true);
+
+	MapBlockSnapshot *snapshot = new MapBlockSnapshot;
+	b.snapshot(snapshot, version);
+	saver.saveBlock(snapshot);
+
+	// Queued blocks are loaded from the saver before they are written
+	UASSERT(saver.loadBlock(pos) == os.str());
+	saver.sync();
+	UASSERT(db.loadBlock(pos) == os.str());
+
+	std::vector<v3s16> positions;
+	positions.push_back(pos);
+	positions.push_back(pos + v3s16(1, 0, 0));
+	std::vector<std::string> blocks;
+	saver.loadBlocks(positions, blocks);
+	UASSERTEQ(size_t, blocks.size(), 2);
+	UASSERT(blocks[0] == os.str());
+	UASSERT(blocks[1] == "");
+
+	saver.deleteBlock(pos);
+	UASSERT(saver.loadBlock(pos) == "");
+	saver.sync();
+	UASSERT(db.loadBlock(pos) == "");
+}
+
+static std::string serialize_network(MapBlock *block, u8 version,
+	u16 net_proto_version)
+{
+	std::ostringstream os(std::ios_base::binary);
+	block->serialize(os, version, false);
+	block->serializeNetworkSpecific(os, net_proto_version);
+	return os.str();
+}
+
+/*
+	A database whose writes fail while told so
+*/
+class FailingDatabase : public Database_Dummy
+{
+public:
+	FailingDatabase() : fail(false) {}
+
+	bool saveBlock(const v3s16 &pos, const std::string &data)
+	{
+		return !fail && Database_Dummy::saveBlock(pos, data);
+	}
+
+	bool fail;
+};
+
+void TestMapBlock::testMapSaverFailure(IGameDef *gamedef)
+{
+	FailingDatabase db;
+	MapSaver saver(&db, 1);
+
+	v3s16 pos(1, 2, 3);
+	MapBlock b(NULL, pos, gamedef);
+	MapNode stone(t_CONTENT_STONE);
+	b.setNode(v3s16(4, 5, 6), stone);
+
+	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	std::ostringstream os(std::ios_base::binary);
+	os.write((char *)&version, 1);
+	b.serialize(os, version, true);
+
+	MapBlockSnapshot *snapshot = new MapBlockSnapshot;
+	b.snapshot(snapshot, version);
+	db.fail = true;
+	saver.saveBlock(snapshot);
+	saver.sync();
+
+	// The block is kept until it can be written
+	UASSERT(db.loadBlock(pos) == "");
+	UASSERT(saver.loadBlock(pos) == os.str());
+
+	// It is written with the next flush
+	db.fail = false;
+	MapBlockSnapshot *other = new MapBlockSnapshot;
+	MapBlock b2(NULL, pos + v3s16(1, 0, 0), gamedef);
+	b2.snapshot(other, version);
+	saver.saveBlock(other);
+	saver.sync();
+	UASSERT(db.loadBlock(pos) == os.str());
+	UASSERT(db.loadBlock(pos + v3s16(1, 0, 0)) != "");
+}
+
+void TestMapBlock::testNetworkBlob(IGameDef *gamedef)
+{
+	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	MapBlock b(NULL, v3s16(0, 0, 0), gamedef);
+	MapNode stone(t_CONTENT_STONE);
+	b.setNode(v3s16(1, 2, 3), stone);
+
+	const std::string &blob = b.getNetworkBlob(version, 20);
+	UASSERT(blob == serialize_network(&b, version, 20));
+	UASSERT(&b.getNetworkBlob(version, 20) == &blob);
+
+	// Every protocol version gets its own blob
+	UASSERT(b.getNetworkBlob(version, 21) == serialize_network(&b, version, 21));
+	UASSERT(b.getNetworkBlob(version, 20) != b.getNetworkBlob(version, 21));
+
+	// Older blobs are dropped to make room for a third one
+	UASSERT(b.getNetworkBlob(version, 22) == serialize_network(&b, version, 22));
+	UASSERT(b.getNetworkBlob(version, 20) == serialize_network(&b, version, 20));
+
+	// And all of them when the block has not been sent for a while
+	b.incrementUsageTimer(MAPBLOCK_NETWORK_BLOB_KEEP + 1);
+	UASSERT(b.getNetworkBlob(version, 20) == serialize_network(&b, version, 20));
+
+	// Modifying the block expires the cached blobs
+	MapNode water(t_CONTENT_WATER);
+	b.setNode(v3s16(1, 2, 3), water);
+	UASSERT(b.getNetworkBlob(version, 21) == serialize_network(&b, version, 21));
+
+	VoxelManipulator vm;
+	vm.addArea(VoxelArea(v3s16(0, 0, 0),
+		v3s16(MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1)));
+	b.copyTo(vm);
+	vm.setNodeNoRef(v3s16(4, 5, 6), stone);
+	b.copyFrom(vm);
+	UASSERT(b.getNodeNoEx(v3s16(4, 5, 6)).getContent() == t_CONTENT_STONE);
+	UASSERT(b.getNetworkBlob(version, 21) == serialize_network(&b, version, 21));
+}
+
+void TestMapBlock::testOpaqueFaces(IGameDef *gamedef)
+{
+	MapBlock b(NULL, v3s16(0, 0, 0), gamedef);
+	UASSERTEQ(u8, b.getOpaqueFaces(), 0);
+
+	MapNode stone(t_CONTENT_STONE);
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+		b.setNode(v3s16(x, y, z), stone);
+	UASSERTEQ(u8, b.getOpaqueFaces(), 0x3f);
+
+	// Transparent nodes inside of the block don't matter
+	MapNode air(CONTENT_AIR);
+	b.setNode(v3s16(5, 5, 5), air);
+	UASSERTEQ(u8, b.getOpaqueFacesNoUpdate(), 0);
+	UASSERTEQ(u8, b.getOpaqueFaces(), 0x3f);
+
+	// Bit 5 is the face towards -X
+	b.setNode(v3s16(0, 5, 5), air);
+	UASSERTEQ(u8, b.getOpaqueFaces(), 0x1f);
+
+	// Corners are part of three faces
+	b.setNode(v3s16(5, 5, 5), stone);
+	b.setNode(v3s16(0, 5, 5), stone);
+	b.setNode(v3s16(MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1, 0), air);
+	UASSERTEQ(u8, b.getOpaqueFaces(), 0x3f & ~(1 << 1 | 1 << 2 | 1 << 3));
+
+	// Loading from disk updates the faces right away
+	std::ostringstream os(std::ios_base::binary);
+	b.serialize(os, SER_FMT_VER_HIGHEST_WRITE, true);
+	MapBlock b2(NULL, v3s16(0, 0, 0), gamedef);
+	std::istringstream is(os.str(), std::ios_base::binary);
+	b2.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true);
+	UASSERTEQ(u8, b2.getOpaqueFacesNoUpdate(), 0x3f & ~(1 << 1 | 1 << 2 | 1 << 3));
+}
+
+void TestMapBlock::testDatabaseLoadBlocks()
+{
+	Database_Dummy dummy;
+	checkLoadBlocks(&dummy);
+
+	std::string dir = getTestTempDirectory() + DIR_DELIM "loadblocks";
+	fs::RecursiveDelete(dir);
+	Database_SQLite3 sqlite(dir);
+	checkLoadBlocks(&sqlite);
+}
+
+void TestMapBlock::checkLoadBlocks(Database *db)
+{
+	// More than fit into one query of any backend
+	std::vector<v3s16> positions;
+	db->beginSave();
+	for (s16 i = -150; i < 150; i++) {
+		v3s16 p(i, i % 7, -i);
+		positions.push_back(p);
+		if (i % 3 != 0)
+			db->saveBlock(p, "block " + itos(i));
+	}
+	db->endSave();
+	// Duplicates get the data too
+	positions.push_back(v3s16(1, 1, -1));
+
+	std::vector<std::string> blocks;
+	db->loadBlocks(positions, blocks);
+	UASSERTEQ(size_t, blocks.size(), positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		UASSERT(blocks[i] == db->loadBlock(positions[i]));
+	UASSERT(blocks[0] == "");
+	UASSERT(blocks.back() == "block 1");
+}
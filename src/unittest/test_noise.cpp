@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include "util/numeric.h"
 #include "exceptions.h"
 #include "noise.h"
 
@@ -34,6 +35,9 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimd();
+
+	void compareSimdMaps(NoiseParams *np, bool is3d, bool use_persistence);
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -48,6 +52,7 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimd);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -120,6 +125,65 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseSimd()
+{
+	u32 flags[] = {
+		0,
+		NOISE_FLAG_EASED,
+		NOISE_FLAG_ABSVALUE,
+		NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE,
+	};
+	float spreads[] = {250, 50, 7.3, 2.5};
+
+	for (u32 i = 0; i != ARRLEN(flags); i++)
+	for (u32 j = 0; j != ARRLEN(spreads); j++) {
+		NoiseParams np(20, 40, v3f(spreads[j], spreads[j] * 0.7, spreads[j]),
+			9, 4, 0.6, 2.0, flags[i]);
+		compareSimdMaps(&np, false, false);
+		compareSimdMaps(&np, false, true);
+		compareSimdMaps(&np, true, false);
+		compareSimdMaps(&np, true, true);
+	}
+
+	noise_set_simd_level(noise_get_max_simd_level());
+	UASSERT(noise_get_simd_level() == noise_get_max_simd_level());
+}
+
+void TestNoise::compareSimdMaps(NoiseParams *np, bool is3d,
+	bool use_persistence)
+{
+	// Sizes that aren't multiples of the vector widths
+	const u32 sx = 21, sy = 13, sz = is3d ? 11 : 1;
+	const u32 bufsize = sx * sy * sz;
+
+	float persistence_map[sx * sy * 11];
+	for (u32 i = 0; i != bufsize; i++)
+		persistence_map[i] = 0.4 + (i % 7) * 0.05;
+	float *pmap = use_persistence ? persistence_map : NULL;
+
+	noise_set_simd_level(NOISE_SIMD_NONE);
+	Noise expected(np, 1337, sx, sy, sz);
+	if (is3d)
+		expected.perlinMap3D(-437.5, 12.25, 9001, pmap);
+	else
+		expected.perlinMap2D(-437.5, 12.25, pmap);
+
+	for (int level = NOISE_SIMD_SSE2;
+			level <= noise_get_max_simd_level(); level++) {
+		noise_set_simd_level((NoiseSimdLevel)level);
+		UASSERT(noise_get_simd_level() == level);
+
+		Noise actual(np, 1337, sx, sy, sz);
+		if (is3d)
+			actual.perlinMap3D(-437.5, 12.25, 9001, pmap);
+		else
+			actual.perlinMap2D(-437.5, 12.25, pmap);
+
+		for (u32 i = 0; i != bufsize; i++)
+			UASSERT(fabs(actual.result[i] - expected.result[i]) <= 0.00001);
+	}
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
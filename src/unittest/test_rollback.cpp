@@ -0,0 +1,87 @@
+/*
+Minetest
+Copyright (C) 2026 agent <agent@local>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "filesys.h"
+#include "rollback.h"
+
+class TestRollback : public TestBase {
+public:
+	TestRollback() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestRollback"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testRecordActions(IGameDef *gamedef);
+};
+
+static TestRollback g_test_instance;
+
+void TestRollback::runTests(IGameDef *gamedef)
+{
+	TEST(testRecordActions, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void reportDigs(RollbackManager *rollback, s16 first, s16 count)
+{
+	RollbackNode stone;
+	stone.name = "default:stone";
+	RollbackNode air;
+	air.name = "air";
+
+	for (s16 i = first; i < first + count; i++) {
+		RollbackAction action;
+		action.setSetNode(v3s16(i, 0, 0), stone, air);
+		rollback->reportAction(action);
+	}
+}
+
+void TestRollback::testRecordActions(IGameDef *gamedef)
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM "rollback";
+	fs::RecursiveDelete(dir);
+	UASSERT(fs::CreateAllDirs(dir));
+
+	RollbackManager *rollback = new RollbackManager(dir, gamedef);
+	rollback->setActor("player:tester", false);
+
+	// More than one batch, the last one still queued
+	reportDigs(rollback, 0, 1234);
+	std::list<RollbackAction> actions = rollback->getEntriesSince(0);
+	UASSERTEQ(size_t, actions.size(), 1234);
+	UASSERT(actions.back().actor == "player:tester");
+	UASSERT(actions.back().n_old.name == "default:stone");
+
+	// Actions still queued are written on shutdown
+	reportDigs(rollback, 1234, 10);
+	delete rollback;
+
+	rollback = new RollbackManager(dir, gamedef);
+	actions = rollback->getNodeActors(v3s16(1240, 0, 0), 0, 1000, 100);
+	UASSERTEQ(size_t, actions.size(), 1);
+	UASSERT(actions.front().p == v3s16(1240, 0, 0));
+	actions = rollback->getEntriesSince(0);
+	UASSERTEQ(size_t, actions.size(), 1244);
+	delete rollback;
+
+	fs::RecursiveDelete(dir);
+}
@@ -19,8 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <sstream>
 #include "util/string.h"
 #include "util/serialize.h"
+#include "genericobject.h"
 
 class TestSerialization : public TestBase {
 public:
@@ -43,6 +45,7 @@ class TestSerialization : public TestBase {
 	void testVecPut();
 	void testStringLengthLimits();
 	void testBufReader();
+	void testCompactPosition();
 
 	std::string teststring2;
 	std::wstring teststring2_w;
@@ -70,6 +73,7 @@ void TestSerialization::runTests(IGameDef *gamedef)
 	TEST(testVecPut);
 	TEST(testStringLengthLimits);
 	TEST(testBufReader);
+	TEST(testCompactPosition);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -632,6 +636,33 @@ void TestSerialization::testBufReader()
 }
 
 
+void TestSerialization::testCompactPosition()
+{
+	v3f pos, vel, acc;
+	f32 yaw, interval;
+	bool interpolate, end;
+
+	std::string full = gob_cmd_update_position(v3f(1.5, -2000, 3),
+		v3f(0, 0, 0), v3f(0, -10, 0), -90, true, false, 0.09);
+	std::string compact = gob_cmd_update_position_compact(v3f(1.5, -2000, 3),
+		v3f(0, 0, 0), v3f(0, -10, 0), -90, true, false, 0.09);
+	// Zero velocity is left out
+	UASSERTEQ(size_t, full.size(), 47);
+	UASSERTEQ(size_t, compact.size(), 30);
+
+	std::istringstream is(compact, std::ios::binary);
+	UASSERTEQ(u8, readU8(is), GENERIC_CMD_UPDATE_POSITION_COMPACT);
+	gob_read_update_position_compact(is, &pos, &vel, &acc, &yaw,
+		&interpolate, &end, &interval);
+	UASSERT(pos == v3f(1.5, -2000, 3));
+	UASSERT(vel == v3f(0, 0, 0));
+	UASSERT(acc == v3f(0, -10, 0));
+	UASSERT(fabs(yaw - 270) < 0.01);
+	UASSERT(interpolate && !end);
+	UASSERT(fabs(interval - 0.09) < 0.001);
+	UASSERTEQ(int, is.peek(), EOF);
+}
+
 const u8 TestSerialization::test_serialized_data[12 * 13] = {
 	0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc,
 	0xdd, 0xee, 0xff, 0x80, 0x75, 0x30, 0xff, 0xff, 0xff, 0xfa, 0xff, 0xff,
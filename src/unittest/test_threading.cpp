@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "threading/atomic.h"
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "util/thread.h"
 
 
 class TestThreading : public TestBase {
@@ -33,6 +34,7 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testThreadKill();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -42,6 +44,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 	TEST(testStartStopWait);
 	TEST(testThreadKill);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -180,3 +183,41 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+class CountingJob : public WorkerPool::Job {
+public:
+	CountingJob() : count(0) {}
+
+	void run()
+	{
+		for (u32 i = 0; i < 1000; ++i)
+			++count;
+	}
+
+	u32 count;
+};
+
+
+void TestThreading::testWorkerPool()
+{
+	std::vector<CountingJob> jobs(100);
+	std::vector<WorkerPool::Job *> job_ptrs;
+	for (size_t i = 0; i < jobs.size(); ++i)
+		job_ptrs.push_back(&jobs[i]);
+
+	// Without threads the jobs run on the calling thread
+	for (u32 num_threads = 0; num_threads <= 4; num_threads += 4) {
+		WorkerPool pool("Test", num_threads);
+		UASSERTEQ(u32, pool.getThreadCount(), num_threads);
+
+		// Batches must not leak into each other
+		for (u32 batch = 1; batch <= 3; ++batch) {
+			pool.run(job_ptrs);
+			for (size_t i = 0; i < jobs.size(); ++i)
+				UASSERTEQ(u32, jobs[i].count, batch * 1000);
+		}
+
+		for (size_t i = 0; i < jobs.size(); ++i)
+			jobs[i].count = 0;
+	}
+}
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include "util/container.h"
 #include "util/numeric.h"
 #include "util/string.h"
 
@@ -48,6 +49,7 @@ class TestUtilities : public TestBase {
 	void testIsNumber();
 	void testIsPowerOfTwo();
 	void testMyround();
+	void testPosHashMap();
 };
 
 static TestUtilities g_test_instance;
@@ -73,6 +75,7 @@ void TestUtilities::runTests(IGameDef *gamedef)
 	TEST(testIsNumber);
 	TEST(testIsPowerOfTwo);
 	TEST(testMyround);
+	TEST(testPosHashMap);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -293,3 +296,52 @@ void TestUtilities::testMyround()
 	UASSERT(myround(-6.5f) == -7);
 }
 
+
+void TestUtilities::testPosHashMap()
+{
+	PosHashMap<int> map;
+	std::map<v3s16, int *> ref;
+	int values[3];
+
+	UASSERT(map.get(v3s16(0, 0, 0)) == NULL);
+	UASSERT(map.erase(v3s16(0, 0, 0)) == false);
+
+	// Enough positions to grow the table several times, with negative
+	// coordinates and neighbours that probe the same slots
+	for (s16 x = -6; x < 6; x++)
+	for (s16 y = -6; y < 6; y++)
+	for (s16 z = -6; z < 6; z++) {
+		v3s16 p(x * 3, y, z * 1000);
+		int *value = &values[(x + y + z + 18) % 3];
+		UASSERT(map.insert(p, value) == true);
+		ref[p] = value;
+	}
+	UASSERTEQ(u32, map.size(), ref.size());
+	UASSERT(map.insert(v3s16(3, 0, 0), &values[0]) == false);
+
+	// Erase every other position, then check all of them
+	bool erase = false;
+	for (std::map<v3s16, int *>::iterator i = ref.begin();
+			i != ref.end(); ++i) {
+		erase = !erase;
+		if (!erase)
+			continue;
+		UASSERT(map.erase(i->first) == true);
+		i->second = NULL;
+	}
+	for (std::map<v3s16, int *>::iterator i = ref.begin();
+			i != ref.end(); ++i)
+		UASSERT(map.get(i->first) == i->second);
+	UASSERTEQ(u32, map.size(), ref.size() / 2);
+
+	// Shrinks while being emptied, and still works afterwards
+	for (std::map<v3s16, int *>::iterator i = ref.begin();
+			i != ref.end(); ++i) {
+		if (i->second != NULL)
+			UASSERT(map.erase(i->first) == true);
+	}
+	UASSERTEQ(u32, map.size(), 0);
+	UASSERT(map.get(v3s16(3, 0, 0)) == NULL);
+	UASSERT(map.insert(v3s16(-32768, 32767, -1), &values[1]) == true);
+	UASSERT(map.get(v3s16(-32768, 32767, -1)) == &values[1]);
+}
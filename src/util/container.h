@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define UTIL_CONTAINER_HEADER
 
 #include "../irrlichttypes.h"
+#include "../irr_v3d.h"
 #include "../exceptions.h"
 #include "../threading/mutex.h"
 #include "../threading/mutex_auto_lock.h"
@@ -30,6 +31,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <map>
 #include <set>
 #include <queue>
+#include <cassert>
 
 /*
 Queue with unique values with fast checking of value existence
@@ -234,6 +236,146 @@ class MutexedQueue
 	Semaphore m_signal;
 };
 
+/*
+Map of v3s16 positions to pointers as a flat hash table with open
+addressing, much faster to look up than a std::map. NULL can not be stored.
+Lookups are safe from several threads while the map is not modified.
+*/
+
+template<typename T>
+class PosHashMap
+{
+public:
+	PosHashMap():
+		m_slots(MIN_SIZE),
+		m_count(0)
+	{
+	}
+
+	T *get(v3s16 p) const
+	{
+		u64 key = packPos(p);
+		for (u32 i = slotIndex(key);; i = (i + 1) & mask()) {
+			const Slot &slot = m_slots[i];
+			if (slot.value == NULL)
+				return NULL;
+			if (slot.key == key)
+				return slot.value;
+		}
+	}
+
+	// Returns false if the position is already in the map
+	bool insert(v3s16 p, T *value)
+	{
+		assert(value != NULL);
+		if ((m_count + 1) * 2 > m_slots.size())
+			rehash(m_slots.size() * 2);
+
+		u64 key = packPos(p);
+		u32 i = slotIndex(key);
+		for (; m_slots[i].value != NULL; i = (i + 1) & mask()) {
+			if (m_slots[i].key == key)
+				return false;
+		}
+		m_slots[i].key = key;
+		m_slots[i].value = value;
+		m_count++;
+		return true;
+	}
+
+	// Returns false if the position is not in the map
+	bool erase(v3s16 p)
+	{
+		u64 key = packPos(p);
+		u32 i = slotIndex(key);
+		for (;; i = (i + 1) & mask()) {
+			if (m_slots[i].value == NULL)
+				return false;
+			if (m_slots[i].key == key)
+				break;
+		}
+
+		// Move the following entries back into the hole if they would
+		// not be found anymore, instead of leaving a tombstone
+		for (u32 j = (i + 1) & mask(); m_slots[j].value != NULL;
+				j = (j + 1) & mask()) {
+			u32 home = slotIndex(m_slots[j].key);
+			if (((j - home) & mask()) >= ((j - i) & mask())) {
+				m_slots[i] = m_slots[j];
+				i = j;
+			}
+		}
+		m_slots[i].value = NULL;
+		m_count--;
+
+		if (m_slots.size() > MIN_SIZE && m_count * 8 < m_slots.size())
+			rehash(m_slots.size() / 2);
+		return true;
+	}
+
+	void clear()
+	{
+		m_slots.assign(MIN_SIZE, Slot());
+		m_count = 0;
+	}
+
+	u32 size() const
+	{
+		return m_count;
+	}
+
+private:
+	// Number of slots at least, a power of two
+	static const u32 MIN_SIZE = 64;
+
+	struct Slot
+	{
+		Slot(): key(0), value(NULL) {}
+
+		u64 key;
+		T *value;
+	};
+
+	static u64 packPos(v3s16 p)
+	{
+		return ((u64)(u16)p.X << 32) | ((u64)(u16)p.Y << 16) | (u16)p.Z;
+	}
+
+	u32 mask() const
+	{
+		return m_slots.size() - 1;
+	}
+
+	u32 slotIndex(u64 key) const
+	{
+		u32 h = (u32)(key >> 32) * 0x9E3779B1U ^
+				(u32)((key >> 16) & 0xFFFF) * 0x85EBCA77U ^
+				(u32)(key & 0xFFFF) * 0xC2B2AE3DU;
+		h ^= h >> 15;
+		h *= 0x2C1B3C6DU;
+		h ^= h >> 12;
+		return h & mask();
+	}
+
+	void rehash(u32 size)
+	{
+		std::vector<Slot> old(size);
+		old.swap(m_slots);
+		for (u32 i = 0; i < old.size(); i++) {
+			const Slot &slot = old[i];
+			if (slot.value == NULL)
+				continue;
+			u32 j = slotIndex(slot.key);
+			while (m_slots[j].value != NULL)
+				j = (j + 1) & mask();
+			m_slots[j] = slot;
+		}
+	}
+
+	std::vector<Slot> m_slots;
+	u32 m_count;
+};
+
 template<typename K, typename V>
 class LRUCache
 {
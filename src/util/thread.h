@@ -24,8 +24,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "../threading/thread.h"
 #include "../threading/mutex.h"
 #include "../threading/mutex_auto_lock.h"
+#include "../threading/semaphore.h"
 #include "porting.h"
 #include "log.h"
+#include "container.h"
+#include <vector>
 
 template<typename T>
 class MutexedVariable {
@@ -235,5 +238,122 @@ class UpdateThread : public Thread
 	Semaphore m_update_sem;
 };
 
+/*
+	A fixed set of worker threads for running batches of independent jobs.
+
+	run() blocks until every job of the batch has finished; the calling
+	thread works on the batch too, so a pool with 0 threads just runs
+	the jobs serially.
+*/
+class WorkerPool
+{
+public:
+	class Job
+	{
+	public:
+		virtual ~Job() {}
+		virtual void run() = 0;
+	};
+
+	WorkerPool(const std::string &name, u32 num_threads) :
+		m_jobs(NULL),
+		m_next_job(0)
+	{
+		for (u32 i = 0; i < num_threads; i++) {
+			WorkerThread *thread = new WorkerThread(name, this);
+			m_threads.push_back(thread);
+			thread->start();
+		}
+	}
+
+	~WorkerPool()
+	{
+		for (u32 i = 0; i < m_threads.size(); i++)
+			m_threads[i]->stop();
+		if (!m_threads.empty())
+			m_work_sem.post(m_threads.size());
+		for (u32 i = 0; i < m_threads.size(); i++) {
+			m_threads[i]->wait();
+			delete m_threads[i];
+		}
+	}
+
+	u32 getThreadCount() const { return m_threads.size(); }
+
+	void run(const std::vector<Job *> &jobs)
+	{
+		{
+			MutexAutoLock lock(m_mutex);
+			m_jobs = &jobs;
+			m_next_job = 0;
+		}
+
+		// Only wake up as many threads as there is work for
+		u32 num_wakeups = MYMIN(m_threads.size(), jobs.size());
+		if (num_wakeups > 0)
+			m_work_sem.post(num_wakeups);
+		runJobs();
+		for (u32 i = 0; i < num_wakeups; i++)
+			m_done_sem.wait();
+
+		MutexAutoLock lock(m_mutex);
+		m_jobs = NULL;
+	}
+
+private:
+	class WorkerThread : public Thread
+	{
+	public:
+		WorkerThread(const std::string &name, WorkerPool *pool) :
+			Thread(name + "Worker"),
+			m_pool(pool)
+		{}
+
+		void *run()
+		{
+			DSTACK(FUNCTION_NAME);
+			BEGIN_DEBUG_EXCEPTION_HANDLER
+
+			while (!stopRequested()) {
+				m_pool->m_work_sem.wait();
+				if (stopRequested())
+					break;
+				m_pool->runJobs();
+				m_pool->m_done_sem.post();
+			}
+
+			END_DEBUG_EXCEPTION_HANDLER
+
+			return NULL;
+		}
+
+	private:
+		WorkerPool *m_pool;
+	};
+
+	void runJobs()
+	{
+		for (;;) {
+			Job *job;
+			{
+				MutexAutoLock lock(m_mutex);
+				if (m_jobs == NULL || m_next_job >= m_jobs->size())
+					return;
+				job = (*m_jobs)[m_next_job++];
+			}
+			job->run();
+		}
+	}
+
+	std::vector<WorkerThread *> m_threads;
+	const std::vector<Job *> *m_jobs;
+	size_t m_next_job;
+	Mutex m_mutex;
+	Semaphore m_work_sem;
+	Semaphore m_done_sem;
+
+	DISABLE_CLASS_COPY(WorkerPool);
+};
+
 #endif
 